@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Measure how long test files take to compile with ctest.h.
+
+Generates a test file with COUNT tests, half CTEST and half CTEST2 in suites
+of 100, and times:
+
+    include     an empty file that only includes ctest.h
+    tests       the generated tests, without CTEST_MAIN
+    runner      a file that defines CTEST_MAIN, i.e. ctest_main and the
+                assertions, which header-only mode compiles per executable
+    header      tests + runner + link, a header-only test executable
+    library     tests + link against the prebuilt ctest library
+
+Each step is the best of --runs. The results are printed as a table, and
+written as JSON with --json so they can be compared across commits.
+
+Usage: compile_benchmark.py --compiler c++ --include include [--library libctest.a]
+"""
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+SUITE_SIZE = 100
+
+
+def generate_tests(count, empty=False):
+    """Return the source of a file with `count` tests, half CTEST and half CTEST2.
+
+    If `empty`, the tests have empty bodies.
+    """
+    lines = ['#include "ctest.h"', ""]
+    suites = (count + SUITE_SIZE - 1) // SUITE_SIZE
+
+    for suite in range(suites):
+        first = suite * SUITE_SIZE
+        size = min(SUITE_SIZE, count - first)
+
+        if suite % 2:
+            name = "fixture_%d" % suite
+            lines.append("CTEST_DATA(%s) { int value; };" % name)
+            lines.append("CTEST_SETUP(%s) { data->value = %d; }" % (name, suite))
+            lines.append("CTEST_TEARDOWN(%s) { data->value = 0; }" % name)
+
+            for test in range(size):
+                body = "" if empty else "ASSERT_EQUAL(%d, data->value); " % suite
+                lines.append("CTEST2(%s, test_%d) { %s}" % (name, first + test, body))
+        else:
+            name = "plain_%d" % suite
+
+            for test in range(size):
+                body = "" if empty else "ASSERT_EQUAL(%d, %d); " % (test, test)
+                lines.append("CTEST(%s, test_%d) { %s}" % (name, first + test, body))
+
+        lines.append("")
+
+    return "\n".join(lines)
+
+
+RUNNER = """#define CTEST_MAIN
+#include "ctest.h"
+"""
+
+MAIN = """#include "ctest.h"
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
+"""
+
+
+def measure(command, runs):
+    best = None
+
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run(command, check=True)
+        elapsed = time.perf_counter() - start
+
+        if best is None or elapsed < best:
+            best = elapsed
+
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--compiler", default="c++")
+    parser.add_argument("--include", required=True, help="the directory with ctest.h")
+    parser.add_argument("--library", help="the prebuilt ctest library, to time library mode")
+    parser.add_argument("--count", type=int, default=10000, help="number of generated tests")
+    parser.add_argument("--runs", type=int, default=3)
+    parser.add_argument("--flags", default="-std=c++17 -O0", help="extra compiler flags")
+    parser.add_argument("--json", help="also write the results to this file")
+    arguments = parser.parse_args()
+
+    flags = arguments.flags.split() + ["-I", arguments.include]
+    results = {"count": arguments.count}
+
+    with tempfile.TemporaryDirectory() as directory:
+        def path(name):
+            return os.path.join(directory, name)
+
+        sources = {
+            "empty.cpp": '#include "ctest.h"\n',
+            "tests.cpp": generate_tests(arguments.count),
+            "runner.cpp": RUNNER,
+            "main.cpp": MAIN,
+        }
+
+        for name, text in sources.items():
+            with open(path(name), "w") as file:
+                file.write(text)
+
+        def compile(name, *extra):
+            return [arguments.compiler] + flags + list(extra) + ["-c", path(name), "-o", path(name + ".o")]
+
+        results["include"] = measure(compile("empty.cpp"), arguments.runs)
+        results["tests"] = measure(compile("tests.cpp"), arguments.runs)
+        results["runner"] = measure(compile("runner.cpp", "-DCTEST_SEGFAULT"), arguments.runs)
+        main_time = measure(compile("main.cpp"), arguments.runs)
+
+        objects = [path("tests.cpp.o"), path("main.cpp.o")]
+        link = [arguments.compiler] + objects + ["-o", path("tests")]
+        results["header"] = results["tests"] + results["runner"] + measure(
+            link[:1] + [path("runner.cpp.o")] + link[1:] + ["-lpthread", "-lm"], arguments.runs
+        )
+
+        if arguments.library:
+            results["library"] = results["tests"] + main_time + measure(
+                link + [arguments.library, "-lpthread", "-lm"], arguments.runs
+            )
+
+    print("%d tests, %s %s" % (arguments.count, arguments.compiler, arguments.flags))
+
+    for name in ("include", "tests", "runner", "header", "library"):
+        if name in results:
+            print("%-10s %8.3f s" % (name, results[name]))
+
+    print("per test   %8.1f us" % (results["tests"] / arguments.count * 1e6))
+
+    if arguments.json:
+        with open(arguments.json, "w") as file:
+            json.dump(results, file, indent=2, sort_keys=True)
+            file.write("\n")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,225 @@
+// Compare the throughput of parser::StreamParser against the original,
+// std::regex based, ctest output scraper.
+//
+// Usage: parser_benchmark [megabytes]
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser.hpp"
+
+namespace legacy {
+
+// The parser as it was before parser::StreamParser, kept as a baseline
+namespace details
+{
+    std::regex const TEST_REGEX {"TEST \\d+/\\d+ (\\w+):(\\w+)"};
+    std::regex const RESULTS_REGEX {
+        "RESULTS: (\\d+) tests \\((\\d+) ok, (\\d+) failed, (\\d+) skipped\\) ran in (\\d+\\.\\d+) ms"
+    };
+}
+
+struct SingleTestCase
+{
+    std::string suite_name;
+    std::string test_name;
+    parser::TestStatus return_status;
+};
+
+struct TestResults
+{
+    std::vector<SingleTestCase> cases;
+
+    unsigned int number_ok;
+    unsigned int number_failed;
+    unsigned int number_skipped;
+    unsigned int number_total;
+    unsigned int total_time;
+};
+
+TestResults parse_std_out(std::string const text)
+{
+    std::stringstream stream(text);
+    std::string buffer;
+    std::vector<SingleTestCase> cases;
+    TestResults output {};
+    bool in_test {false};
+
+    std::smatch matches;
+
+    std::string suite_name;
+    std::string test_name;
+    parser::TestStatus return_status;
+
+    auto add_to_cases = [&suite_name, &test_name, &return_status, &cases](){
+        cases.push_back(SingleTestCase{suite_name, test_name, return_status});
+    };
+
+    while(std::getline(stream, buffer, '\n'))
+    {
+        if (std::regex_search(buffer, matches, details::TEST_REGEX))
+        {
+            in_test = true;
+            suite_name = matches[1];
+            test_name = matches[2];
+
+            continue;
+        }
+
+        if (in_test)
+        {
+            if (buffer == "[OK]")
+            {
+                return_status = parser::TestStatus_OK;
+                add_to_cases();
+
+                continue;
+            }
+            else if (buffer == "[FAILED]")
+            {
+                return_status = parser::TestStatus_FAILED;
+                add_to_cases();
+
+                continue;
+            }
+            else if (buffer == "[SKIPPED]")
+            {
+                return_status = parser::TestStatus_SKIPPED;
+                add_to_cases();
+
+                continue;
+            }
+        }
+
+        if (in_test && std::regex_search(buffer, matches, details::RESULTS_REGEX))
+        {
+            output.cases = cases;
+            output.number_total = std::stoi(matches[1]);
+            output.number_ok = std::stoi(matches[2]);
+            output.number_failed = std::stoi(matches[3]);
+            output.number_skipped = std::stoi(matches[4]);
+            output.total_time = std::stoi(matches[5]);
+
+            break;
+        }
+    }
+
+    return output;
+}
+
+}
+
+
+namespace {
+
+// Build a ctest-like log of roughly `size` bytes, with a mix of statuses and messages.
+std::string make_log(std::size_t size)
+{
+    std::string text;
+    text.reserve(size + 256);
+    unsigned int index = 0;
+    unsigned int failed = 0;
+
+    while (text.size() < size)
+    {
+        ++index;
+        text += "TEST " + std::to_string(index) + "/1000000 suite" + std::to_string(index % 97)
+            + ":test_" + std::to_string(index) + "\n";
+
+        if (index % 5 == 0)
+        {
+            ++failed;
+            text += "[FAIL]\n";
+            text += "  LOG: setup() data=0x5581e2a0 buffer=(nil)\n";
+            text += "  ERR: mytests.cpp:" + std::to_string(index % 300) + "  assertion failed, 123 == 456\n";
+        }
+        else
+        {
+            text += "[OK]\n";
+        }
+    }
+
+    text += "RESULTS: " + std::to_string(index) + " tests (" + std::to_string(index - failed)
+        + " ok, " + std::to_string(failed) + " failed, 0 skipped) ran in 12.5 ms\n";
+
+    return text;
+}
+
+template <typename Function>
+double measure(Function function)
+{
+    // Best of 3, to reduce the noise of a shared machine
+    double best = 0.0;
+
+    for (int run = 0; run < 3; ++run)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        function();
+        std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+
+        if (run == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+
+    return best;
+}
+
+void report(char const* name, std::size_t bytes, double seconds)
+{
+    std::printf("%-24s %10.1f MB/s  (%.3f s)\n", name, (double) bytes / seconds / 1e6, seconds);
+}
+
+}
+
+
+int main(int argc, char const* argv[])
+{
+    std::size_t const megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 32;
+    std::string const text = make_log(megabytes * 1000 * 1000);
+    std::size_t const chunk_size = 64 * 1024;
+    std::size_t cases = 0;
+
+    std::printf("input: %zu bytes\n", text.size());
+
+    report(
+        "legacy_regex",
+        text.size(),
+        measure([&]() { cases = legacy::parse_std_out(text).cases.size(); })
+    );
+    report(
+        "stream_whole",
+        text.size(),
+        measure([&]() { cases = parser::parse_std_out(text).cases.size(); })
+    );
+    report(
+        "stream_chunked_64k",
+        text.size(),
+        measure(
+            [&]()
+            {
+                parser::StreamParser stream;
+                std::string_view const view {text};
+
+                for (std::size_t offset = 0; offset < view.size(); offset += chunk_size)
+                {
+                    stream.feed(view.substr(offset, chunk_size));
+                }
+
+                cases = stream.finish().cases.size();
+            }
+        )
+    );
+
+    std::printf("cases: %zu\n", cases);
+
+    return 0;
+}
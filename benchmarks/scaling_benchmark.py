@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+"""Measure how the ctest runner scales with the number of tests.
+
+Builds one synthetic test executable per --counts entry, with half CTEST and
+half CTEST2 tests (empty bodies) plus one test that runs --assertions
+ASSERT_EQUAL calls when selected, and measures:
+
+    startup      wall time of a run whose filter selects no test
+    discover     the "discover" span of --trace: finding the .ctest section
+    filter       the "filter" span of --trace: suite_filter over every test
+    per_test     wall time per empty test, stdout to /dev/null, minus startup
+    pipe         stdout throughput of the full run when read through a pipe
+    assertions   ASSERT_EQUAL calls per second
+
+Each measurement is the best of --runs. The results are printed as a table,
+and written as JSON with --json so they can be compared across commits.
+
+Usage: scaling_benchmark.py --compiler c++ --include include [--counts 1000,10000,100000]
+"""
+import argparse
+import concurrent.futures
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+from compile_benchmark import generate_tests
+
+HEADER = """#include <stdlib.h>
+
+#define CTEST_MAIN
+#define CTEST_NO_COLORS
+"""
+
+FOOTER = """
+// volatile, so that the compiler can't prove the assertions true
+static volatile long zz_value;
+
+// Only runs assertions when asked to, so that it doesn't skew the other measurements
+CTEST(zz_asserts, loop) {
+    const char* count = getenv("ZZ_ASSERTIONS");
+    const long total = count ? atol(count) : 0;
+    long i;
+    for (i = 0; i < total; i++) {
+        zz_value = i;
+        ASSERT_EQUAL(i, zz_value);
+    }
+}
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
+"""
+
+NO_MATCH = "zz_none"
+
+
+def best_of(runs, function):
+    best = None
+
+    for _ in range(runs):
+        start = time.perf_counter()
+        value = function()
+        elapsed = time.perf_counter() - start
+
+        if best is None or elapsed < best[0]:
+            best = (elapsed, value)
+
+    return best
+
+
+def trace_spans(executable, directory):
+    """Return the durations, in seconds, of the runner's spans in a run that selects no test."""
+    path = os.path.join(directory, "trace.json")
+    subprocess.run([executable, "--trace=" + path, NO_MATCH], check=True, stdout=subprocess.DEVNULL)
+
+    with open(path) as file:
+        events = json.load(file)["traceEvents"]
+
+    return {event["name"]: event["dur"] / 1e6 for event in events if event.get("cat") == "runner"}
+
+
+def measure(executable, count, arguments, directory):
+    def run(*extra, **options):
+        return subprocess.run([executable] + list(extra), check=True, **options)
+
+    devnull = {"stdout": subprocess.DEVNULL}
+    startup, _ = best_of(arguments.runs, lambda: run(NO_MATCH, **devnull))
+    spans = best_of(arguments.runs, lambda: trace_spans(executable, directory))[1]
+    everything, _ = best_of(arguments.runs, lambda: run(**devnull))
+    piped, output = best_of(arguments.runs, lambda: run(stdout=subprocess.PIPE).stdout)
+    environment = dict(os.environ, ZZ_ASSERTIONS=str(arguments.assertions))
+    asserts, _ = best_of(arguments.runs, lambda: run("zz_asserts", env=environment, **devnull))
+
+    return {
+        "startup": startup,
+        "discover": spans.get("discover", 0.0),
+        "filter": spans.get("filter", 0.0),
+        "per_test": max(everything - startup, 0.0) / count,
+        "pipe_bytes": len(output),
+        "pipe": len(output) / piped,
+        "assertions": arguments.assertions / max(asserts - startup, 1e-9),
+    }
+
+
+def commit():
+    try:
+        return subprocess.run(
+            ["git", "describe", "--always", "--dirty"],
+            cwd=os.path.dirname(os.path.abspath(__file__)),
+            capture_output=True,
+            text=True,
+            check=True,
+        ).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ""
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--compiler", default="c++")
+    parser.add_argument("--include", required=True, help="the directory with ctest.h")
+    parser.add_argument("--counts", default="1000,10000,100000", help="comma separated numbers of tests")
+    parser.add_argument("--assertions", type=int, default=100000000)
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--flags", default="-std=c++17 -O2", help="extra compiler flags")
+    parser.add_argument("--json", help="also write the results to this file")
+    arguments = parser.parse_args()
+
+    counts = [int(count) for count in arguments.counts.split(",")]
+    results = {"commit": commit(), "flags": arguments.flags, "counts": {}}
+
+    with tempfile.TemporaryDirectory() as directory:
+        def build(count):
+            source = os.path.join(directory, "tests_%d.cpp" % count)
+            executable = os.path.join(directory, "tests_%d" % count)
+
+            with open(source, "w") as file:
+                file.write(HEADER + generate_tests(count, empty=True) + FOOTER)
+
+            subprocess.run(
+                [arguments.compiler] + arguments.flags.split()
+                + ["-I", arguments.include, source, "-o", executable, "-lpthread", "-lm"],
+                check=True,
+            )
+
+            return executable
+
+        # The builds dominate the run time, and are independent
+        with concurrent.futures.ThreadPoolExecutor() as pool:
+            executables = list(pool.map(build, counts))
+
+        for count, executable in zip(counts, executables):
+            results["counts"][str(count)] = measure(executable, count, arguments, directory)
+
+    print("%s %s" % (arguments.compiler, arguments.flags))
+    print(
+        "%8s %10s %10s %10s %10s %10s %12s"
+        % ("tests", "startup", "discover", "filter", "per test", "pipe", "assertions")
+    )
+
+    for count in counts:
+        result = results["counts"][str(count)]
+        print(
+            "%8d %7.2f ms %7.1f us %7.1f us %7.1f ns %5.1f MB/s %8.1f M/s"
+            % (
+                count,
+                result["startup"] * 1e3,
+                result["discover"] * 1e6,
+                result["filter"] * 1e6,
+                result["per_test"] * 1e9,
+                result["pipe"] / 1e6,
+                result["assertions"] / 1e6,
+            )
+        )
+
+    if arguments.json:
+        with open(arguments.json, "w") as file:
+            json.dump(results, file, indent=2, sort_keys=True)
+            file.write("\n")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
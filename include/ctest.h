@@ -21,6 +21,8 @@
 #endif
 
 #ifdef __cplusplus
+#include <new> /* placement new, for CTEST_DATA */
+
 extern "C" {
 #endif
 
@@ -38,6 +40,7 @@ typedef void (*ctest_nullary_run_func)(void);
 typedef void (*ctest_unary_run_func)(void*);
 typedef void (*ctest_setup_func)(void*);
 typedef void (*ctest_teardown_func)(void*);
+typedef void (*ctest_fixture_func)(void*, int);
 
 union ctest_run_func_union {
     ctest_nullary_run_func nullary;
@@ -71,43 +74,94 @@ struct ctest {
     const char* ttname;  // test name
     union ctest_run_func_union run;
 
-    void* data;
+    size_t data_size;  // of the CTEST_DATA struct given to setup, run and teardown, 0 for none
     ctest_setup_func* setup;
     ctest_teardown_func* teardown;
+    ctest_fixture_func fixture;  // constructs (1) or destroys (0) a C++ CTEST_DATA in place, NULL in C
 
     int skip;
+    int kind;  // enum ctest_kind, how `run` is called
+
+    const char* file;  // where the test is defined
+    int line;
+
+    unsigned int magic;
+};
+
+enum ctest_kind {
+    CTEST_KIND_DEFAULT = 0,
+    CTEST_KIND_ASYNC = 1  // `run` returns a ctest_async::task, see CTEST_ASYNC
+};
+
+// Extra information about a test, kept in its own section so that tests
+// without any don't pay for it
+struct ctest_meta {
+    const char* ssname;
+    const char* ttname;
+    int kind;  // enum ctest_meta_kind
+    const char* const* values;  // NULL terminated
 
     unsigned int magic;
 };
 
+enum ctest_meta_kind {
+    CTEST_META_INPUTS = 1,  // files the test reads, see CTEST_INPUTS
+    CTEST_META_DEPENDS = 2,  // "suite:test" names of the tests it needs, see CTEST_DEPENDS
+    CTEST_META_TAGS = 3,  // one string of comma-separated tags, see CTEST_TAGGED
+    CTEST_META_TIMED = 4  // a test whose result is its timing, see CTEST_COMPLEXITY
+};
+
 #define CTEST_IMPL_NAME(name) ctest_##name
 #define CTEST_IMPL_FNAME(sname, tname) CTEST_IMPL_NAME(sname##_##tname##_run)
 #define CTEST_IMPL_TNAME(sname, tname) CTEST_IMPL_NAME(sname##_##tname)
 #define CTEST_IMPL_DATA_SNAME(sname) CTEST_IMPL_NAME(sname##_data)
-#define CTEST_IMPL_DATA_TNAME(sname, tname) CTEST_IMPL_NAME(sname##_##tname##_data)
 #define CTEST_IMPL_SETUP_FNAME(sname) CTEST_IMPL_NAME(sname##_setup)
 #define CTEST_IMPL_SETUP_FPNAME(sname) CTEST_IMPL_NAME(sname##_setup_ptr)
 #define CTEST_IMPL_SETUP_TPNAME(sname, tname) CTEST_IMPL_NAME(sname##_##tname##_setup_ptr)
 #define CTEST_IMPL_TEARDOWN_FNAME(sname) CTEST_IMPL_NAME(sname##_teardown)
 #define CTEST_IMPL_TEARDOWN_FPNAME(sname) CTEST_IMPL_NAME(sname##_teardown_ptr)
 #define CTEST_IMPL_TEARDOWN_TPNAME(sname, tname) CTEST_IMPL_NAME(sname##_##tname##_teardown_ptr)
+#define CTEST_IMPL_FIXTURE_FNAME(sname) CTEST_IMPL_NAME(sname##_data_lifetime)
 
 #define CTEST_IMPL_MAGIC (0xdeadbeef)
 #ifdef __APPLE__
 #define CTEST_IMPL_SECTION __attribute__ ((used, section ("__DATA, .ctest"), aligned(1)))
+#define CTEST_IMPL_META_SECTION __attribute__ ((used, section ("__DATA, .ctest_meta"), aligned(1)))
 #else
 #define CTEST_IMPL_SECTION __attribute__ ((used, section (".ctest"), aligned(1)))
+#define CTEST_IMPL_META_SECTION __attribute__ ((used, section (".ctest_meta"), aligned(1)))
 #endif
 
-#define CTEST_IMPL_STRUCT(sname, tname, tskip, tdata, tsetup, tteardown) \
+#define CTEST_IMPL_META_NAME(sname, tname, tag) CTEST_IMPL_NAME(sname##_##tname##_##tag)
+#define CTEST_IMPL_META(sname, tname, tag, mkind, ...) \
+    static const char* const CTEST_IMPL_META_NAME(sname, tname, tag##_values)[] = { __VA_ARGS__, NULL }; \
+    static struct ctest_meta CTEST_IMPL_META_NAME(sname, tname, tag) CTEST_IMPL_META_SECTION = { \
+        #sname, \
+        #tname, \
+        mkind, \
+        CTEST_IMPL_META_NAME(sname, tname, tag##_values), \
+        CTEST_IMPL_MAGIC, \
+    }
+
+#define CTEST_IMPL_STRUCT(sname, tname, tskip, tdata_size, tsetup, tteardown) \
+    CTEST_IMPL_STRUCT_FULL(sname, tname, tskip, tdata_size, tsetup, tteardown, NULL, CTEST_KIND_DEFAULT)
+
+#define CTEST_IMPL_STRUCT_KIND(sname, tname, tskip, tdata_size, tsetup, tteardown, tkind) \
+    CTEST_IMPL_STRUCT_FULL(sname, tname, tskip, tdata_size, tsetup, tteardown, NULL, tkind)
+
+#define CTEST_IMPL_STRUCT_FULL(sname, tname, tskip, tdata_size, tsetup, tteardown, tfixture, tkind) \
     static struct ctest CTEST_IMPL_TNAME(sname, tname) CTEST_IMPL_SECTION = { \
         #sname, \
         #tname, \
         { (ctest_nullary_run_func) CTEST_IMPL_FNAME(sname, tname) }, \
-        tdata, \
+        tdata_size, \
         (ctest_setup_func*) tsetup, \
         (ctest_teardown_func*) tteardown, \
+        tfixture, \
         tskip, \
+        tkind, \
+        __FILE__, \
+        __LINE__, \
         CTEST_IMPL_MAGIC, \
     }
 
@@ -119,24 +173,48 @@ struct ctest {
 #define CTEST_TEARDOWN(sname) \
     template <> void CTEST_IMPL_TEARDOWN_FNAME(sname)(struct CTEST_IMPL_DATA_SNAME(sname)* data)
 
+#if __cplusplus >= 201402L
+
+// One setup/teardown pointer per suite, instead of a pair of variables per test
 #define CTEST_DATA(sname) \
     template <typename T> void CTEST_IMPL_SETUP_FNAME(sname)(T* data) { } \
     template <typename T> void CTEST_IMPL_TEARDOWN_FNAME(sname)(T* data) { } \
+    template <typename T> void CTEST_IMPL_FIXTURE_FNAME(sname)(void* data, int construct) { \
+        if (construct) ::new (data) T(); else static_cast<T*>(data)->~T(); \
+    } \
+    template <typename T> static void (*CTEST_IMPL_SETUP_FPNAME(sname))(T*) = &CTEST_IMPL_SETUP_FNAME(sname)<T>; \
+    template <typename T> static void (*CTEST_IMPL_TEARDOWN_FPNAME(sname))(T*) = &CTEST_IMPL_TEARDOWN_FNAME(sname)<T>; \
     struct CTEST_IMPL_DATA_SNAME(sname)
 
-#define CTEST_IMPL_CTEST(sname, tname, tskip) \
-    static void CTEST_IMPL_FNAME(sname, tname)(void); \
-    CTEST_IMPL_STRUCT(sname, tname, tskip, NULL, NULL, NULL); \
-    static void CTEST_IMPL_FNAME(sname, tname)(void)
+#define CTEST_IMPL_CTEST2(sname, tname, tskip) \
+    static void CTEST_IMPL_FNAME(sname, tname)(struct CTEST_IMPL_DATA_SNAME(sname)* data); \
+    CTEST_IMPL_STRUCT_FULL(sname, tname, tskip, sizeof(struct CTEST_IMPL_DATA_SNAME(sname)), &CTEST_IMPL_SETUP_FPNAME(sname)<struct CTEST_IMPL_DATA_SNAME(sname)>, &CTEST_IMPL_TEARDOWN_FPNAME(sname)<struct CTEST_IMPL_DATA_SNAME(sname)>, &CTEST_IMPL_FIXTURE_FNAME(sname)<struct CTEST_IMPL_DATA_SNAME(sname)>, CTEST_KIND_DEFAULT); \
+    static void CTEST_IMPL_FNAME(sname, tname)(struct CTEST_IMPL_DATA_SNAME(sname)* data)
+
+#else
+
+#define CTEST_DATA(sname) \
+    template <typename T> void CTEST_IMPL_SETUP_FNAME(sname)(T* data) { } \
+    template <typename T> void CTEST_IMPL_TEARDOWN_FNAME(sname)(T* data) { } \
+    template <typename T> void CTEST_IMPL_FIXTURE_FNAME(sname)(void* data, int construct) { \
+        if (construct) ::new (data) T(); else static_cast<T*>(data)->~T(); \
+    } \
+    struct CTEST_IMPL_DATA_SNAME(sname)
 
 #define CTEST_IMPL_CTEST2(sname, tname, tskip) \
-    static struct CTEST_IMPL_DATA_SNAME(sname) CTEST_IMPL_DATA_TNAME(sname, tname); \
     static void CTEST_IMPL_FNAME(sname, tname)(struct CTEST_IMPL_DATA_SNAME(sname)* data); \
     static void (*CTEST_IMPL_SETUP_TPNAME(sname, tname))(struct CTEST_IMPL_DATA_SNAME(sname)*) = &CTEST_IMPL_SETUP_FNAME(sname)<struct CTEST_IMPL_DATA_SNAME(sname)>; \
     static void (*CTEST_IMPL_TEARDOWN_TPNAME(sname, tname))(struct CTEST_IMPL_DATA_SNAME(sname)*) = &CTEST_IMPL_TEARDOWN_FNAME(sname)<struct CTEST_IMPL_DATA_SNAME(sname)>; \
-    CTEST_IMPL_STRUCT(sname, tname, tskip, &CTEST_IMPL_DATA_TNAME(sname, tname), &CTEST_IMPL_SETUP_TPNAME(sname, tname), &CTEST_IMPL_TEARDOWN_TPNAME(sname, tname)); \
+    CTEST_IMPL_STRUCT_FULL(sname, tname, tskip, sizeof(struct CTEST_IMPL_DATA_SNAME(sname)), &CTEST_IMPL_SETUP_TPNAME(sname, tname), &CTEST_IMPL_TEARDOWN_TPNAME(sname, tname), &CTEST_IMPL_FIXTURE_FNAME(sname)<struct CTEST_IMPL_DATA_SNAME(sname)>, CTEST_KIND_DEFAULT); \
     static void CTEST_IMPL_FNAME(sname, tname)(struct CTEST_IMPL_DATA_SNAME(sname)* data)
 
+#endif
+
+#define CTEST_IMPL_CTEST(sname, tname, tskip) \
+    static void CTEST_IMPL_FNAME(sname, tname)(void); \
+    CTEST_IMPL_STRUCT(sname, tname, tskip, 0, NULL, NULL); \
+    static void CTEST_IMPL_FNAME(sname, tname)(void)
+
 #else
 
 #define CTEST_SETUP(sname) \
@@ -157,26 +235,200 @@ struct ctest {
 
 #define CTEST_IMPL_CTEST(sname, tname, tskip) \
     static void CTEST_IMPL_FNAME(sname, tname)(void); \
-    CTEST_IMPL_STRUCT(sname, tname, tskip, NULL, NULL, NULL); \
+    CTEST_IMPL_STRUCT(sname, tname, tskip, 0, NULL, NULL); \
     static void CTEST_IMPL_FNAME(sname, tname)(void)
 
 #define CTEST_IMPL_CTEST2(sname, tname, tskip) \
-    static struct CTEST_IMPL_DATA_SNAME(sname) CTEST_IMPL_DATA_TNAME(sname, tname); \
     static void CTEST_IMPL_FNAME(sname, tname)(struct CTEST_IMPL_DATA_SNAME(sname)* data); \
-    CTEST_IMPL_STRUCT(sname, tname, tskip, &CTEST_IMPL_DATA_TNAME(sname, tname), &CTEST_IMPL_SETUP_FPNAME(sname), &CTEST_IMPL_TEARDOWN_FPNAME(sname)); \
+    CTEST_IMPL_STRUCT(sname, tname, tskip, sizeof(struct CTEST_IMPL_DATA_SNAME(sname)), &CTEST_IMPL_SETUP_FPNAME(sname), &CTEST_IMPL_TEARDOWN_FPNAME(sname)); \
     static void CTEST_IMPL_FNAME(sname, tname)(struct CTEST_IMPL_DATA_SNAME(sname)* data)
 
 #endif
 
+/* Runs the selected tests, see the README for the options, and returns the
+ * number of failed tests, or 1 if they couldn't be run. Defined in the file that defines CTEST_MAIN, or in
+ * the prebuilt ctest library. See also ctest_run.
+ */
+int ctest_main(int argc, const char *argv[]);
+
 void CTEST_LOG(const char* fmt, ...) CTEST_IMPL_FORMAT_PRINTF(1, 2);
 void CTEST_ERR(const char* fmt, ...) CTEST_IMPL_FORMAT_PRINTF(1, 2);  // doesn't return
 
+/* Tracing, see --trace
+ *
+ * CTEST_TRACE_SCOPE("name") records a span from there to the end of the
+ * enclosing scope, or to the failed assertion that leaves it. `name` must
+ * outlive the run, e.g. a string literal.
+ */
+uint64_t ctest_trace_begin(const char* name);
+void ctest_trace_end(uint64_t* span);
+
+#define CTEST_IMPL_TRACE_VAR2(line) ctest_trace_span_##line
+#define CTEST_IMPL_TRACE_VAR(line) CTEST_IMPL_TRACE_VAR2(line)
+#define CTEST_TRACE_SCOPE(name) \
+    uint64_t CTEST_IMPL_TRACE_VAR(__LINE__) __attribute__((cleanup(ctest_trace_end))) = ctest_trace_begin(name)
+
+/* Structured events
+ *
+ * When the CTEST_EVENT_FD environment variable names an open file descriptor,
+ * ctest_main writes a binary record to it for every test event, next to the
+ * normal text output. Each record is a struct ctest_event_header followed by
+ * `size` bytes of payload. Integers are in host byte order and every string is
+ * a uint32_t length followed by that many bytes (no NUL terminator).
+ */
+enum ctest_event_type {
+    CTEST_EVENT_TEST_START = 1,  /* u32 index, u32 total, str suite, str test, str tags (as given to CTEST_TAGGED) */
+    CTEST_EVENT_LOG = 2,         /* str message */
+    CTEST_EVENT_ASSERT = 3,      /* u32 line, str file, str message */
+    CTEST_EVENT_TEST_END = 4,    /* u32 status, u64 duration (ns) */
+    CTEST_EVENT_SUMMARY = 5,     /* u32 total, u32 ok, u32 failed, u32 skipped, u64 duration (ns) */
+    CTEST_EVENT_RUSAGE = 6,      /* with --rusage, before TEST_END: u64 max RSS growth (KB), u64 minor
+                                    faults, u64 major faults, u64 voluntary context switches, u64
+                                    involuntary context switches, u64 user time (ns), u64 system time (ns) */
+    CTEST_EVENT_OUTPUT = 7       /* with --capture, before TEST_END: str what the test wrote to fds 1 and 2 */
+};
+
+enum ctest_status {
+    CTEST_STATUS_OK = 0,
+    CTEST_STATUS_FAILED = 1,
+    CTEST_STATUS_SKIPPED = 2,
+    CTEST_STATUS_CACHED = 3,  /* passed in a previous run, not run again */
+    CTEST_STATUS_FLAKY = 4    /* failed, then passed when retried */
+};
+
+struct ctest_event_header {
+    uint32_t size;  /* payload size, excluding this header */
+    uint16_t type;  /* enum ctest_event_type */
+    uint16_t reserved;
+};
+
+/* Programmatic runs
+ *
+ * ctest_run runs the selected tests like ctest_main, without going through a
+ * command line or stdout, and can be called again in the same process. A
+ * zeroed struct ctest_options runs every test once with the usual report.
+ */
+enum ctest_reporter {
+    CTEST_REPORTER_TEXT = 0,   /* the "TEST i/n" lines and the RESULTS line, on stdout */
+    CTEST_REPORTER_NONE = 1,   /* only the callbacks */
+    CTEST_REPORTER_EVENTS = 2  /* the structured event records, to `event_fd`, instead of the text */
+};
+
+struct ctest_options {
+    const char* suite;  /* the suites whose name starts with it, NULL for all */
+    const char* test;  /* with `suite`, the tests whose name starts with it */
+    int jobs;  /* tests run at once, in forked children, 0 for one at a time */
+    int repeat;  /* times the tests are run, 0 for once */
+    enum ctest_reporter reporter;
+    int event_fd;  /* with CTEST_REPORTER_EVENTS */
+    /* Any other option, as given to ctest_main. argv[0] is the program. */
+    int argc;
+    const char** argv;
+};
+
+struct ctest_callbacks {
+    void* context;  /* passed back as is */
+    /* Called in the order of the report. Tests run in --jobs children or on
+     * --coordinator workers are started, then ended, once their result is in.
+     * Either can be NULL. */
+    void (*test_start)(void* context, const char* suite, const char* test, int index, int total);
+    void (*test_end)(void* context, const char* suite, const char* test, enum ctest_status status,
+                     uint64_t duration);  /* in nanoseconds */
+};
+
+struct ctest_run_result {
+    int error;  /* nonzero if the tests couldn't be run, e.g. invalid options */
+    int total;
+    int ok;  /* including cached and flaky tests */
+    int failed;
+    int skipped;
+    int flaky;
+    uint64_t duration;  /* in nanoseconds */
+};
+
+struct ctest_run_result ctest_run(const struct ctest_options* options, struct ctest_callbacks* callbacks);
+
 #define CTEST(sname, tname) CTEST_IMPL_CTEST(sname, tname, 0)
 #define CTEST_SKIP(sname, tname) CTEST_IMPL_CTEST(sname, tname, 1)
 
 #define CTEST2(sname, tname) CTEST_IMPL_CTEST2(sname, tname, 0)
 #define CTEST2_SKIP(sname, tname) CTEST_IMPL_CTEST2(sname, tname, 1)
 
+// The files a test reads. With a result cache, the test is run again when one changes.
+#define CTEST_INPUTS(sname, tname, ...) CTEST_IMPL_META(sname, tname, inputs, CTEST_META_INPUTS, __VA_ARGS__)
+
+/* Run a test only after the given "suite:test" tests, and skip it unless
+ * they all passed. Dependencies that weren't selected are run anyway.
+ */
+#define CTEST_DEPENDS(sname, tname, ...) CTEST_IMPL_META(sname, tname, depends, CTEST_META_DEPENDS, __VA_ARGS__)
+
+/* Tests with comma-separated tags, e.g. CTEST_TAGGED(net, connect, "slow,io").
+ * --tags=slow,-io selects the tests that have one of the tags and none of the
+ * ones starting with '-'.
+ */
+#define CTEST_TAGGED(sname, tname, ttags) \
+    CTEST_IMPL_META(sname, tname, tags, CTEST_META_TAGS, ttags); \
+    CTEST_IMPL_CTEST(sname, tname, 0)
+#define CTEST2_TAGGED(sname, tname, ttags) \
+    CTEST_IMPL_META(sname, tname, tags, CTEST_META_TAGS, ttags); \
+    CTEST_IMPL_CTEST2(sname, tname, 0)
+
+#if defined(CTEST_THREADS) && !defined(_WIN32)
+#define CTEST_IMPL_HAS_THREADS 1
+
+/* Threaded tests (POSIX threads, #define CTEST_THREADS)
+ *
+ * The body of a CTEST_THREADED test runs on `nthreads` threads, which are
+ * released together once all of them are started. Each one gets its index,
+ * from 0 to nthreads-1, as `thread_index`. An assertion failing on a thread
+ * stops only that thread and the test fails once they all finished.
+ */
+void ctest_impl_run_threads(void (*body)(int), int count);
+
+#define CTEST_IMPL_THREAD_FNAME(sname, tname) CTEST_IMPL_NAME(sname##_##tname##_thread)
+#define CTEST_THREADED(sname, tname, nthreads) \
+    static void CTEST_IMPL_THREAD_FNAME(sname, tname)(int thread_index __attribute__((unused))); \
+    static void CTEST_IMPL_FNAME(sname, tname)(void) { \
+        ctest_impl_run_threads(CTEST_IMPL_THREAD_FNAME(sname, tname), nthreads); \
+    } \
+    CTEST_IMPL_STRUCT(sname, tname, 0, 0, NULL, NULL); \
+    static void CTEST_IMPL_THREAD_FNAME(sname, tname)(int thread_index __attribute__((unused)))
+#endif
+
+/* Complexity tests
+ *
+ * The body of a CTEST_COMPLEXITY test runs for each of the sizes, as `n`, and
+ * is timed. The times are fitted to the ctest_complexity models and
+ * EXPECT_COMPLEXITY(N_LOG_N) in the body fails the test once the best fit is
+ * worse than O(n log n). Give sizes far enough apart for the work to dominate
+ * the noise, e.g. CTEST_COMPLEXITY(sort, quick, 1000, 4000, 16000, 64000).
+ * --cpus and --cpu-cache control the environment they are timed in.
+ */
+enum ctest_complexity {
+    CTEST_COMPLEXITY_CONSTANT = 0,
+    CTEST_COMPLEXITY_LOG_N = 1,
+    CTEST_COMPLEXITY_N = 2,
+    CTEST_COMPLEXITY_N_LOG_N = 3,
+    CTEST_COMPLEXITY_N_SQUARED = 4
+};
+
+void ctest_impl_run_complexity(void (*body)(size_t), const size_t* sizes, int count);
+void ctest_impl_expect_complexity(int complexity, const char* caller, int line);
+
+#define CTEST_IMPL_COMPLEXITY_FNAME(sname, tname) CTEST_IMPL_NAME(sname##_##tname##_complexity)
+#define CTEST_IMPL_SIZES_NAME(sname, tname) CTEST_IMPL_NAME(sname##_##tname##_sizes)
+#define CTEST_COMPLEXITY(sname, tname, ...) \
+    static void CTEST_IMPL_COMPLEXITY_FNAME(sname, tname)(size_t n); \
+    static const size_t CTEST_IMPL_SIZES_NAME(sname, tname)[] = { __VA_ARGS__ }; \
+    CTEST_IMPL_META(sname, tname, timed, CTEST_META_TIMED, "complexity"); \
+    static void CTEST_IMPL_FNAME(sname, tname)(void) { \
+        ctest_impl_run_complexity(CTEST_IMPL_COMPLEXITY_FNAME(sname, tname), CTEST_IMPL_SIZES_NAME(sname, tname), \
+                                  (int)(sizeof(CTEST_IMPL_SIZES_NAME(sname, tname)) / sizeof(size_t))); \
+    } \
+    CTEST_IMPL_STRUCT(sname, tname, 0, 0, NULL, NULL); \
+    static void CTEST_IMPL_COMPLEXITY_FNAME(sname, tname)(size_t n)
+#define EXPECT_COMPLEXITY(complexity) ctest_impl_expect_complexity(CTEST_COMPLEXITY_##complexity, __FILE__, __LINE__)
+
 
 void assert_str(const char* cmp, const char* exp, const char* real, const char* caller, int line);
 #define ASSERT_STR(exp, real) assert_str("==", exp, real, __FILE__, __LINE__)
@@ -196,6 +448,14 @@ void assert_data(const unsigned char* exp, size_t expsize,
 #define ASSERT_DATA(exp, expsize, real, realsize) \
     assert_data(exp, expsize, real, realsize, __FILE__, __LINE__)
 
+// Compare with the content of the file at `path`, see --update-golden
+void assert_golden(const char* path, const void* real, size_t realsize, const char* caller, int line);
+#define ASSERT_MATCHES_GOLDEN(path, buf, len) assert_golden(path, buf, len, __FILE__, __LINE__)
+
+// Fail if the peak RSS of the process grew by more than `kb` KB since the test started
+void assert_max_rss_delta(long kb, const char* caller, int line);
+#define ASSERT_MAX_RSS_DELTA(kb) assert_max_rss_delta(kb, __FILE__, __LINE__)
+
 #define CTEST_FLT_EPSILON 1e-5
 #define CTEST_DBL_EPSILON 1e-12
 
@@ -246,6 +506,121 @@ void assert_dbl_compare(const char* cmp, double exp, double real, double tol, co
 #define ASSERT_DBL_LT(v1, v2) assert_dbl_compare("<", v1, v2, 0.0, __FILE__, __LINE__)
 #define ASSERT_DBL_GT(v1, v2) assert_dbl_compare(">", v1, v2, 0.0, __FILE__, __LINE__)
 
+#if defined(__cplusplus) && defined(__cpp_impl_coroutine) && defined(__linux__)
+#define CTEST_IMPL_HAS_ASYNC 1
+
+/* Coroutine tests (C++20, Linux)
+ *
+ * CTEST_ASYNC tests are coroutines. All selected CTEST_ASYNC tests are started
+ * together and run on one thread by an epoll event loop, so tests that mostly
+ * wait on file descriptors or timers overlap their waits. Assertions work as
+ * usual and fail only the test that made them.
+ *
+ * CTEST_ASYNC(suite, name) {
+ *     co_await ctest_async::sleep_for(std::chrono::milliseconds(10));
+ *     co_await ctest_async::readable(fd);
+ *     co_await helper();  // any other ctest_async::task
+ * }
+ */
+}
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace ctest_async {
+
+class task {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+
+        task get_return_object() noexcept {
+            return task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // Resume whoever co_awaited this task. The event loop checks done() on tests.
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() noexcept { }
+        };
+
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_void() noexcept { }
+        void unhandled_exception() noexcept { exception = std::current_exception(); }
+    };
+
+    explicit task(std::coroutine_handle<promise_type> handle) noexcept : m_handle(handle) { }
+    task(task&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) { }
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() { if (m_handle) m_handle.destroy(); }
+
+    std::coroutine_handle<promise_type> handle() const noexcept { return m_handle; }
+    std::coroutine_handle<promise_type> release() noexcept { return std::exchange(m_handle, {}); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        m_handle.promise().continuation = caller;
+        return m_handle;
+    }
+    void await_resume() {
+        if (m_handle.promise().exception) std::rethrow_exception(m_handle.promise().exception);
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+// Register `handle` with the event loop. Return false if it can't wait, in which case it continues immediately.
+bool ctest_impl_async_wait(int fd, unsigned int events, std::coroutine_handle<> handle);
+bool ctest_impl_async_sleep(long long nanoseconds, std::coroutine_handle<> handle);
+
+struct ctest_impl_fd_awaiter {
+    int fd;
+    unsigned int events;
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) { return ctest_impl_async_wait(fd, events, handle); }
+    void await_resume() const noexcept { }
+};
+
+struct ctest_impl_sleep_awaiter {
+    long long nanoseconds;
+
+    bool await_ready() const noexcept { return nanoseconds <= 0; }
+    bool await_suspend(std::coroutine_handle<> handle) { return ctest_impl_async_sleep(nanoseconds, handle); }
+    void await_resume() const noexcept { }
+};
+
+// Suspend until `fd` has data to read (or is closed)
+inline ctest_impl_fd_awaiter readable(int fd) { return {fd, 0x001u /* EPOLLIN */}; }
+
+// Suspend until `fd` can be written to
+inline ctest_impl_fd_awaiter writable(int fd) { return {fd, 0x004u /* EPOLLOUT */}; }
+
+inline ctest_impl_sleep_awaiter sleep_for(std::chrono::nanoseconds duration) {
+    return {static_cast<long long>(duration.count())};
+}
+
+}
+
+#define CTEST_ASYNC(sname, tname) \
+    static ::ctest_async::task CTEST_IMPL_FNAME(sname, tname)(void); \
+    CTEST_IMPL_STRUCT_KIND(sname, tname, 0, 0, NULL, NULL, CTEST_KIND_ASYNC); \
+    static ::ctest_async::task CTEST_IMPL_FNAME(sname, tname)(void)
+
+extern "C" {
+#endif
+
 #ifdef CTEST_MAIN
 
 #include <setjmp.h>
@@ -258,8 +633,11 @@ void assert_dbl_compare(const char* cmp, double exp, double real, double tol, co
 #elif defined(_WIN32)
 #include <io.h>
 #endif
+#include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <wchar.h>
 
 static size_t ctest_errorsize;
@@ -268,9 +646,41 @@ static char* ctest_errormsg;
 static char ctest_errorbuffer[MSG_SIZE];
 static jmp_buf ctest_err;
 static int color_output = 1;
+// Where the text report goes: stdout, or nowhere without CTEST_REPORTER_TEXT
+static FILE* ctest_report;
 static const char* suite_name;
 static const char* test_expression;
 
+#ifdef CTEST_IMPL_HAS_THREADS
+#include <pthread.h>
+#define CTEST_IMPL_THREAD_LOCAL __thread
+
+// Messages from CTEST_THREADED threads share the error buffer and event stream
+static pthread_mutex_t ctest_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+// Set on CTEST_THREADED threads, where CTEST_ERR can't jump to ctest_err
+static CTEST_IMPL_THREAD_LOCAL jmp_buf* ctest_thread_jump;
+static CTEST_IMPL_THREAD_LOCAL int ctest_thread_index = -1;
+#else
+#define CTEST_IMPL_THREAD_LOCAL
+#endif
+
+// The location of the failing assertion, if CTEST_ERR was called by one
+static CTEST_IMPL_THREAD_LOCAL const char* ctest_err_file;
+static CTEST_IMPL_THREAD_LOCAL int ctest_err_line;
+#ifdef CTEST_IMPL_HAS_ASYNC
+// If CTEST_ERR is called from a CTEST_ASYNC test, which can't be longjmp-ed out of
+static int ctest_async_running;
+#endif
+#define CTEST_IMPL_ERR_AT(caller, line, ...) \
+    (ctest_err_file = (caller), ctest_err_line = (line), CTEST_ERR(__VA_ARGS__))
+
+// --profile reads the registers of the code SIGPROF interrupted, which is specific to these
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__)) && (defined(_GNU_SOURCE) || !defined(__STRICT_ANSI__))
+#define CTEST_IMPL_HAS_PROFILE 1
+// A stack address above the frames of the running test body, where --profile stops following them
+static CTEST_IMPL_THREAD_LOCAL const char* ctest_profile_top;
+#endif
+
 typedef int (*ctest_filter_func)(struct ctest*);
 
 #define ANSI_BLACK    "\033[0;30m"
@@ -292,29 +702,240 @@ typedef int (*ctest_filter_func)(struct ctest*);
 #define ANSI_NORMAL   "\033[0m"
 
 CTEST(suite, test) { }
+CTEST_IMPL_META(suite, test, anchor, 0, NULL);
+
+#if defined(CLOCK_MONOTONIC)
+static uint64_t ctest_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+#else
+static uint64_t ctest_now_ns(void) {
+    return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+}
+#endif
+
+#if !defined(_WIN32)
+#include <sys/uio.h>
+
+#define CTEST_IMPL_EVENT_BUFFER_SIZE 65536
+#define CTEST_IMPL_EVENT_MAX_PARTS 8
+
+// Records are batched in ctest_event_buffer and written once per test. Large
+// payloads skip the buffer and go to writev directly.
+static int ctest_event_fd = -1;
+static unsigned char ctest_event_buffer[CTEST_IMPL_EVENT_BUFFER_SIZE];
+static size_t ctest_event_used;
+
+// While set, records are appended here instead of being written, see event_replay
+struct ctest_event_capture {
+    unsigned char* data;
+    size_t used;
+    size_t capacity;
+};
+static struct ctest_event_capture* ctest_event_capture;
+
+static void event_write(struct iovec* parts, int count) {
+    while (count > 0) {
+        ssize_t written = writev(ctest_event_fd, parts, count);
+        if (written < 0) {
+            // The reader went away, stop reporting rather than failing the tests
+            ctest_event_fd = -1;
+            return;
+        }
+        while (count > 0 && (size_t)written >= parts->iov_len) {
+            written -= (ssize_t)parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0) {
+            parts->iov_base = (char*)parts->iov_base + written;
+            parts->iov_len -= (size_t)written;
+        }
+    }
+}
+
+static void event_flush(void) {
+    if (ctest_event_fd < 0 || ctest_event_used == 0) return;
+    struct iovec part = { ctest_event_buffer, ctest_event_used };
+    event_write(&part, 1);
+    ctest_event_used = 0;
+}
+
+// Write a record made of `count` parts. Strings need 2 parts: their length and their bytes.
+static void event_emit(enum ctest_event_type type, struct iovec* parts, int count) {
+    if (ctest_event_fd < 0) return;
+
+    struct ctest_event_header header;
+    struct iovec vector[CTEST_IMPL_EVENT_MAX_PARTS + 2];
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < count; i++) size += parts[i].iov_len;
+
+    header.size = (uint32_t)size;
+    header.type = (uint16_t)type;
+    header.reserved = 0;
+
+    if (ctest_event_capture) {
+        struct ctest_event_capture* capture = ctest_event_capture;
+        if (capture->used + sizeof(header) + size > capture->capacity) {
+            size_t capacity = capture->capacity ? capture->capacity : 256;
+            while (capture->used + sizeof(header) + size > capacity) capacity *= 2;
+            unsigned char* data = (unsigned char*)realloc(capture->data, capacity);
+            if (data == NULL) return;
+            capture->data = data;
+            capture->capacity = capacity;
+        }
+        memcpy(capture->data + capture->used, &header, sizeof(header));
+        capture->used += sizeof(header);
+        for (i = 0; i < count; i++) {
+            memcpy(capture->data + capture->used, parts[i].iov_base, parts[i].iov_len);
+            capture->used += parts[i].iov_len;
+        }
+        return;
+    }
+
+    if (ctest_event_used + sizeof(header) + size <= sizeof(ctest_event_buffer)) {
+        memcpy(ctest_event_buffer + ctest_event_used, &header, sizeof(header));
+        ctest_event_used += sizeof(header);
+        for (i = 0; i < count; i++) {
+            memcpy(ctest_event_buffer + ctest_event_used, parts[i].iov_base, parts[i].iov_len);
+            ctest_event_used += parts[i].iov_len;
+        }
+        return;
+    }
+
+    vector[0].iov_base = ctest_event_buffer;
+    vector[0].iov_len = ctest_event_used;
+    vector[1].iov_base = &header;
+    vector[1].iov_len = sizeof(header);
+    for (i = 0; i < count; i++) vector[i + 2] = parts[i];
+    event_write(vector, count + 2);
+    ctest_event_used = 0;
+}
 
-static void vprint_errormsg(const char* const fmt, va_list ap) CTEST_IMPL_FORMAT_PRINTF(1, 0);
-static void print_errormsg(const char* const fmt, ...) CTEST_IMPL_FORMAT_PRINTF(1, 2);
+#ifdef CTEST_IMPL_HAS_ASYNC
+// Write the records of `capture` and release it
+static void event_replay(struct ctest_event_capture* capture) {
+    if (ctest_event_fd >= 0 && capture->used) {
+        struct iovec parts[2] = { { ctest_event_buffer, ctest_event_used }, { capture->data, capture->used } };
+        event_write(parts, 2);
+        ctest_event_used = 0;
+    }
+    free(capture->data);
+    capture->data = NULL;
+    capture->used = capture->capacity = 0;
+}
+#endif
+
+static void event_string(struct iovec* parts, uint32_t* size, const char* text, size_t length) {
+    *size = (uint32_t)length;
+    parts[0].iov_base = size;
+    parts[0].iov_len = sizeof(*size);
+    parts[1].iov_base = (void*)text;
+    parts[1].iov_len = length;
+}
+
+static void event_open(void) {
+    const char* fd = getenv("CTEST_EVENT_FD");
+    char* end;
+    long value;
+
+    ctest_event_fd = -1;
+    ctest_event_used = 0;
+    if (fd == NULL || fd[0] == 0) return;
+    value = strtol(fd, &end, 10);
+    if (*end == 0 && value >= 0) ctest_event_fd = (int)value;
+}
+
+static void event_test_start(int idx, int total, const struct ctest* test, const char* tags) {
+    if (ctest_event_fd < 0) return;
+    uint32_t numbers[2] = { (uint32_t)idx, (uint32_t)total };
+    uint32_t sizes[3];
+    struct iovec parts[7] = { { numbers, sizeof(numbers) } };
+    event_string(parts + 1, &sizes[0], test->ssname, strlen(test->ssname));
+    event_string(parts + 3, &sizes[1], test->ttname, strlen(test->ttname));
+    event_string(parts + 5, &sizes[2], tags, strlen(tags));
+    event_emit(CTEST_EVENT_TEST_START, parts, 7);
+}
+
+static void event_message(enum ctest_event_type type, const char* text, size_t length) {
+    if (ctest_event_fd < 0) return;
+    uint32_t line = (uint32_t)ctest_err_line;
+    const char* file = ctest_err_file ? ctest_err_file : "";
+    uint32_t sizes[2];
+    struct iovec parts[5] = { { &line, sizeof(line) } };
+    if (type == CTEST_EVENT_LOG) {
+        event_string(parts, &sizes[0], text, length);
+        event_emit(type, parts, 2);
+    } else {
+        event_string(parts + 1, &sizes[0], file, strlen(file));
+        event_string(parts + 3, &sizes[1], text, length);
+        event_emit(type, parts, 5);
+    }
+}
+
+static void event_test_end(enum ctest_status status, uint64_t duration) {
+    if (ctest_event_fd < 0) return;
+    uint32_t value = (uint32_t)status;
+    struct iovec parts[2] = { { &value, sizeof(value) }, { &duration, sizeof(duration) } };
+    event_emit(CTEST_EVENT_TEST_END, parts, 2);
+    event_flush();
+}
 
-static void vprint_errormsg(const char* const fmt, va_list ap) {
+static void event_summary(int total, int num_ok, int num_fail, int num_skip, uint64_t duration) {
+    if (ctest_event_fd < 0) return;
+    uint32_t counts[4] = { (uint32_t)total, (uint32_t)num_ok, (uint32_t)num_fail, (uint32_t)num_skip };
+    struct iovec parts[2] = { { counts, sizeof(counts) }, { &duration, sizeof(duration) } };
+    event_emit(CTEST_EVENT_SUMMARY, parts, 2);
+    event_flush();
+}
+#else
+static int ctest_event_fd = -1;
+struct ctest_event_capture {
+    unsigned char* data;
+    size_t used;
+    size_t capacity;
+};
+static struct ctest_event_capture* ctest_event_capture;
+static void event_flush(void) { }
+static void event_open(void) { }
+static void event_test_start(int idx, int total, const struct ctest* test, const char* tags) {
+    (void)idx; (void)total; (void)test; (void)tags;
+}
+static void event_message(enum ctest_event_type type, const char* text, size_t length) { (void)type; (void)text; (void)length; }
+static void event_test_end(enum ctest_status status, uint64_t duration) { (void)status; (void)duration; }
+static void event_summary(int total, int num_ok, int num_fail, int num_skip, uint64_t duration) {
+    (void)total; (void)num_ok; (void)num_fail; (void)num_skip; (void)duration;
+}
+#endif
+
+static int vprint_errormsg(const char* const fmt, va_list ap) CTEST_IMPL_FORMAT_PRINTF(1, 0);
+static int print_errormsg(const char* const fmt, ...) CTEST_IMPL_FORMAT_PRINTF(1, 2);
+
+static int vprint_errormsg(const char* const fmt, va_list ap) {
     // (v)snprintf returns the number that would have been written
     const int ret = vsnprintf(ctest_errormsg, ctest_errorsize, fmt, ap);
     if (ret < 0) {
         ctest_errormsg[0] = 0x00;
     } else {
         const size_t size = (size_t) ret;
-        const size_t s = (ctest_errorsize <= size ? size -ctest_errorsize : size);
-        // ctest_errorsize may overflow at this point
+        // Once it is full, stay on its terminator
+        const size_t s = (size < ctest_errorsize ? size : ctest_errorsize - 1);
         ctest_errorsize -= s;
         ctest_errormsg += s;
     }
+    return ret;
 }
 
-static void print_errormsg(const char* const fmt, ...) {
+static int print_errormsg(const char* const fmt, ...) {
     va_list argp;
     va_start(argp, fmt);
-    vprint_errormsg(fmt, argp);
+    const int ret = vprint_errormsg(fmt, argp);
     va_end(argp);
+    return ret;
 }
 
 static void msg_start(const char* color, const char* title) {
@@ -322,6 +943,11 @@ static void msg_start(const char* color, const char* title) {
         print_errormsg("%s", color);
     }
     print_errormsg("  %s: ", title);
+#ifdef CTEST_IMPL_HAS_THREADS
+    if (ctest_thread_index >= 0) {
+        print_errormsg("[thread %d] ", ctest_thread_index);
+    }
+#endif
 }
 
 static void msg_end(void) {
@@ -331,95 +957,746 @@ static void msg_end(void) {
     print_errormsg("\n");
 }
 
-void CTEST_LOG(const char* fmt, ...)
-{
-    va_list argp;
-    msg_start(ANSI_BLUE, "LOG");
+static void vprint_message(const char* color, const char* title, enum ctest_event_type type,
+                           const char* fmt, va_list ap) CTEST_IMPL_FORMAT_PRINTF(4, 0);
 
-    va_start(argp, fmt);
-    vprint_errormsg(fmt, argp);
-    va_end(argp);
+static void vprint_message(const char* color, const char* title, enum ctest_event_type type,
+                           const char* fmt, va_list ap) {
+    msg_start(color, title);
+
+    if (ctest_event_fd < 0) {
+        vprint_errormsg(fmt, ap);
+    } else {
+        char* text = ctest_errormsg;
+        const size_t available = ctest_errorsize;
+        va_list copy;
+        va_copy(copy, ap);
+        const int size = vprint_errormsg(fmt, ap);
+        if (size >= 0 && (size_t)size < available) {
+            event_message(type, text, (size_t)size);
+        } else {
+            // The error buffer is full, the event still gets the whole message
+            char scratch[MSG_SIZE];
+            const int length = vsnprintf(scratch, sizeof(scratch), fmt, copy);
+            if (length >= 0) {
+                event_message(type, scratch, (size_t)length < sizeof(scratch) ? (size_t)length : sizeof(scratch) - 1);
+            }
+        }
+        va_end(copy);
+    }
 
     msg_end();
 }
 
-CTEST_IMPL_DIAG_PUSH_IGNORED(missing-noreturn)
+static int ctest_verbose;  // --verbose
 
-void CTEST_ERR(const char* fmt, ...)
-{
-    va_list argp;
-    msg_start(ANSI_YELLOW, "ERR");
+#ifdef CTEST_LAZY_LOG
+#ifndef CTEST_LAZY_LOG_SIZE
+#define CTEST_LAZY_LOG_SIZE 65536
+#endif
+#if CTEST_LAZY_LOG_SIZE < 256
+#error "CTEST_LAZY_LOG_SIZE must be at least 256 bytes"
+#endif
+#define CTEST_IMPL_LOG_MAX_ARGS 32
+#define CTEST_IMPL_LOG_MAX_SPEC 32
+#define CTEST_IMPL_LOG_NULL ((size_t)-1)
 
-    va_start(argp, fmt);
-    vprint_errormsg(fmt, argp);
-    va_end(argp);
+/* CTEST_LAZY_LOG: CTEST_LOG only records its format and arguments in a ring,
+ * which is formatted if the test fails, with --verbose or for CTEST_EVENT_FD.
+ * Strings are copied, as they may not outlive the call. Once the ring is full,
+ * the oldest messages make room.
+ *
+ * An entry is a header, one value per argument (and per '*' width or
+ * precision), then the strings. The format is parsed again to print it.
+ */
+struct ctest_log_header {
+    const char* fmt;
+    uint32_t units;  // size of the entry, 0 marks the end of the ring
+    short thread;  // CTEST_THREADED thread index, or -1
+    unsigned short count;  // values
+};
 
-    msg_end();
-    longjmp(ctest_err, 1);
-}
+union ctest_log_value {
+    struct ctest_log_header header;
+    intmax_t i;
+    uintmax_t u;
+    double d;
+    long double ld;
+    const void* p;
+    size_t offset;  // of a string, in bytes from the start of the entry, or CTEST_IMPL_LOG_NULL
+};
 
-CTEST_IMPL_DIAG_POP()
+#define CTEST_IMPL_LOG_UNITS (CTEST_LAZY_LOG_SIZE / sizeof(union ctest_log_value))
+// The longest text of a "%.*s" entry that still fits the ring
+#define CTEST_IMPL_LOG_TEXT_MAX ((CTEST_IMPL_LOG_UNITS - 3) * sizeof(union ctest_log_value) - 1)
 
-void assert_str(const char* cmp, const char* exp, const char*  real, const char* caller, int line) {
-    if ((!exp ^ !real) || (exp && (
-        (cmp[1] == '=' && ((cmp[0] == '=') ^ (strcmp(exp, real) == 0))) ||
-        (cmp[1] == '~' && ((cmp[0] == '=') ^ (strstr(exp, real) != NULL)))
-    ))) {
-        CTEST_ERR("%s:%d  assertion failed, '%s' %s '%s'", caller, line, exp, cmp, real);
-    }
-}
+static union ctest_log_value ctest_log_ring[CTEST_IMPL_LOG_UNITS];
+static size_t ctest_log_head;  // oldest entry
+static size_t ctest_log_tail;  // where the next one goes
+static unsigned int ctest_log_count;
+static unsigned int ctest_log_dropped;  // entries that made room for newer ones
 
-void assert_wstr(const char* cmp, const wchar_t *exp, const wchar_t *real, const char* caller, int line) {
-    if ((!exp ^ !real) || (exp && (
-        (cmp[1] == '=' && ((cmp[0] == '=') ^ (wcscmp(exp, real) == 0))) ||
-        (cmp[1] == '~' && ((cmp[0] == '=') ^ (wcsstr(exp, real) != NULL)))
-    ))) {
-        CTEST_ERR("%s:%d  assertion failed, '%ls' %s '%ls'", caller, line, exp, cmp, real);
-    }
-}
+enum ctest_log_length { LOG_LENGTH_NONE, LOG_LENGTH_HH, LOG_LENGTH_H, LOG_LENGTH_L, LOG_LENGTH_LL,
+                        LOG_LENGTH_J, LOG_LENGTH_Z, LOG_LENGTH_T, LOG_LENGTH_LONG_DOUBLE };
 
-void assert_data(const unsigned char* exp, size_t expsize,
-                 const unsigned char* real, size_t realsize,
-                 const char* caller, int line) {
-    size_t i;
-    if (expsize != realsize) {
-        CTEST_ERR("%s:%d  expected %" PRIuMAX " bytes, got %" PRIuMAX, caller, line, (uintmax_t) expsize, (uintmax_t) realsize);
+// A conversion specification, from its '%' to its conversion character
+struct ctest_log_spec {
+    int stars;  // '*' widths and precisions, each takes an int argument first
+    int star_precision;  // the precision is a '*', the last of them
+    int precision;  // a literal one, or -1
+    int length;  // enum ctest_log_length
+    char conversion;
+};
+
+// Parse the specification starting at the '%' of `p`. Return its end, or NULL for conversions it can't defer.
+static const char* log_parse(const char* p, struct ctest_log_spec* spec) {
+    spec->stars = 0;
+    spec->star_precision = 0;
+    spec->precision = -1;
+    spec->length = LOG_LENGTH_NONE;
+    for (p++; *p && strchr("-+ #0'", *p); p++) { }
+    if (*p == '*') {
+        spec->stars++;
+        p++;
     }
-    for (i=0; i<expsize; i++) {
-        if (exp[i] != real[i]) {
-            CTEST_ERR("%s:%d expected 0x%02x at offset %" PRIuMAX " got 0x%02x",
-                caller, line, exp[i], (uintmax_t) i, real[i]);
+    while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            spec->star_precision = 1;
+            p++;
+        } else {
+            spec->precision = 0;
+            while (*p >= '0' && *p <= '9') spec->precision = spec->precision * 10 + (*p++ - '0');
         }
     }
+    switch (*p) {
+    case 'h': spec->length = p[1] == 'h' ? LOG_LENGTH_HH : LOG_LENGTH_H; p += p[1] == 'h' ? 2 : 1; break;
+    case 'l': spec->length = p[1] == 'l' ? LOG_LENGTH_LL : LOG_LENGTH_L; p += p[1] == 'l' ? 2 : 1; break;
+    case 'j': spec->length = LOG_LENGTH_J; p++; break;
+    case 'z': spec->length = LOG_LENGTH_Z; p++; break;
+    case 't': spec->length = LOG_LENGTH_T; p++; break;
+    case 'L': spec->length = LOG_LENGTH_LONG_DOUBLE; p++; break;
+    default: break;
+    }
+    if (!*p || !strchr("diouxXcspfFeEgGaA%", *p)) return NULL;
+    spec->conversion = *p;
+    return p + 1;
 }
 
-static bool get_compare_result(const char* cmp, int c3, bool eq) {
-    if (cmp[0] == '<')
-        return c3 < 0 || ((cmp[1] == '=') & eq);
-    if (cmp[0] == '>')
-        return c3 > 0 || ((cmp[1] == '=') & eq);
-    return (cmp[0] == '=') == eq;
+// The oldest entry of the ring
+static union ctest_log_value* log_oldest(void) {
+    if (ctest_log_head == CTEST_IMPL_LOG_UNITS || ctest_log_ring[ctest_log_head].header.units == 0) ctest_log_head = 0;
+    return &ctest_log_ring[ctest_log_head];
 }
 
-void assert_compare(const char* cmp, intmax_t exp, intmax_t real, const char* caller, int line) {
-    int c3 = (real < exp) - (exp < real);
+static void log_evict(void) {
+    ctest_log_head += log_oldest()->header.units;
+    if (--ctest_log_count == 0) ctest_log_head = ctest_log_tail = 0;
+}
 
-    if (!get_compare_result(cmp, c3, c3 == 0)) {
-        CTEST_ERR("%s:%d  assertion failed, %" PRIdMAX " %s %" PRIdMAX "", caller, line, exp, cmp, real);
+// Make room for `units` at the tail of the ring, dropping the oldest entries if needed
+static union ctest_log_value* log_reserve(size_t units) {
+    size_t at;
+    for (;;) {
+        if (ctest_log_count == 0) {
+            at = 0;
+            break;
+        }
+        if (ctest_log_tail >= ctest_log_head) {
+            if (ctest_log_tail + units <= CTEST_IMPL_LOG_UNITS) {
+                at = ctest_log_tail;
+                break;
+            }
+            if (units < ctest_log_head) {
+                if (ctest_log_tail < CTEST_IMPL_LOG_UNITS) ctest_log_ring[ctest_log_tail].header.units = 0;
+                at = 0;
+                break;
+            }
+        } else if (ctest_log_tail + units < ctest_log_head) {
+            at = ctest_log_tail;
+            break;
+        }
+        log_evict();
+        ctest_log_dropped++;
     }
+    ctest_log_tail = at + units;
+    ctest_log_count++;
+    return &ctest_log_ring[at];
 }
 
-void assert_compare_u(const char* cmp, uintmax_t exp, uintmax_t real, const char* caller, int line) {
-    int c3 = (real < exp) - (exp < real);
+// Copy `size` bytes of a string argument after the values of `entry`. Return its offset.
+static size_t log_copy(union ctest_log_value* entry, size_t* used, size_t capacity, const void* text, size_t size, size_t align) {
+    size_t offset = (*used + align - 1) / align * align;
+    if (offset + size > capacity) size = offset < capacity ? (capacity - offset) / align * align : 0;
+    memcpy((char*)entry + offset, text, size);
+    *used = offset + size;
+    return offset;
+}
 
-    if (!get_compare_result(cmp, c3, c3 == 0)) {
-        CTEST_ERR("%s:%d  assertion failed, %" PRIuMAX " %s %" PRIuMAX, caller, line, exp, cmp, real);
+// Record a CTEST_LOG. Return -1 if the format has something it can't defer, or the entry is larger than the ring.
+static int log_record(const char* fmt, va_list ap) {
+    // Strings past MSG_SIZE bytes wouldn't be shown, as messages are cut there
+    union ctest_log_value entry[1 + CTEST_IMPL_LOG_MAX_ARGS + MSG_SIZE / sizeof(union ctest_log_value) + 2];
+    const size_t capacity = sizeof(entry);
+    size_t used;
+    unsigned short count = 0;
+    const char* p;
+
+    // Count the values first, the strings go after them
+    for (p = fmt; (p = strchr(p, '%')) != NULL;) {
+        struct ctest_log_spec spec;
+        const char* end = log_parse(p, &spec);
+        if (!end || end - p >= CTEST_IMPL_LOG_MAX_SPEC) return -1;
+        if (spec.conversion != '%') count = (unsigned short)(count + spec.stars + 1);
+        p = end;
+    }
+    if (count > CTEST_IMPL_LOG_MAX_ARGS) return -1;
+    used = (1 + (size_t)count) * sizeof(union ctest_log_value);
+    count = 0;
+
+    for (p = fmt; (p = strchr(p, '%')) != NULL;) {
+        struct ctest_log_spec spec;
+        union ctest_log_value* value = &entry[1 + count];
+        const char* end = log_parse(p, &spec);
+        int precision = spec.precision;
+        int star;
+        p = end;
+        if (spec.conversion == '%') continue;
+        for (star = 0; star < spec.stars; star++) {
+            (value++)->i = va_arg(ap, int);
+            count++;
+        }
+        if (spec.star_precision) precision = value[-1].i < 0 ? -1 : (int)value[-1].i;
+        count++;
+        switch (spec.conversion) {
+        case 'd': case 'i':
+            switch (spec.length) {
+            case LOG_LENGTH_L: value->i = va_arg(ap, long); break;
+            case LOG_LENGTH_LL: value->i = va_arg(ap, long long); break;
+            case LOG_LENGTH_J: value->i = va_arg(ap, intmax_t); break;
+            case LOG_LENGTH_Z: value->i = (intmax_t)va_arg(ap, size_t); break;
+            case LOG_LENGTH_T: value->i = va_arg(ap, ptrdiff_t); break;
+            default: value->i = va_arg(ap, int); break;
+            }
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            switch (spec.length) {
+            case LOG_LENGTH_L: value->u = va_arg(ap, unsigned long); break;
+            case LOG_LENGTH_LL: value->u = va_arg(ap, unsigned long long); break;
+            case LOG_LENGTH_J: value->u = va_arg(ap, uintmax_t); break;
+            case LOG_LENGTH_Z: value->u = va_arg(ap, size_t); break;
+            case LOG_LENGTH_T: value->u = (uintmax_t)va_arg(ap, ptrdiff_t); break;
+            default: value->u = va_arg(ap, unsigned int); break;
+            }
+            break;
+        case 'c':
+            value->i = spec.length == LOG_LENGTH_L ? (intmax_t)va_arg(ap, wint_t) : va_arg(ap, int);
+            break;
+        case 'p':
+            value->p = va_arg(ap, void*);
+            break;
+        case 's':
+            if (spec.length == LOG_LENGTH_L) {
+                const wchar_t* text = va_arg(ap, const wchar_t*);
+                size_t length = 0;
+                if (text) while ((precision < 0 || length < (size_t)precision) && text[length]) length++;
+                value->offset = text ? log_copy(entry, &used, capacity - sizeof(wchar_t), text, length * sizeof(wchar_t), sizeof(wchar_t))
+                                     : CTEST_IMPL_LOG_NULL;
+                if (text) {
+                    const wchar_t end_of_text = 0;
+                    log_copy(entry, &used, capacity, &end_of_text, sizeof(end_of_text), sizeof(wchar_t));
+                }
+            } else {
+                const char* text = va_arg(ap, const char*);
+                size_t length = 0;
+                if (text) while ((precision < 0 || length < (size_t)precision) && length < MSG_SIZE && text[length]) length++;
+                value->offset = text ? log_copy(entry, &used, capacity - 1, text, length, 1) : CTEST_IMPL_LOG_NULL;
+                if (text) log_copy(entry, &used, capacity, "", 1, 1);
+            }
+            break;
+        default:
+            if (spec.length == LOG_LENGTH_LONG_DOUBLE)
+                value->ld = va_arg(ap, long double);
+            else
+                value->d = va_arg(ap, double);
+            break;
+        }
+    }
+
+    entry[0].header.fmt = fmt;
+    entry[0].header.units = (uint32_t)((used + sizeof(union ctest_log_value) - 1) / sizeof(union ctest_log_value));
+#ifdef CTEST_IMPL_HAS_THREADS
+    entry[0].header.thread = (short)ctest_thread_index;
+#else
+    entry[0].header.thread = -1;
+#endif
+    entry[0].header.count = count;
+    if (entry[0].header.units > CTEST_IMPL_LOG_UNITS) return -1;
+    memcpy(log_reserve(entry[0].header.units), entry, entry[0].header.units * sizeof(union ctest_log_value));
+    return 0;
+}
+
+static int log_record_args(const char* fmt, ...) CTEST_IMPL_FORMAT_PRINTF(1, 2);
+
+static int log_record_args(const char* fmt, ...) {
+    va_list argp;
+    va_start(argp, fmt);
+    const int recorded = log_record(fmt, argp);
+    va_end(argp);
+    return recorded;
+}
+
+#define CTEST_IMPL_LOG_PRINT(type, value) \
+    (spec.stars == 0 ? snprintf(out + length, size - length, format, (type)(value)) \
+     : spec.stars == 1 ? snprintf(out + length, size - length, format, (int)values[0].i, (type)(value)) \
+     : snprintf(out + length, size - length, format, (int)values[0].i, (int)values[1].i, (type)(value)))
+
+// Print a recorded message into `out`. Return its length.
+static size_t log_format(const union ctest_log_value* entry, char* out, size_t size) {
+    const union ctest_log_value* values = entry + 1;
+    const char* p = entry->header.fmt;
+    size_t length = 0;
+
+    while (*p && length + 1 < size) {
+        const char* percent = strchr(p, '%');
+        const size_t literal = percent ? (size_t)(percent - p) : strlen(p);
+        const size_t copied = literal < size - 1 - length ? literal : size - 1 - length;
+        struct ctest_log_spec spec;
+        char format[CTEST_IMPL_LOG_MAX_SPEC];
+        const union ctest_log_value* value;
+        const char* end;
+        int written = 0;
+
+        memcpy(out + length, p, copied);
+        length += copied;
+        if (!percent || length + 1 >= size) break;
+        // It was parsed when recorded
+        end = log_parse(percent, &spec);
+        memcpy(format, percent, (size_t)(end - percent));
+        format[end - percent] = 0;
+        p = end;
+        if (spec.conversion == '%') {
+            out[length++] = '%';
+            continue;
+        }
+
+        value = values + spec.stars;
+        switch (spec.conversion) {
+        case 'd': case 'i':
+            switch (spec.length) {
+            case LOG_LENGTH_L: written = CTEST_IMPL_LOG_PRINT(long, value->i); break;
+            case LOG_LENGTH_LL: written = CTEST_IMPL_LOG_PRINT(long long, value->i); break;
+            case LOG_LENGTH_J: written = CTEST_IMPL_LOG_PRINT(intmax_t, value->i); break;
+            case LOG_LENGTH_Z: written = CTEST_IMPL_LOG_PRINT(size_t, value->i); break;
+            case LOG_LENGTH_T: written = CTEST_IMPL_LOG_PRINT(ptrdiff_t, value->i); break;
+            default: written = CTEST_IMPL_LOG_PRINT(int, value->i); break;
+            }
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            switch (spec.length) {
+            case LOG_LENGTH_L: written = CTEST_IMPL_LOG_PRINT(unsigned long, value->u); break;
+            case LOG_LENGTH_LL: written = CTEST_IMPL_LOG_PRINT(unsigned long long, value->u); break;
+            case LOG_LENGTH_J: written = CTEST_IMPL_LOG_PRINT(uintmax_t, value->u); break;
+            case LOG_LENGTH_Z: written = CTEST_IMPL_LOG_PRINT(size_t, value->u); break;
+            case LOG_LENGTH_T: written = CTEST_IMPL_LOG_PRINT(ptrdiff_t, value->u); break;
+            default: written = CTEST_IMPL_LOG_PRINT(unsigned int, value->u); break;
+            }
+            break;
+        case 'c':
+            if (spec.length == LOG_LENGTH_L)
+                written = CTEST_IMPL_LOG_PRINT(wint_t, value->i);
+            else
+                written = CTEST_IMPL_LOG_PRINT(int, value->i);
+            break;
+        case 'p':
+            written = CTEST_IMPL_LOG_PRINT(const void*, value->p);
+            break;
+        case 's':
+            if (spec.length == LOG_LENGTH_L) {
+                written = CTEST_IMPL_LOG_PRINT(const wchar_t*, value->offset == CTEST_IMPL_LOG_NULL ? NULL
+                                               : (const wchar_t*)(const void*)((const char*)entry + value->offset));
+            } else {
+                written = CTEST_IMPL_LOG_PRINT(const char*, value->offset == CTEST_IMPL_LOG_NULL ? NULL
+                                               : (const char*)entry + value->offset);
+            }
+            break;
+        default:
+            if (spec.length == LOG_LENGTH_LONG_DOUBLE)
+                written = CTEST_IMPL_LOG_PRINT(long double, value->ld);
+            else
+                written = CTEST_IMPL_LOG_PRINT(double, value->d);
+            break;
+        }
+        values = value + 1;
+        if (written > 0) length += (size_t)written < size - 1 - length ? (size_t)written : size - 1 - length;
+    }
+    out[length] = 0;
+    return length;
+}
+
+// Format the recorded messages into the test's messages if `show`, and into
+// CTEST_EVENT_LOG records, then empty the ring
+static void log_flush(int show) {
+    char text[MSG_SIZE];
+#if !defined(_WIN32)
+    const int events = ctest_event_fd >= 0;
+#else
+    const int events = 0;
+#endif
+    if (show && ctest_log_dropped) {
+        msg_start(ANSI_BLUE, "LOG");
+        print_errormsg("%u earlier messages were dropped, see CTEST_LAZY_LOG_SIZE", ctest_log_dropped);
+        msg_end();
+    }
+    while (ctest_log_count > 0 && (show || events)) {
+        const union ctest_log_value* entry = log_oldest();
+        const size_t length = log_format(entry, text, sizeof(text));
+        if (show) {
+#ifdef CTEST_IMPL_HAS_THREADS
+            const int thread = ctest_thread_index;
+            ctest_thread_index = entry->header.thread;
+#endif
+            msg_start(ANSI_BLUE, "LOG");
+            print_errormsg("%s", text);
+            msg_end();
+#ifdef CTEST_IMPL_HAS_THREADS
+            ctest_thread_index = thread;
+#endif
+        }
+        event_message(CTEST_EVENT_LOG, text, length);
+        log_evict();
+    }
+    ctest_log_head = ctest_log_tail = 0;
+    ctest_log_count = 0;
+    ctest_log_dropped = 0;
+}
+#endif
+
+void CTEST_LOG(const char* fmt, ...)
+{
+    va_list argp;
+#ifdef CTEST_IMPL_HAS_THREADS
+    if (ctest_thread_jump) pthread_mutex_lock(&ctest_thread_lock);
+#endif
+    va_start(argp, fmt);
+#ifdef CTEST_LAZY_LOG
+#ifdef CTEST_IMPL_HAS_ASYNC
+    // The messages of concurrent CTEST_ASYNC tests would share the ring
+    if (ctest_async_running) {
+        vprint_message(ANSI_BLUE, "LOG", CTEST_EVENT_LOG, fmt, argp);
+    } else
+#endif
+    {
+        va_list copy;
+        va_copy(copy, argp);
+        if (log_record(fmt, argp) != 0) {
+            // A conversion it can't defer, such as %n, or an entry larger than the ring: the text is
+            // recorded instead, cut to fit
+            char text[MSG_SIZE];
+            vsnprintf(text, sizeof(text), fmt, copy);
+            log_record_args("%.*s", (int)CTEST_IMPL_LOG_TEXT_MAX, text);
+        }
+        va_end(copy);
+    }
+#else
+    vprint_message(ANSI_BLUE, "LOG", CTEST_EVENT_LOG, fmt, argp);
+#endif
+    va_end(argp);
+#ifdef CTEST_IMPL_HAS_THREADS
+    if (ctest_thread_jump) pthread_mutex_unlock(&ctest_thread_lock);
+#endif
+}
+
+#ifdef CTEST_IMPL_HAS_ASYNC
+// Thrown by CTEST_ERR to unwind a CTEST_ASYNC test
+struct ctest_async_failure { };
+#endif
+
+CTEST_IMPL_DIAG_PUSH_IGNORED(missing-noreturn)
+
+void CTEST_ERR(const char* fmt, ...)
+{
+    va_list argp;
+#ifdef CTEST_IMPL_HAS_THREADS
+    if (ctest_thread_jump) pthread_mutex_lock(&ctest_thread_lock);
+#endif
+#ifdef CTEST_LAZY_LOG
+    // The messages before the failure explain it
+    log_flush(1);
+#endif
+    va_start(argp, fmt);
+    vprint_message(ANSI_YELLOW, "ERR", CTEST_EVENT_ASSERT, fmt, argp);
+    va_end(argp);
+
+    ctest_err_file = NULL;
+    ctest_err_line = 0;
+#ifdef CTEST_IMPL_HAS_THREADS
+    if (ctest_thread_jump) {
+        pthread_mutex_unlock(&ctest_thread_lock);
+        longjmp(*ctest_thread_jump, 1);
+    }
+#endif
+#ifdef CTEST_IMPL_HAS_ASYNC
+    if (ctest_async_running) throw ctest_async_failure();
+#endif
+    longjmp(ctest_err, 1);
+}
+
+CTEST_IMPL_DIAG_POP()
+
+void assert_str(const char* cmp, const char* exp, const char*  real, const char* caller, int line) {
+    if ((!exp ^ !real) || (exp && (
+        (cmp[1] == '=' && ((cmp[0] == '=') ^ (strcmp(exp, real) == 0))) ||
+        (cmp[1] == '~' && ((cmp[0] == '=') ^ (strstr(exp, real) != NULL)))
+    ))) {
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  assertion failed, '%s' %s '%s'", caller, line, exp, cmp, real);
+    }
+}
+
+void assert_wstr(const char* cmp, const wchar_t *exp, const wchar_t *real, const char* caller, int line) {
+    if ((!exp ^ !real) || (exp && (
+        (cmp[1] == '=' && ((cmp[0] == '=') ^ (wcscmp(exp, real) == 0))) ||
+        (cmp[1] == '~' && ((cmp[0] == '=') ^ (wcsstr(exp, real) != NULL)))
+    ))) {
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  assertion failed, '%ls' %s '%ls'", caller, line, exp, cmp, real);
+    }
+}
+
+void assert_data(const unsigned char* exp, size_t expsize,
+                 const unsigned char* real, size_t realsize,
+                 const char* caller, int line) {
+    size_t i;
+    if (expsize != realsize) {
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  expected %" PRIuMAX " bytes, got %" PRIuMAX, caller, line, (uintmax_t) expsize, (uintmax_t) realsize);
+    }
+    for (i=0; i<expsize; i++) {
+        if (exp[i] != real[i]) {
+            CTEST_IMPL_ERR_AT(caller, line, "%s:%d expected 0x%02x at offset %" PRIuMAX " got 0x%02x",
+                caller, line, exp[i], (uintmax_t) i, real[i]);
+        }
+    }
+}
+
+// Write `data` to a temporary file next to `path` and rename it over `path`,
+// so that readers see either the old or the new content, never a mix
+static int write_atomically(const char* path, const void* data, size_t size) {
+    const size_t length = strlen(path) + 32;
+    char* temporary = (char*)malloc(length);
+    FILE* file;
+    int ok;
+
+    if (!temporary) return -1;
+    snprintf(temporary, length, "%s.%ld.tmp", path, (long)getpid());
+    file = fopen(temporary, "wb");
+    if (!file) {
+        free(temporary);
+        return -1;
+    }
+    ok = fwrite(data, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+    if (ok) remove(path);  // rename doesn't replace files there
+#endif
+    ok = ok && rename(temporary, path) == 0;
+    if (!ok) remove(temporary);
+    free(temporary);
+    return ok ? 0 : -1;
+}
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef CTEST_IMPL_HAS_THREADS
+#define CTEST_IMPL_LOCK() pthread_mutex_lock(&ctest_thread_lock)
+#define CTEST_IMPL_UNLOCK() pthread_mutex_unlock(&ctest_thread_lock)
+#else
+#define CTEST_IMPL_LOCK()
+#define CTEST_IMPL_UNLOCK()
+#endif
+
+static int ctest_golden_update;  // --update-golden
+
+// A golden file, mapped once and shared by every test comparing against it
+struct ctest_golden {
+    char* path;
+    const unsigned char* data;
+    size_t size;
+};
+
+static struct ctest_golden* ctest_goldens;
+static size_t ctest_golden_count;
+
+static int golden_load(const char* path, struct ctest_golden* golden) {
+#if !defined(_WIN32)
+    struct stat info;
+    const int fd = open(path, O_RDONLY);
+    void* data = NULL;
+
+    if (fd < 0) return -1;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+    // Empty files can't be mapped
+    if (info.st_size > 0) {
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    golden->data = (const unsigned char*)data;
+    golden->size = (size_t)info.st_size;
+#else
+    FILE* file = fopen(path, "rb");
+    unsigned char* data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    if (!file) return -1;
+    while (!feof(file) && !ferror(file)) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : 64 * 1024;
+            data = (unsigned char*)realloc(data, capacity);
+            if (!data) break;
+        }
+        size += fread(data + size, 1, capacity - size, file);
+    }
+    fclose(file);
+    golden->data = data;
+    golden->size = size;
+#endif
+    golden->path = (char*)malloc(strlen(path) + 1);
+    if (golden->path) strcpy(golden->path, path);
+    return 0;
+}
+
+static void golden_unload(struct ctest_golden* golden) {
+#if !defined(_WIN32)
+    if (golden->data) munmap((void*)golden->data, golden->size);
+#else
+    free((void*)golden->data);
+#endif
+    free(golden->path);
+}
+
+// 0 when found, -1 when missing and -2 out of memory
+static int golden_find(const char* path, struct ctest_golden* golden) {
+    struct ctest_golden* grown;
+    size_t i;
+
+    for (i = 0; i < ctest_golden_count; i++) {
+        if (strcmp(ctest_goldens[i].path, path) == 0) {
+            *golden = ctest_goldens[i];
+            return 0;
+        }
+    }
+    if (golden_load(path, golden) != 0) return -1;
+    grown = (struct ctest_golden*)realloc(ctest_goldens, sizeof(*grown) * (ctest_golden_count + 1));
+    if (!grown || !golden->path) {
+        golden_unload(golden);
+        return -2;
+    }
+    ctest_goldens = grown;
+    ctest_goldens[ctest_golden_count++] = *golden;
+    return 0;
+}
+
+// Drop the mapping of `path`, which is about to be replaced
+static void golden_forget(const char* path) {
+    size_t i;
+    for (i = 0; i < ctest_golden_count; i++) {
+        if (strcmp(ctest_goldens[i].path, path) == 0) {
+            golden_unload(&ctest_goldens[i]);
+            ctest_goldens[i] = ctest_goldens[--ctest_golden_count];
+            return;
+        }
+    }
+}
+
+static void golden_close(void) {
+    size_t i;
+    for (i = 0; i < ctest_golden_count; i++) golden_unload(&ctest_goldens[i]);
+    free(ctest_goldens);
+    ctest_goldens = NULL;
+    ctest_golden_count = 0;
+}
+
+void assert_golden(const char* path, const void* real, size_t realsize, const char* caller, int line) {
+    const unsigned char* actual = (const unsigned char*)real;
+    struct ctest_golden golden;
+    char actual_path[4096];
+    int found;
+    int matches;
+    size_t i = 0;
+
+    // Compared under the lock, as with --update-golden another thread may unmap the file
+    CTEST_IMPL_LOCK();
+    found = golden_find(path, &golden);
+    matches = found == 0 && golden.size == realsize && (realsize == 0 || memcmp(golden.data, actual, realsize) == 0);
+    if (found == 0 && !matches) {
+        while (i < golden.size && i < realsize && golden.data[i] == actual[i]) i++;
+    }
+    CTEST_IMPL_UNLOCK();
+    if (found == -2) CTEST_ERR("out of memory");
+    if (matches) return;
+
+    if (ctest_golden_update) {
+        CTEST_IMPL_LOCK();
+        golden_forget(path);
+        CTEST_IMPL_UNLOCK();
+        if (write_atomically(path, real, realsize) != 0) {
+            CTEST_IMPL_ERR_AT(caller, line, "%s:%d  cannot write golden file %s", caller, line, path);
+        }
+        CTEST_LOG("updated golden file %s", path);
+        return;
+    }
+
+    // Leave the output next to the golden file, to diff them
+    snprintf(actual_path, sizeof(actual_path), "%s.actual", path);
+    write_atomically(actual_path, real, realsize);
+
+    if (found != 0) {
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  golden file %s is missing, the output is in %s",
+                          caller, line, path, actual_path);
+    }
+    CTEST_IMPL_ERR_AT(caller, line, "%s:%d  output differs from %s at offset %" PRIuMAX
+                      " (expected %" PRIuMAX " bytes, got %" PRIuMAX "), the output is in %s",
+                      caller, line, path, (uintmax_t) i, (uintmax_t) golden.size, (uintmax_t) realsize, actual_path);
+}
+
+static bool get_compare_result(const char* cmp, int c3, bool eq) {
+    if (cmp[0] == '<')
+        return c3 < 0 || ((cmp[1] == '=') & eq);
+    if (cmp[0] == '>')
+        return c3 > 0 || ((cmp[1] == '=') & eq);
+    return (cmp[0] == '=') == eq;
+}
+
+void assert_compare(const char* cmp, intmax_t exp, intmax_t real, const char* caller, int line) {
+    int c3 = (real < exp) - (exp < real);
+
+    if (!get_compare_result(cmp, c3, c3 == 0)) {
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  assertion failed, %" PRIdMAX " %s %" PRIdMAX "", caller, line, exp, cmp, real);
+    }
+}
+
+void assert_compare_u(const char* cmp, uintmax_t exp, uintmax_t real, const char* caller, int line) {
+    int c3 = (real < exp) - (exp < real);
+
+    if (!get_compare_result(cmp, c3, c3 == 0)) {
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  assertion failed, %" PRIuMAX " %s %" PRIuMAX, caller, line, exp, cmp, real);
     }
 }
 
 void assert_interval(intmax_t exp1, intmax_t exp2, intmax_t real, const char* caller, int line) {
     if (real < exp1 || real > exp2) {
-        CTEST_ERR("%s:%d  expected %" PRIdMAX "-%" PRIdMAX ", got %" PRIdMAX, caller, line, exp1, exp2, real);
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  expected %" PRIdMAX "-%" PRIdMAX ", got %" PRIdMAX, caller, line, exp1, exp2, real);
     }
 }
 
@@ -444,36 +1721,36 @@ void assert_dbl_compare(const char* cmp, double exp, double real, double tol, co
             tolstr = "eps";
             tol = -tol;
         }
-        CTEST_ERR("%s:%d  assertion failed, %.8g %s %.8g (diff %.4g, %s %.4g)", caller, line, exp, cmp, real, diff, tolstr, tol);
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  assertion failed, %.8g %s %.8g (diff %.4g, %s %.4g)", caller, line, exp, cmp, real, diff, tolstr, tol);
     }
 }
 
 void assert_null(void* real, const char* caller, int line) {
     if ((real) != NULL) {
-        CTEST_ERR("%s:%d  should be NULL", caller, line);
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  should be NULL", caller, line);
     }
 }
 
 void assert_not_null(const void* real, const char* caller, int line) {
     if (real == NULL) {
-        CTEST_ERR("%s:%d  should not be NULL", caller, line);
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  should not be NULL", caller, line);
     }
 }
 
 void assert_true(int real, const char* caller, int line) {
     if ((real) == 0) {
-        CTEST_ERR("%s:%d  should be true", caller, line);
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  should be true", caller, line);
     }
 }
 
 void assert_false(int real, const char* caller, int line) {
     if ((real) != 0) {
-        CTEST_ERR("%s:%d  should be false", caller, line);
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  should be false", caller, line);
     }
 }
 
 void assert_fail(const char* caller, int line) {
-    CTEST_ERR("%s:%d  shouldn't come here", caller, line);
+    CTEST_IMPL_ERR_AT(caller, line, "%s:%d  shouldn't come here", caller, line);
 }
 
 
@@ -495,127 +1772,4018 @@ static int suite_filter(struct ctest* t) {
     );
 }
 
-static void color_print(const char* color, const char* text) {
-    if (color_output)
-        printf("%s%s" ANSI_NORMAL "\n", color, text);
-    else
-        printf("%s\n", text);
+// --changed-since: a unix time, or a comma-separated list of changed files
+static const char* ctest_changed_since;
+// The unix time of --changed-since, when it's one
+static int ctest_changed_by_time;
+static uintmax_t ctest_changed_time;
+// The file of the last test checked, and whether it changed
+static const char* ctest_changed_last_file;
+static int ctest_changed_last;
+// --coverage-map: "suite:test<TAB>file" lines, from scripts/coverage_map.py
+static char* ctest_coverage_map;
+
+// A line of the coverage map, split in place. `file` indexes ctest_coverage_changed, which has
+// one entry per distinct file: -1 until it's checked, then whether it changed.
+struct ctest_coverage_entry {
+    const char* test;
+    const char* path;
+    int file;
+};
+// Sorted by `test`
+static struct ctest_coverage_entry* ctest_coverage_entries;
+static int ctest_coverage_count;
+static signed char* ctest_coverage_changed;
+
+// If `a` and `b` name the same file, ignoring whatever directory one of them is relative to
+static int same_file(const char* a, size_t a_length, const char* b, size_t b_length) {
+    if (a_length < b_length) {
+        const char* swap = a;
+        size_t swap_length = a_length;
+        a = b;
+        a_length = b_length;
+        b = swap;
+        b_length = swap_length;
+    }
+    return (
+        b_length != 0
+        && memcmp(a + a_length - b_length, b, b_length) == 0
+        && (a_length == b_length || a[a_length - b_length - 1] == '/')
+    );
 }
 
-#ifdef CTEST_SEGFAULT
-#include <signal.h>
-static void sighandler(int signum)
-{
-    const char msg_color[] = ANSI_BRED "[SIGSEGV: Segmentation fault]" ANSI_NORMAL "\n";
-    const char msg_nocolor[] = "[SIGSEGV: Segmentation fault]\n";
+static int file_changed(const char* file) {
+    const char* changed = ctest_changed_since;
 
-    const char* msg = color_output ? msg_color : msg_nocolor;
-    write(STDOUT_FILENO, msg, (unsigned int)strlen(msg));
+    if (ctest_changed_by_time) {
+        struct stat info;
+        // A file which can't be found may have been moved, so it counts as changed
+        return stat(file, &info) != 0 || (uintmax_t)info.st_mtime > ctest_changed_time;
+    }
 
-    /* "Unregister" the signal handler and send the signal back to the process
-     * so it can terminate as expected */
-    signal(signum, SIG_DFL);
-#if !defined(_WIN32) || defined(__CYGWIN__)
-    kill(getpid(), signum);
-#endif
+    while (*changed) {
+        size_t size = strcspn(changed, ",");
+        if (same_file(file, strlen(file), changed, size)) return 1;
+        changed += size;
+        if (*changed == ',') changed++;
+    }
+    return 0;
 }
-#endif
-
-int ctest_main(int argc, const char *argv[]);
 
-__attribute__((no_sanitize_address)) int ctest_main(int argc, const char *argv[])
-{
-    static int total = 0;
-    static int num_ok = 0;
-    static int num_fail = 0;
-    static int num_skip = 0;
-    static int idx = 1;
-    static ctest_filter_func filter = suite_all;
+// Compare the "suite:test" of a coverage map line with the names of `t`
+static int compare_coverage_test(const char* test, const struct ctest* t) {
+    const size_t suite_length = strlen(t->ssname);
+    int c = strncmp(test, t->ssname, suite_length);
+    if (c) return c;
+    c = (unsigned char)test[suite_length] - ':';
+    return c ? c : strcmp(test + suite_length + 1, t->ttname);
+}
 
-#ifdef CTEST_SEGFAULT
-    signal(SIGSEGV, sighandler);
-#endif
+// If `t`, or a file it covered in the coverage map, changed since --changed-since
+static int test_changed(struct ctest* t) {
+    int low = 0;
+    int high = ctest_coverage_count;
 
-    if (argc == 2) {
-        suite_name = argv[1];
-        filter = suite_filter;
-    } else if (argc == 3) {
-        suite_name = argv[1];
-        test_expression = argv[2];
-        filter = suite_filter;
+    // The tests of a file are next to each other, so this checks most files once
+    if (ctest_changed_last_file == NULL || strcmp(ctest_changed_last_file, t->file) != 0) {
+        ctest_changed_last_file = t->file;
+        ctest_changed_last = file_changed(t->file);
     }
-#ifdef CTEST_NO_COLORS
-    color_output = 0;
-#else
-    color_output = isatty(1);
-#endif
-    clock_t t1 = clock();
+    if (ctest_changed_last) return 1;
 
-    struct ctest* ctest_begin = &CTEST_IMPL_TNAME(suite, test);
-    struct ctest* ctest_end = &CTEST_IMPL_TNAME(suite, test);
-    // find begin and end of section by comparing magics
-    while (1) {
-        struct ctest* t = ctest_begin-1;
-        if (t->magic != CTEST_IMPL_MAGIC) break;
-        ctest_begin--;
+    // The first line of `t`
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        if (compare_coverage_test(ctest_coverage_entries[middle].test, t) < 0) low = middle + 1;
+        else high = middle;
     }
-    while (1) {
-        struct ctest* t = ctest_end+1;
-        if (t->magic != CTEST_IMPL_MAGIC) break;
-        ctest_end++;
+    for (; low < ctest_coverage_count && compare_coverage_test(ctest_coverage_entries[low].test, t) == 0; low++) {
+        struct ctest_coverage_entry* entry = &ctest_coverage_entries[low];
+        if (ctest_coverage_changed[entry->file] < 0) {
+            ctest_coverage_changed[entry->file] = (signed char)file_changed(entry->path);
+        }
+        if (ctest_coverage_changed[entry->file]) return 1;
     }
-    ctest_end++;    // end after last one
+    return 0;
+}
 
-    static struct ctest* test;
-    for (test = ctest_begin; test != ctest_end; test++) {
-        if (test == &CTEST_IMPL_TNAME(suite, test)) continue;
-        if (filter(test)) total++;
-    }
+static int compare_coverage_paths(const void* a, const void* b) {
+    return strcmp(((const struct ctest_coverage_entry*)a)->path, ((const struct ctest_coverage_entry*)b)->path);
+}
 
-    for (test = ctest_begin; test != ctest_end; test++) {
-        if (test == &CTEST_IMPL_TNAME(suite, test)) continue;
-        if (filter(test)) {
-            ctest_errorbuffer[0] = 0;
-            ctest_errorsize = MSG_SIZE-1;
-            ctest_errormsg = ctest_errorbuffer;
-            printf("TEST %d/%d %s:%s\n", idx, total, test->ssname, test->ttname);
-            fflush(stdout);
-            if (test->skip) {
-                color_print(ANSI_BYELLOW, "[SKIPPED]");
-                num_skip++;
-            } else {
-                int result = setjmp(ctest_err);
-                if (result == 0) {
-                    if (test->setup && *test->setup) (*test->setup)(test->data);
-                    if (test->data)
-                        test->run.unary(test->data);
-                    else
-                        test->run.nullary();
-                    if (test->teardown && *test->teardown) (*test->teardown)(test->data);
-                    // if we got here it's ok
-#ifdef CTEST_COLOR_OK
-                    color_print(ANSI_BGREEN, "[OK]");
-#else
-                    printf("[OK]\n");
-#endif
-                    num_ok++;
-                } else {
-                    color_print(ANSI_BRED, "[FAIL]");
-                    num_fail++;
-                }
-                if (ctest_errorsize != MSG_SIZE-1) printf("%s", ctest_errorbuffer);
-            }
-            idx++;
+static int compare_coverage_tests(const void* a, const void* b) {
+    return strcmp(((const struct ctest_coverage_entry*)a)->test, ((const struct ctest_coverage_entry*)b)->test);
+}
+
+// Split the lines of ctest_coverage_map, then sort them by test, with an index for each distinct file
+static int index_coverage_map(void) {
+    char* line = ctest_coverage_map;
+    int lines = 1;
+    int files = 0;
+    int i;
+
+    for (i = 0; ctest_coverage_map[i]; i++) lines += ctest_coverage_map[i] == '\n';
+    ctest_coverage_entries = (struct ctest_coverage_entry*)malloc(sizeof(*ctest_coverage_entries) * (size_t)lines);
+    if (!ctest_coverage_entries) return -1;
+
+    while (*line) {
+        char* end = strchr(line, '\n');
+        char* next = end ? end + 1 : line + strlen(line);
+        char* tab;
+        if (end) *end = '\0';
+        if (end && end > line && end[-1] == '\r') end[-1] = '\0';
+        tab = strchr(line, '\t');
+        if (tab) {
+            *tab = '\0';
+            ctest_coverage_entries[ctest_coverage_count].test = line;
+            ctest_coverage_entries[ctest_coverage_count].path = tab + 1;
+            ctest_coverage_count++;
         }
+        line = next;
     }
-    clock_t t2 = clock();
 
-    const char* color = (num_fail) ? ANSI_BRED : ANSI_GREEN;
-    char results[80];
-    snprintf(results, sizeof(results), "RESULTS: %d tests (%d ok, %d failed, %d skipped) ran in %.1f ms",
-             total, num_ok, num_fail, num_skip, (double)(t2 - t1)*1000.0/CLOCKS_PER_SEC);
-    color_print(color, results);
-    return num_fail;
+    qsort(ctest_coverage_entries, (size_t)ctest_coverage_count, sizeof(*ctest_coverage_entries), compare_coverage_paths);
+    for (i = 0; i < ctest_coverage_count; i++) {
+        if (i > 0 && strcmp(ctest_coverage_entries[i - 1].path, ctest_coverage_entries[i].path) != 0) files++;
+        ctest_coverage_entries[i].file = files;
+    }
+    qsort(ctest_coverage_entries, (size_t)ctest_coverage_count, sizeof(*ctest_coverage_entries), compare_coverage_tests);
+
+    ctest_coverage_changed = (signed char*)malloc((size_t)files + 1);
+    if (!ctest_coverage_changed) return -1;
+    memset(ctest_coverage_changed, -1, (size_t)files + 1);
+    return 0;
+}
+
+static int load_coverage_map(const char* path) {
+    FILE* file = fopen(path, "rb");
+    size_t size = 0;
+    size_t capacity = 4096;
+
+    if (!file) {
+        fprintf(stderr, "cannot open coverage map '%s'\n", path);
+        return -1;
+    }
+    ctest_coverage_map = (char*)malloc(capacity);
+    while (ctest_coverage_map) {
+        char* grown;
+        size += fread(ctest_coverage_map + size, 1, capacity - size - 1, file);
+        if (size < capacity - 1) break;
+        capacity *= 2;
+        grown = (char*)realloc(ctest_coverage_map, capacity);
+        if (!grown) free(ctest_coverage_map);
+        ctest_coverage_map = grown;
+    }
+    fclose(file);
+    if (!ctest_coverage_map) return -1;
+    ctest_coverage_map[size] = '\0';
+    return index_coverage_map();
+}
+
+static struct ctest_meta* ctest_meta_begin;
+static struct ctest_meta* ctest_meta_end;
+
+// The values of the `kind` metadata declared for `t`, or NULL
+static const char* const* find_meta(struct ctest* t, int kind) {
+    struct ctest_meta* meta;
+    for (meta = ctest_meta_begin; meta != ctest_meta_end; meta++) {
+        if (
+            meta->kind == kind
+            && strcmp(meta->ssname, t->ssname) == 0
+            && strcmp(meta->ttname, t->ttname) == 0
+        ) {
+            return meta->values;
+        }
+    }
+    return NULL;
+}
+
+// Dependencies, see CTEST_DEPENDS. Tests are numbered by their position in the .ctest section.
+#define CTEST_IMPL_NOT_SELECTED 0xff
+#define CTEST_IMPL_PENDING 0xfe
+
+static struct ctest* ctest_section;
+static int ctest_section_size;
+// The dependencies of test i are ctest_dep_list[ctest_dep_first[i]] to
+// ctest_dep_list[ctest_dep_first[i + 1] - 1]. NULL when no test has any.
+static int* ctest_dep_first;
+static int* ctest_dep_list;
+// The status of each test in the current run, or one of the markers above
+static unsigned char* ctest_outcome;
+
+static int test_index(const struct ctest* t) {
+    return (int)(t - ctest_section);
+}
+
+static int compare_tests(const void* a, const void* b) {
+    const struct ctest* x = &ctest_section[*(const int*)a];
+    const struct ctest* y = &ctest_section[*(const int*)b];
+    const int suite = strcmp(x->ssname, y->ssname);
+    return suite ? suite : strcmp(x->ttname, y->ttname);
+}
+
+// Binary search `sorted` for the test in the first `length` characters of `suite`, or -1
+static int find_test(const int* sorted, int count, const char* suite, size_t length, const char* name) {
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        const struct ctest* t = &ctest_section[sorted[middle]];
+        int c = strncmp(t->ssname, suite, length);
+        if (c == 0) c = t->ssname[length] ? 1 : strcmp(t->ttname, name);
+        if (c == 0) return sorted[middle];
+        if (c < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return -1;
+}
+
+// Resolve every CTEST_DEPENDS. Print why and return -1 for names that can't be used.
+static int load_dependencies(void) {
+    struct ctest_meta* meta;
+    const char* const* value;
+    int* sorted;
+    int count = 0;
+    int total = 0;
+    int i;
+
+    for (meta = ctest_meta_begin; meta != ctest_meta_end; meta++) {
+        if (meta->kind != CTEST_META_DEPENDS) continue;
+        for (value = meta->values; *value; value++) total++;
+    }
+    if (total == 0) return 0;
+
+    sorted = (int*)malloc(sizeof(*sorted) * (size_t)ctest_section_size);
+    ctest_dep_first = (int*)calloc((size_t)ctest_section_size + 1, sizeof(*ctest_dep_first));
+    ctest_dep_list = (int*)malloc(sizeof(*ctest_dep_list) * (size_t)total);
+    ctest_outcome = (unsigned char*)malloc((size_t)ctest_section_size);
+    for (i = 0; i < ctest_section_size; i++) {
+        if (&ctest_section[i] != &CTEST_IMPL_TNAME(suite, test)) sorted[count++] = i;
+    }
+    qsort(sorted, (size_t)count, sizeof(*sorted), compare_tests);
+
+    // Count the dependencies of each test, then fill them in
+    for (meta = ctest_meta_begin; meta != ctest_meta_end; meta++) {
+        if (meta->kind != CTEST_META_DEPENDS) continue;
+        const int owner = find_test(sorted, count, meta->ssname, strlen(meta->ssname), meta->ttname);
+        if (owner < 0) continue;
+        for (value = meta->values; *value; value++) ctest_dep_first[owner + 1]++;
+    }
+    for (i = 0; i < ctest_section_size; i++) ctest_dep_first[i + 1] += ctest_dep_first[i];
+    for (meta = ctest_meta_begin; meta != ctest_meta_end; meta++) {
+        if (meta->kind != CTEST_META_DEPENDS) continue;
+        const int owner = find_test(sorted, count, meta->ssname, strlen(meta->ssname), meta->ttname);
+        if (owner < 0) continue;
+        int next = ctest_dep_first[owner];
+        for (value = meta->values; *value; value++) {
+            const char* colon = strchr(*value, ':');
+            const int dependency = colon ? find_test(sorted, count, *value, (size_t)(colon - *value), colon + 1) : -1;
+            if (dependency < 0) {
+                fprintf(stderr, "%s:%s depends on unknown test '%s'\n", meta->ssname, meta->ttname, *value);
+                free(sorted);
+                return -1;
+            }
+            if (ctest_section[owner].kind == CTEST_KIND_ASYNC || ctest_section[dependency].kind == CTEST_KIND_ASYNC) {
+                fprintf(stderr, "%s:%s: CTEST_ASYNC tests can't have or be dependencies\n", meta->ssname, meta->ttname);
+                free(sorted);
+                return -1;
+            }
+            ctest_dep_list[next++] = dependency;
+        }
+    }
+    free(sorted);
+    return 0;
+}
+
+// Add the dependencies of `tests` that weren't selected. `tests` has room for every test.
+static void select_dependencies(struct ctest** tests, int* count) {
+    unsigned char* selected;
+    int i;
+    int d;
+
+    if (!ctest_dep_first) return;
+    selected = (unsigned char*)calloc((size_t)ctest_section_size, 1);
+    for (i = 0; i < *count; i++) selected[test_index(tests[i])] = 1;
+    for (i = 0; i < *count; i++) {
+        const int index = test_index(tests[i]);
+        for (d = ctest_dep_first[index]; d < ctest_dep_first[index + 1]; d++) {
+            if (selected[ctest_dep_list[d]]) continue;
+            selected[ctest_dep_list[d]] = 1;
+            tests[(*count)++] = &ctest_section[ctest_dep_list[d]];
+        }
+    }
+    free(selected);
+}
+
+struct ctest_dep_walk {
+    const int* position;  // of each test in the list being ordered, -1 if it isn't in it
+    unsigned char* state;  // 0 not visited, 1 visiting, 2 done
+    int* stack;
+    int* sorted;  // positions, dependencies first
+    int sorted_count;
+};
+
+static int dependency_visit(struct ctest_dep_walk* walk, int index, int depth) {
+    int d;
+    if (walk->state[index] == 2) return 0;
+    if (walk->state[index] == 1) {
+        for (d = 0; walk->stack[d] != index; d++) { }
+        fprintf(stderr, "dependency cycle:");
+        for (; d < depth; d++) fprintf(stderr, " %s:%s ->", ctest_section[walk->stack[d]].ssname, ctest_section[walk->stack[d]].ttname);
+        fprintf(stderr, " %s:%s\n", ctest_section[index].ssname, ctest_section[index].ttname);
+        return -1;
+    }
+    walk->state[index] = 1;
+    walk->stack[depth] = index;
+    for (d = ctest_dep_first[index]; d < ctest_dep_first[index + 1]; d++) {
+        const int dependency = ctest_dep_list[d];
+        if (walk->position[dependency] >= 0 && dependency_visit(walk, dependency, depth + 1) != 0) return -1;
+    }
+    walk->state[index] = 2;
+    walk->sorted[walk->sorted_count++] = walk->position[index];
+    return 0;
+}
+
+// Move the dependencies of each test of `ordered` (and `order`, if given) before
+// it, keeping the order otherwise. Print the cycle and return -1 if there is one.
+static int order_dependencies(struct ctest** ordered, int* order, int count) {
+    struct ctest_dep_walk walk;
+    int* position;
+    int result = 0;
+    int i;
+
+    if (!ctest_dep_first || count == 0) return 0;
+    position = (int*)malloc(sizeof(*position) * (size_t)ctest_section_size);
+    walk.position = position;
+    walk.state = (unsigned char*)calloc((size_t)ctest_section_size, 1);
+    walk.stack = (int*)malloc(sizeof(*walk.stack) * (size_t)ctest_section_size);
+    walk.sorted = (int*)malloc(sizeof(*walk.sorted) * (size_t)count);
+    walk.sorted_count = 0;
+    for (i = 0; i < ctest_section_size; i++) position[i] = -1;
+    for (i = 0; i < count; i++) position[test_index(ordered[i])] = i;
+
+    for (i = 0; i < count && result == 0; i++) result = dependency_visit(&walk, test_index(ordered[i]), 0);
+
+    if (result == 0) {
+        struct ctest** tests = (struct ctest**)malloc(sizeof(*tests) * (size_t)count);
+        int* indices = (int*)malloc(sizeof(*indices) * (size_t)count);
+        memcpy(tests, ordered, sizeof(*tests) * (size_t)count);
+        if (order) memcpy(indices, order, sizeof(*indices) * (size_t)count);
+        for (i = 0; i < count; i++) {
+            ordered[i] = tests[walk.sorted[i]];
+            if (order) order[i] = indices[walk.sorted[i]];
+        }
+        free(indices);
+        free(tests);
+    }
+    free(walk.sorted);
+    free(walk.stack);
+    free(walk.state);
+    free(position);
+    return result;
+}
+
+// Mark `tests` as pending and every other test as not part of the run
+static void reset_outcomes(struct ctest** tests, int count) {
+    int i;
+    if (!ctest_outcome) return;
+    memset(ctest_outcome, CTEST_IMPL_NOT_SELECTED, (size_t)ctest_section_size);
+    for (i = 0; i < count; i++) ctest_outcome[test_index(tests[i])] = CTEST_IMPL_PENDING;
+}
+
+// Whether every dependency of `t` has finished, or won't run
+static int dependencies_done(const struct ctest* t) {
+    int d;
+    if (!ctest_dep_first) return 1;
+    const int index = test_index(t);
+    for (d = ctest_dep_first[index]; d < ctest_dep_first[index + 1]; d++) {
+        if (ctest_outcome[ctest_dep_list[d]] == CTEST_IMPL_PENDING) return 0;
+    }
+    return 1;
+}
+
+// Whether a dependency of `t` didn't pass, or isn't part of the run
+static int dependency_failed(const struct ctest* t) {
+    int d;
+    if (!ctest_dep_first) return 0;
+    const int index = test_index(t);
+    for (d = ctest_dep_first[index]; d < ctest_dep_first[index + 1]; d++) {
+        switch (ctest_outcome[ctest_dep_list[d]]) {
+            case CTEST_STATUS_OK:
+            case CTEST_STATUS_CACHED:
+            case CTEST_STATUS_FLAKY:
+                break;
+            default:
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// Tags, see CTEST_TAGGED. Every distinct tag is a bit, and every test has the mask of its tags.
+#define CTEST_IMPL_MAX_TAGS 64
+
+static const char* ctest_tags;  // --tags
+static const char* ctest_tag_names[CTEST_IMPL_MAX_TAGS];
+static size_t ctest_tag_lengths[CTEST_IMPL_MAX_TAGS];
+static int ctest_tag_count;
+// By section index, NULL when no test has tags
+static uint64_t* ctest_tag_masks;
+static const char** ctest_tag_text;
+static int ctest_tags_filtered;  // whether --tags named a tag to select
+static uint64_t ctest_tags_wanted;  // a selected test has one of these
+static uint64_t ctest_tags_unwanted;  // and none of these
+
+// The bit of the tag `name`, or -1. With `add`, a new tag gets the next bit.
+static int tag_bit(const char* name, size_t length, int add) {
+    int i;
+    for (i = 0; i < ctest_tag_count; i++) {
+        if (ctest_tag_lengths[i] == length && strncmp(ctest_tag_names[i], name, length) == 0) return i;
+    }
+    if (!add || ctest_tag_count == CTEST_IMPL_MAX_TAGS) return -1;
+    ctest_tag_names[ctest_tag_count] = name;
+    ctest_tag_lengths[ctest_tag_count] = length;
+    return ctest_tag_count++;
+}
+
+// Point `tag` at the next tag of the comma-separated `list`, without spaces
+// around it, and return its length, or 0 at the end of the list
+static size_t next_tag(const char** list, const char** tag) {
+    size_t length;
+    while (**list == ',' || **list == ' ') (*list)++;
+    *tag = *list;
+    while (**list && **list != ',') (*list)++;
+    length = (size_t)(*list - *tag);
+    while (length && (*tag)[length - 1] == ' ') length--;
+    return length;
+}
+
+// Index the tags of every test, then resolve --tags. Print why and return -1 if that fails.
+static int load_tags(void) {
+    struct ctest_meta* meta;
+    const char* list;
+    const char* tag;
+    size_t length;
+    int tagged = 0;
+    int i;
+
+    ctest_tag_count = 0;
+    ctest_tags_filtered = 0;
+    ctest_tags_wanted = ctest_tags_unwanted = 0;
+    for (meta = ctest_meta_begin; meta != ctest_meta_end; meta++) {
+        if (meta->kind == CTEST_META_TAGS) tagged++;
+    }
+    if (tagged) {
+        int* sorted = (int*)malloc(sizeof(*sorted) * (size_t)ctest_section_size);
+        int count = 0;
+        ctest_tag_masks = (uint64_t*)calloc((size_t)ctest_section_size, sizeof(*ctest_tag_masks));
+        ctest_tag_text = (const char**)calloc((size_t)ctest_section_size, sizeof(*ctest_tag_text));
+        for (i = 0; i < ctest_section_size; i++) {
+            if (&ctest_section[i] != &CTEST_IMPL_TNAME(suite, test)) sorted[count++] = i;
+        }
+        qsort(sorted, (size_t)count, sizeof(*sorted), compare_tests);
+
+        for (meta = ctest_meta_begin; meta != ctest_meta_end; meta++) {
+            if (meta->kind != CTEST_META_TAGS) continue;
+            const int owner = find_test(sorted, count, meta->ssname, strlen(meta->ssname), meta->ttname);
+            if (owner < 0) continue;
+            ctest_tag_text[owner] = meta->values[0];
+            list = meta->values[0];
+            while ((length = next_tag(&list, &tag)) != 0) {
+                const int bit = tag_bit(tag, length, 1);
+                if (bit < 0) {
+                    fprintf(stderr, "%s:%s: there can be at most %d distinct tags\n", meta->ssname, meta->ttname, CTEST_IMPL_MAX_TAGS);
+                    free(sorted);
+                    return -1;
+                }
+                ctest_tag_masks[owner] |= (uint64_t)1 << bit;
+            }
+        }
+        free(sorted);
+    }
+
+    if (!ctest_tags) return 0;
+    list = ctest_tags;
+    while ((length = next_tag(&list, &tag)) != 0) {
+        const int unwanted = tag[0] == '-';
+        if (unwanted) {
+            tag++;
+            length--;
+        } else {
+            ctest_tags_filtered = 1;
+        }
+        const int bit = tag_bit(tag, length, 0);
+        if (bit < 0)
+            fprintf(stderr, "no test is tagged '%.*s'\n", (int)length, tag);
+        else if (unwanted)
+            ctest_tags_unwanted |= (uint64_t)1 << bit;
+        else
+            ctest_tags_wanted |= (uint64_t)1 << bit;
+    }
+    return 0;
+}
+
+// Whether the tags of `t` match --tags
+static int tags_match(const struct ctest* t) {
+    const uint64_t mask = ctest_tag_masks ? ctest_tag_masks[test_index(t)] : 0;
+    if (ctest_tags_filtered && !(mask & ctest_tags_wanted)) return 0;
+    return !(mask & ctest_tags_unwanted);
+}
+
+// The tags of `t` as written in CTEST_TAGGED, or ""
+static const char* test_tags(const struct ctest* t) {
+    const char* tags = ctest_tag_text ? ctest_tag_text[test_index(t)] : NULL;
+    return tags ? tags : "";
+}
+
+#if !defined(_WIN32)
+#include <errno.h>
+
+// Result cache: a passing test is recorded as a file named after the hash of
+// the executable, the test name and the contents of its CTEST_INPUTS. The
+// files are written with a rename, so a directory can be shared between runs.
+static const char* ctest_cache_dir;
+static int ctest_cache_read = 1;  // --no-cache still records passing tests
+static uint64_t ctest_binary_hash;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static int hash_file(uint64_t* hash, const char* path) {
+    unsigned char buffer[64 * 1024];
+    size_t size;
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        *hash = fnv1a(*hash, buffer, size);
+    }
+    fclose(file);
+    return 0;
+}
+
+// dl_iterate_phdr needs _GNU_SOURCE, which g++ always defines
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#define CTEST_IMPL_HAS_BUILD_ID 1
+#include <link.h>
+
+// Hash the GNU build-id note of the executable, the first object listed
+static int hash_build_id(struct dl_phdr_info* info, size_t size, void* data) {
+    uint64_t* hash = (uint64_t*)data;
+    int i;
+    (void) size;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* header = &info->dlpi_phdr[i];
+        const char* note = (const char*)(info->dlpi_addr + header->p_vaddr);
+        const char* end = note + header->p_memsz;
+        if (header->p_type != PT_NOTE) continue;
+
+        while (note + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr)* entry = (const ElfW(Nhdr)*)note;
+            const char* name = note + sizeof(ElfW(Nhdr));
+            const char* desc = name + ((entry->n_namesz + 3) & ~3u);
+            if (
+                entry->n_type == NT_GNU_BUILD_ID
+                && entry->n_namesz == 4
+                && memcmp(name, "GNU", 4) == 0
+            ) {
+                *hash = fnv1a(*hash, desc, entry->n_descsz);
+                return 1;
+            }
+            note = desc + ((entry->n_descsz + 3) & ~3u);
+        }
+    }
+    return 1;
+}
+#endif
+
+static void cache_open(const char* argv0) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    if (!ctest_cache_dir) {
+        ctest_cache_dir = getenv("CTEST_CACHE_DIR");
+    }
+    if (!ctest_cache_dir || ctest_cache_dir[0] == '\0') {
+        ctest_cache_dir = NULL;
+        return;
+    }
+
+#ifdef CTEST_IMPL_HAS_BUILD_ID
+    dl_iterate_phdr(hash_build_id, &hash);
+#endif
+    // Without a build-id, the whole executable is hashed instead
+    if (hash == 0xCBF29CE484222325ull && hash_file(&hash, "/proc/self/exe") != 0 && argv0) {
+        hash_file(&hash, argv0);
+    }
+    if (hash == 0xCBF29CE484222325ull) {
+        ctest_cache_dir = NULL;
+        return;
+    }
+    ctest_binary_hash = hash;
+    if (mkdir(ctest_cache_dir, 0777) != 0 && errno != EEXIST) {
+        ctest_cache_dir = NULL;
+    }
+}
+
+static int cache_path(char* path, size_t size, struct ctest* t) {
+    const char* const* inputs = find_meta(t, CTEST_META_INPUTS);
+    uint64_t hash = fnv1a(0xCBF29CE484222325ull, &ctest_binary_hash, sizeof(ctest_binary_hash));
+
+    hash = fnv1a(hash, t->ssname, strlen(t->ssname) + 1);
+    hash = fnv1a(hash, t->ttname, strlen(t->ttname) + 1);
+    for (; inputs && *inputs; inputs++) {
+        hash = fnv1a(hash, *inputs, strlen(*inputs) + 1);
+        // A missing input hashes differently from an empty one
+        if (hash_file(&hash, *inputs) != 0) hash = fnv1a(hash, "-", 1);
+        hash = fnv1a(hash, "", 1);
+    }
+
+    const int length = snprintf(path, size, "%s/%016" PRIx64, ctest_cache_dir, hash);
+    return length > 0 && (size_t)length < size ? 0 : -1;
+}
+
+static int cache_hit(struct ctest* t) {
+    char path[4096];
+    char content[512];
+    char expected[512];
+    FILE* file;
+    size_t size;
+
+    if (!ctest_cache_dir || !ctest_cache_read || cache_path(path, sizeof(path), t) != 0) return 0;
+    file = fopen(path, "rb");
+    if (!file) return 0;
+    size = fread(content, 1, sizeof(content) - 1, file);
+    fclose(file);
+    content[size] = '\0';
+    // Guard against hash collisions
+    snprintf(expected, sizeof(expected), "%s:%s\n", t->ssname, t->ttname);
+    return strcmp(content, expected) == 0;
+}
+
+static void cache_store(struct ctest* t) {
+    char path[4096];
+    char content[512];
+    int length;
+
+    if (!ctest_cache_dir || cache_path(path, sizeof(path), t) != 0) return;
+    length = snprintf(content, sizeof(content), "%s:%s\n", t->ssname, t->ttname);
+    if (length > 0 && (size_t)length < sizeof(content)) write_atomically(path, content, (size_t)length);
+}
+#else
+static const char* ctest_cache_dir;
+static int ctest_cache_read = 1;
+static void cache_open(const char* argv0) { (void) argv0; ctest_cache_dir = NULL; }
+static int cache_hit(struct ctest* t) { (void) t; return 0; }
+static void cache_store(struct ctest* t) { (void) t; }
+#endif
+
+#ifndef CTEST_TRACE_CAPACITY
+#define CTEST_TRACE_CAPACITY 65536  // spans kept by --trace, the oldest are overwritten
+#endif
+
+struct ctest_trace_span {
+    const char* category;
+    const char* name;  // NULL for the span of a whole test
+    struct ctest* test;
+    uint64_t begin;
+    uint64_t end;  // 0 while the span is open
+    int track;
+};
+
+// --trace: spans are recorded in a ring allocated before the first test, so
+// recording one is a few stores and two clock reads
+static const char* ctest_trace_path;
+static struct ctest_trace_span* ctest_trace_ring;
+static uint64_t ctest_trace_next = 1;  // sequence number of the next span, 0 is no span
+static uint64_t ctest_trace_started;
+static struct ctest* ctest_trace_test;  // the test CTEST_TRACE_SCOPE spans belong to
+static int ctest_trace_track;
+
+static uint64_t trace_record(const char* category, const char* name, struct ctest* test,
+                             uint64_t begin, uint64_t end, int track) {
+    struct ctest_trace_span* span;
+    if (!ctest_trace_ring) return 0;
+    span = &ctest_trace_ring[ctest_trace_next % CTEST_TRACE_CAPACITY];
+    span->category = category;
+    span->name = name;
+    span->test = test;
+    span->begin = begin;
+    span->end = end;
+    span->track = track;
+    return ctest_trace_next++;
+}
+
+static uint64_t trace_begin(const char* category, const char* name) {
+    if (!ctest_trace_ring) return 0;
+    return trace_record(category, name, ctest_trace_test, ctest_now_ns(), 0, ctest_trace_track);
+}
+
+uint64_t ctest_trace_begin(const char* name) {
+#ifdef CTEST_IMPL_HAS_THREADS
+    if (ctest_thread_jump) {
+        uint64_t span;
+        pthread_mutex_lock(&ctest_thread_lock);
+        span = trace_record("scope", name, ctest_trace_test, ctest_now_ns(), 0, ctest_thread_index + 1);
+        pthread_mutex_unlock(&ctest_thread_lock);
+        return span;
+    }
+#endif
+    return trace_begin("scope", name);
+}
+
+void ctest_trace_end(uint64_t* span) {
+    // The span may have been overwritten by newer ones already
+    if (*span == 0 || *span + CTEST_TRACE_CAPACITY < ctest_trace_next) return;
+    ctest_trace_ring[*span % CTEST_TRACE_CAPACITY].end = ctest_now_ns();
+}
+
+// Close the spans left open since `first`, by a failed assertion jumping out of them
+static void trace_close_open(uint64_t first) {
+    const uint64_t now = ctest_now_ns();
+    uint64_t span;
+    if (!ctest_trace_ring) return;
+    if (first + CTEST_TRACE_CAPACITY < ctest_trace_next) first = ctest_trace_next - CTEST_TRACE_CAPACITY;
+    for (span = first; span < ctest_trace_next; span++) {
+        if (ctest_trace_ring[span % CTEST_TRACE_CAPACITY].end == 0) {
+            ctest_trace_ring[span % CTEST_TRACE_CAPACITY].end = now;
+        }
+    }
+}
+
+static void trace_open(void) {
+    if (!ctest_trace_path) return;
+    ctest_trace_ring = (struct ctest_trace_span*)malloc(sizeof(*ctest_trace_ring) * CTEST_TRACE_CAPACITY);
+    if (!ctest_trace_ring) {
+        fprintf(stderr, "cannot allocate the trace buffer\n");
+        return;
+    }
+    // Touch every page now, rather than while a test is being timed
+    memset(ctest_trace_ring, 0, sizeof(*ctest_trace_ring) * CTEST_TRACE_CAPACITY);
+    ctest_trace_next = 1;
+    ctest_trace_started = ctest_now_ns();
+}
+
+static void trace_json_string(FILE* file, const char* text) {
+    fputc('"', file);
+    for (; *text; text++) {
+        const unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+static void trace_test_name(FILE* file, struct ctest* test) {
+    fputc('"', file);
+    fprintf(file, "%s:%s", test->ssname, test->ttname);
+    fputc('"', file);
+}
+
+// Write the spans as Chrome trace-event JSON, for chrome://tracing or Perfetto
+static void trace_write(void) {
+    uint64_t first = ctest_trace_next > CTEST_TRACE_CAPACITY ? ctest_trace_next - CTEST_TRACE_CAPACITY : 1;
+    uint64_t span;
+    int tracks = 1;
+    int track;
+#if !defined(_WIN32)
+    const long pid = (long)getpid();
+#else
+    const long pid = 1;
+#endif
+
+    if (!ctest_trace_ring) return;
+    FILE* file = fopen(ctest_trace_path, "w");
+    if (!file) {
+        fprintf(stderr, "cannot write trace '%s'\n", ctest_trace_path);
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%" PRIu64 "},\"traceEvents\":[\n",
+            first - 1);
+    for (span = first; span < ctest_trace_next; span++) {
+        const struct ctest_trace_span* s = &ctest_trace_ring[span % CTEST_TRACE_CAPACITY];
+        const uint64_t end = s->end ? s->end : s->begin;
+        if (s->track >= tracks) tracks = s->track + 1;
+
+        fprintf(file, "{\"ph\":\"X\",\"pid\":%ld,\"tid\":%d,\"cat\":\"%s\",\"name\":", pid, s->track, s->category);
+        if (s->name)
+            trace_json_string(file, s->name);
+        else if (s->test)
+            trace_test_name(file, s->test);
+        else
+            fprintf(file, "\"\"");
+        fprintf(file, ",\"ts\":%.3f,\"dur\":%.3f",
+                (double)(s->begin - ctest_trace_started) / 1000.0, (double)(end - s->begin) / 1000.0);
+        if (s->test) {
+            fprintf(file, ",\"args\":{\"test\":");
+            trace_test_name(file, s->test);
+            fprintf(file, ",\"file\":");
+            trace_json_string(file, s->test->file);
+            fprintf(file, ",\"line\":%d}", s->test->line);
+        }
+        fprintf(file, "},\n");
+    }
+    for (track = 0; track < tracks; track++) {
+        fprintf(file, "{\"ph\":\"M\",\"pid\":%ld,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"", pid, track);
+        if (track == 0)
+            fprintf(file, "tests");
+        else
+            fprintf(file, "track %d", track);
+        fprintf(file, "\"}}%s\n", track + 1 < tracks ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+}
+
+#ifdef CTEST_IMPL_HAS_THREADS
+struct ctest_impl_thread {
+    void (*body)(int);
+    int index;
+    int failed;
+    uint64_t begin;
+    uint64_t end;
+    pthread_t handle;
+};
+
+static pthread_cond_t ctest_thread_start = PTHREAD_COND_INITIALIZER;
+static int ctest_threads_ready;
+static int ctest_threads_released;
+
+static void* thread_main(void* argument) {
+    struct ctest_impl_thread* thread = (struct ctest_impl_thread*)argument;
+    jmp_buf jump;
+
+    // Wait until every thread is started, so that they all run at once
+    pthread_mutex_lock(&ctest_thread_lock);
+    ctest_threads_ready++;
+    pthread_cond_broadcast(&ctest_thread_start);
+    while (!ctest_threads_released) pthread_cond_wait(&ctest_thread_start, &ctest_thread_lock);
+    pthread_mutex_unlock(&ctest_thread_lock);
+
+    ctest_thread_index = thread->index;
+    ctest_thread_jump = &jump;
+#ifdef CTEST_IMPL_HAS_PROFILE
+    ctest_profile_top = (const char*)&jump;
+#endif
+    thread->begin = ctest_now_ns();
+    if (setjmp(jump) == 0) {
+        thread->body(thread->index);
+    } else {
+        thread->failed = 1;
+    }
+    thread->end = ctest_now_ns();
+    ctest_thread_jump = NULL;
+    ctest_thread_index = -1;
+    return NULL;
+}
+
+void ctest_impl_run_threads(void (*body)(int), int count) {
+    struct ctest_impl_thread* threads = (struct ctest_impl_thread*)calloc((size_t)(count > 0 ? count : 1), sizeof(*threads));
+    char timings[MSG_SIZE];
+    size_t length = 0;
+    int started;
+    int failed = 0;
+    int i;
+
+    ctest_threads_ready = 0;
+    ctest_threads_released = 0;
+    for (started = 0; started < count; started++) {
+        threads[started].body = body;
+        threads[started].index = started;
+        if (pthread_create(&threads[started].handle, NULL, thread_main, &threads[started]) != 0) break;
+    }
+
+    pthread_mutex_lock(&ctest_thread_lock);
+    while (ctest_threads_ready < started) pthread_cond_wait(&ctest_thread_start, &ctest_thread_lock);
+    ctest_threads_released = 1;
+    pthread_cond_broadcast(&ctest_thread_start);
+    pthread_mutex_unlock(&ctest_thread_lock);
+
+    timings[0] = '\0';
+    for (i = 0; i < started; i++) {
+        const struct ctest_impl_thread* thread = &threads[i];
+        pthread_join(thread->handle, NULL);
+        failed += thread->failed;
+        trace_record("thread", NULL, ctest_trace_test, thread->begin, thread->end, i + 1);
+        if (length < sizeof(timings)) {
+            const int size = snprintf(timings + length, sizeof(timings) - length, "%s%d: %.3f ms",
+                                      i ? ", " : "", i, (double)(thread->end - thread->begin) / 1e6);
+            if (size > 0) length += (size_t)size;
+        }
+    }
+    free(threads);
+
+    // Threads which took much longer than the others point at contention
+    CTEST_LOG("thread times %s", timings);
+    if (started < count) CTEST_ERR("only %d of %d threads could be started", started, count);
+    if (failed) CTEST_ERR("%d of %d threads failed", failed, count);
+}
+#endif
+
+// --cpu-cache=cold evicts the CPU caches before every test, and before every
+// timed run of a CTEST_COMPLEXITY size, by writing to each cache line of a
+// buffer bigger than them. The default, warm, runs each size once untimed first.
+#ifndef CTEST_CPU_CACHE_SWEEP_SIZE
+#define CTEST_CPU_CACHE_SWEEP_SIZE (64u * 1024u * 1024u)
+#endif
+
+static int ctest_cpu_cache_cold;
+static unsigned char* ctest_cpu_cache_buffer;
+
+static void cpu_cache_sweep(void) {
+    size_t i;
+    if (!ctest_cpu_cache_buffer) {
+        ctest_cpu_cache_buffer = (unsigned char*)calloc(CTEST_CPU_CACHE_SWEEP_SIZE, 1);
+        if (!ctest_cpu_cache_buffer) return;
+    }
+    for (i = 0; i < CTEST_CPU_CACHE_SWEEP_SIZE; i += 64) ctest_cpu_cache_buffer[i]++;
+}
+
+// The sizes take turns for this long per size, sweeps included, and at least 3 times, and the fastest run of each is kept
+#define CTEST_IMPL_COMPLEXITY_TIME_NS 5000000u
+#define CTEST_IMPL_COMPLEXITY_MAX_RUNS 1000
+
+static const char* const ctest_complexity_names[] = { "O(1)", "O(log n)", "O(n)", "O(n log n)", "O(n^2)" };
+// Set by EXPECT_COMPLEXITY, -1 without one
+static int ctest_complexity_expected = -1;
+static const char* ctest_complexity_file;
+static int ctest_complexity_line;
+
+void ctest_impl_expect_complexity(int complexity, const char* caller, int line) {
+    ctest_complexity_expected = complexity;
+    ctest_complexity_file = caller;
+    ctest_complexity_line = line;
+}
+
+static double complexity_model(int complexity, double n) {
+    switch (complexity) {
+    case CTEST_COMPLEXITY_LOG_N: return log(n < 2.0 ? 2.0 : n);
+    case CTEST_COMPLEXITY_N: return n;
+    case CTEST_COMPLEXITY_N_LOG_N: return n * log(n < 2.0 ? 2.0 : n);
+    case CTEST_COMPLEXITY_N_SQUARED: return n * n;
+    default: return 1.0;
+    }
+}
+
+// A simpler model is preferred while its mean squared relative error is at most this much above the
+// best one, about 5% of RMS error
+#define CTEST_IMPL_COMPLEXITY_TOLERANCE 0.0025
+
+// The mean squared relative error of the weighted least squares fit of times = a + c * model(n).
+// Weighting by 1 / t^2 fits the relative error, so that the largest size doesn't drown the others,
+// and the constant a takes the fixed cost of each run. Both a and c are kept >= 0.
+static double complexity_error(int complexity, const size_t* sizes, const double* times, int count) {
+    // The weighted sums of 1, f, t, f * f and f * t
+    double weights = 0.0;
+    double model = 0.0;
+    double total = 0.0;
+    double square = 0.0;
+    double product = 0.0;
+    double error = 0.0;
+    double determinant;
+    double a;
+    double c = 0.0;
+    int i;
+    for (i = 0; i < count; i++) {
+        const double t = times[i] < 1.0 ? 1.0 : times[i];
+        const double w = 1.0 / (t * t);
+        const double f = complexity_model(complexity, (double)sizes[i]);
+        weights += w;
+        model += w * f;
+        total += w * times[i];
+        square += w * f * f;
+        product += w * f * times[i];
+    }
+    a = total / weights;
+    determinant = weights * square - model * model;
+    if (complexity != CTEST_COMPLEXITY_CONSTANT && determinant > 0.0) {
+        c = (weights * product - model * total) / determinant;
+        a = (total - c * model) / weights;
+        if (a < 0.0) {
+            a = 0.0;
+            c = product / square;
+        }
+        if (c < 0.0) {
+            a = total / weights;
+            c = 0.0;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        const double t = times[i] < 1.0 ? 1.0 : times[i];
+        const double residual = (times[i] - a - c * complexity_model(complexity, (double)sizes[i])) / t;
+        error += residual * residual;
+    }
+    return error / count;
+}
+
+// The simplest model whose fit is within the tolerance of the best one
+static int complexity_fit(const size_t* sizes, const double* times, int count) {
+    double errors[CTEST_COMPLEXITY_N_SQUARED + 1];
+    double best_error = 0.0;
+    int complexity;
+    for (complexity = CTEST_COMPLEXITY_CONSTANT; complexity <= CTEST_COMPLEXITY_N_SQUARED; complexity++) {
+        errors[complexity] = complexity_error(complexity, sizes, times, count);
+        if (complexity == CTEST_COMPLEXITY_CONSTANT || errors[complexity] < best_error) best_error = errors[complexity];
+    }
+    for (complexity = CTEST_COMPLEXITY_CONSTANT; complexity < CTEST_COMPLEXITY_N_SQUARED; complexity++) {
+        if (errors[complexity] <= best_error + CTEST_IMPL_COMPLEXITY_TOLERANCE) break;
+    }
+    return complexity;
+}
+
+void ctest_impl_run_complexity(void (*body)(size_t), const size_t* sizes, int count) {
+    double* times;
+    char timings[MSG_SIZE];
+    size_t length = 0;
+    uint64_t begin;
+    int runs;
+    int best;
+    int i;
+
+    ctest_complexity_expected = -1;
+    if (count < 3) CTEST_ERR("CTEST_COMPLEXITY needs at least 3 sizes to fit, it has %d", count);
+    times = (double*)malloc(sizeof(*times) * (size_t)count);
+    if (!times) CTEST_ERR("out of memory");
+
+    // The sizes take turns, so that a slower spell of the machine slows them all instead of skewing some
+    for (i = 0; i < count; i++) {
+        times[i] = -1.0;
+        if (!ctest_cpu_cache_cold) body(sizes[i]);
+    }
+    begin = ctest_now_ns();
+    for (runs = 0; runs < CTEST_IMPL_COMPLEXITY_MAX_RUNS && (runs < 3 || ctest_now_ns() - begin < CTEST_IMPL_COMPLEXITY_TIME_NS * (uint64_t)count); runs++) {
+        for (i = 0; i < count; i++) {
+            uint64_t start;
+            double elapsed;
+            if (ctest_cpu_cache_cold) cpu_cache_sweep();
+            start = ctest_now_ns();
+            body(sizes[i]);
+            elapsed = (double)(ctest_now_ns() - start);
+            if (times[i] < 0.0 || elapsed < times[i]) times[i] = elapsed;
+        }
+    }
+
+    timings[0] = '\0';
+    for (i = 0; i < count; i++) {
+        if (length < sizeof(timings)) {
+            const int size = snprintf(timings + length, sizeof(timings) - length, "%sn=%lu: %.3f us",
+                                      i ? ", " : "", (unsigned long)sizes[i], times[i] / 1e3);
+            if (size > 0) length += (size_t)size;
+        }
+    }
+    best = complexity_fit(sizes, times, count);
+    free(times);
+
+    CTEST_LOG("best fit %s, times %s", ctest_complexity_names[best], timings);
+    if (ctest_complexity_expected >= 0 && best > ctest_complexity_expected) {
+        CTEST_IMPL_ERR_AT(ctest_complexity_file, ctest_complexity_line, "%s:%d  expected %s, the times fit %s best",
+                          ctest_complexity_file, ctest_complexity_line,
+                          ctest_complexity_names[ctest_complexity_expected], ctest_complexity_names[best]);
+    }
+}
+
+static void color_print(const char* color, const char* text) {
+    if (color_output)
+        fprintf(ctest_report, "%s%s" ANSI_NORMAL "\n", color, text);
+    else
+        fprintf(ctest_report, "%s\n", text);
+}
+
+struct ctest_counts {
+    int num_ok;  // including cached and flaky tests
+    int num_fail;
+    int num_skip;
+    int num_flaky;
+};
+
+// The outcome of running one test of a list
+struct ctest_result {
+    enum ctest_status status;
+    uint64_t duration;  // in nanoseconds, of the last attempt
+};
+
+// Those of the running ctest_run, NULL in the children it forks
+static struct ctest_callbacks* ctest_callbacks;
+
+static void callback_start(const struct ctest* test, int idx, int total) {
+    if (!ctest_callbacks || !ctest_callbacks->test_start) return;
+    ctest_callbacks->test_start(ctest_callbacks->context, test->ssname, test->ttname, idx, total);
+}
+
+static void callback_end(const struct ctest* test, enum ctest_status status, uint64_t duration) {
+    if (!ctest_callbacks || !ctest_callbacks->test_end) return;
+    ctest_callbacks->test_end(ctest_callbacks->context, test->ssname, test->ttname, status, duration);
+}
+
+static void count_status(struct ctest_counts* counts, enum ctest_status status) {
+    switch (status) {
+        case CTEST_STATUS_FLAKY: counts->num_flaky++; /* fallthrough */
+        case CTEST_STATUS_OK:
+        case CTEST_STATUS_CACHED: counts->num_ok++; break;
+        case CTEST_STATUS_FAILED: counts->num_fail++; break;
+        case CTEST_STATUS_SKIPPED: counts->num_skip++; break;
+    }
+}
+
+static void print_status(enum ctest_status status) {
+    switch (status) {
+        case CTEST_STATUS_OK:
+#ifdef CTEST_COLOR_OK
+            color_print(ANSI_BGREEN, "[OK]");
+#else
+            fprintf(ctest_report, "[OK]\n");
+#endif
+            break;
+        case CTEST_STATUS_FAILED:
+            color_print(ANSI_BRED, "[FAIL]");
+            break;
+        case CTEST_STATUS_SKIPPED:
+            color_print(ANSI_BYELLOW, "[SKIPPED]");
+            break;
+        case CTEST_STATUS_CACHED:
+#ifdef CTEST_COLOR_OK
+            color_print(ANSI_GREEN, "[CACHED]");
+#else
+            fprintf(ctest_report, "[CACHED]\n");
+#endif
+            break;
+        case CTEST_STATUS_FLAKY:
+            color_print(ANSI_BYELLOW, "[FLAKY]");
+            break;
+    }
+}
+
+#ifdef CTEST_IMPL_HAS_ASYNC
+}
+
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+namespace ctest_async {
+
+// Each CTEST_ASYNC test keeps its own error buffer, swapped in whenever it is resumed
+struct ctest_impl_async_test {
+    struct ctest* test;
+    int position;  // in the list of tests to run
+    std::coroutine_handle<task::promise_type> handle;
+    char errorbuffer[MSG_SIZE];
+    char* errormsg;
+    size_t errorsize;
+    struct ctest_event_capture events;
+    uint64_t started;
+    uint64_t duration;
+    bool finished;
+    bool failed;
+};
+
+struct ctest_impl_async_waiter {
+    ctest_impl_async_test* owner;
+    std::coroutine_handle<> handle;
+    int fd;
+    bool owns_fd;
+};
+
+static int ctest_async_epoll = -1;
+static int ctest_async_pending;
+static ctest_impl_async_test* ctest_async_current;
+
+static bool ctest_impl_async_register(int fd, unsigned int events, std::coroutine_handle<> handle, bool owns_fd) {
+    if (ctest_async_current == NULL || ctest_async_epoll < 0) {
+        if (owns_fd) close(fd);
+        return false;
+    }
+
+    ctest_impl_async_waiter* waiter = new (std::nothrow) ctest_impl_async_waiter{ctest_async_current, handle, fd, owns_fd};
+    if (waiter == NULL) {
+        if (owns_fd) close(fd);
+        return false;
+    }
+
+    struct epoll_event event;
+    event.events = events | EPOLLONESHOT;
+    event.data.ptr = waiter;
+
+    if (epoll_ctl(ctest_async_epoll, EPOLL_CTL_ADD, fd, &event) == 0) {
+        ctest_async_pending++;
+        return true;
+    }
+
+    if (errno == EEXIST && !owns_fd) {
+        // Another coroutine already waits on `fd`, epoll can watch a duplicate of it separately
+        int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (copy >= 0) {
+            waiter->fd = copy;
+            waiter->owns_fd = true;
+            if (epoll_ctl(ctest_async_epoll, EPOLL_CTL_ADD, copy, &event) == 0) {
+                ctest_async_pending++;
+                return true;
+            }
+            close(copy);
+        }
+    } else if (owns_fd) {
+        close(fd);
+    }
+
+    delete waiter;
+    return false;
+}
+
+bool ctest_impl_async_wait(int fd, unsigned int events, std::coroutine_handle<> handle) {
+    return ctest_impl_async_register(fd, events, handle, false);
+}
+
+bool ctest_impl_async_sleep(long long nanoseconds, std::coroutine_handle<> handle) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0) return false;
+
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = (time_t)(nanoseconds / 1000000000);
+    spec.it_value.tv_nsec = (long)(nanoseconds % 1000000000);
+    if (timerfd_settime(fd, 0, &spec, NULL) == -1) {
+        close(fd);
+        return false;
+    }
+
+    return ctest_impl_async_register(fd, EPOLLIN, handle, true);
+}
+
+// Add an ERR line to the current test without unwinding it
+static void ctest_impl_async_error(const char* message, const char* detail) {
+    msg_start(ANSI_YELLOW, "ERR");
+    char* text = ctest_errormsg;
+    const size_t available = ctest_errorsize;
+    const int size = print_errormsg("%s%s", message, detail);
+    if (size >= 0 && (size_t)size < available) event_message(CTEST_EVENT_ASSERT, text, (size_t)size);
+    msg_end();
+}
+
+static void ctest_impl_async_resume(ctest_impl_async_test* state, std::coroutine_handle<> handle) {
+    ctest_async_current = state;
+    ctest_async_running = 1;
+    ctest_errormsg = state->errormsg;
+    ctest_errorsize = state->errorsize;
+    ctest_event_capture = &state->events;
+
+    handle.resume();
+
+    if (!state->finished && state->handle.done()) {
+        state->finished = true;
+        state->duration = ctest_now_ns() - state->started;
+        if (std::exception_ptr exception = state->handle.promise().exception) {
+            state->failed = true;
+            try {
+                std::rethrow_exception(exception);
+            } catch (const ctest_async_failure&) {
+                // Already reported by CTEST_ERR
+            } catch (const std::exception& error) {
+                ctest_impl_async_error("unhandled exception: ", error.what());
+            } catch (...) {
+                ctest_impl_async_error("unhandled exception", "");
+            }
+        }
+    }
+
+    state->errormsg = ctest_errormsg;
+    state->errorsize = ctest_errorsize;
+    ctest_event_capture = NULL;
+    ctest_async_running = 0;
+    ctest_async_current = NULL;
+}
+
+// Run every CTEST_ASYNC test of `tests` concurrently, then report them in order
+static void ctest_impl_async_run(struct ctest** tests, int total, int* idx,
+                                 struct ctest_counts* counts, struct ctest_result* results) {
+    size_t count = 0;
+    int position;
+
+    for (position = 0; position < total; position++) {
+        if (tests[position]->kind == CTEST_KIND_ASYNC && !tests[position]->skip) count++;
+    }
+
+    ctest_impl_async_test* states = new ctest_impl_async_test[count]();
+    size_t i = 0;
+    ctest_async_epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    for (position = 0; position < total; position++) {
+        struct ctest* test = tests[position];
+        if (test->kind != CTEST_KIND_ASYNC || test->skip) continue;
+        ctest_impl_async_test* state = &states[i++];
+        state->position = position;
+        state->test = test;
+        state->errormsg = state->errorbuffer;
+        state->errorsize = MSG_SIZE-1;
+        state->started = ctest_now_ns();
+        state->handle = reinterpret_cast<task (*)(void)>(test->run.nullary)().release();
+        ctest_impl_async_resume(state, state->handle);
+    }
+
+    struct epoll_event events[64];
+    while (ctest_async_pending > 0 && ctest_async_epoll >= 0) {
+        int ready = epoll_wait(ctest_async_epoll, events, 64, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int e = 0; e < ready; e++) {
+            ctest_impl_async_waiter* waiter = (ctest_impl_async_waiter*)events[e].data.ptr;
+            ctest_impl_async_test* owner = waiter->owner;
+            std::coroutine_handle<> handle = waiter->handle;
+            epoll_ctl(ctest_async_epoll, EPOLL_CTL_DEL, waiter->fd, NULL);
+            if (waiter->owns_fd) close(waiter->fd);
+            delete waiter;
+            ctest_async_pending--;
+            ctest_impl_async_resume(owner, handle);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        ctest_impl_async_test* state = &states[i];
+
+        if (!state->finished) {
+            ctest_errormsg = state->errormsg;
+            ctest_errorsize = state->errorsize;
+            ctest_event_capture = &state->events;
+            ctest_impl_async_error("suspended on something the event loop can't resume", "");
+            ctest_event_capture = NULL;
+            state->failed = true;
+            state->duration = ctest_now_ns() - state->started;
+        }
+
+        const enum ctest_status status = state->failed ? CTEST_STATUS_FAILED : CTEST_STATUS_OK;
+        fprintf(ctest_report, "TEST %d/%d %s:%s\n", *idx, total, state->test->ssname, state->test->ttname);
+        event_test_start(*idx, total, state->test, test_tags(state->test));
+        callback_start(state->test, *idx, total);
+        event_replay(&state->events);
+        print_status(status);
+        if (state->errorsize != MSG_SIZE-1) fprintf(ctest_report, "%s", state->errorbuffer);
+        fflush(ctest_report);
+        event_test_end(status, state->duration);
+        callback_end(state->test, status, state->duration);
+        trace_record("test", NULL, state->test, state->started, state->started + state->duration, (int)i + 1);
+        count_status(counts, status);
+        if (results) {
+            results[state->position].status = status;
+            results[state->position].duration = state->duration;
+        }
+        (*idx)++;
+
+        state->handle.destroy();
+    }
+
+    if (ctest_async_epoll >= 0) close(ctest_async_epoll);
+    ctest_async_epoll = -1;
+    ctest_async_pending = 0;
+    delete[] states;
+}
+
+}
+
+extern "C" {
+#endif
+
+// --capture=failed|all redirects fds 1 and 2 to a memfd while a test runs
+// its setup, body and teardown. What it wrote is shown under its result, for
+// the failed tests or for all of them, as "  OUT: " lines and a
+// CTEST_EVENT_OUTPUT record. CTEST_ASYNC tests run together, so they aren't
+// captured. memfd_create needs _GNU_SOURCE.
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#include <sys/mman.h>
+#define CTEST_IMPL_HAS_CAPTURE 1
+#define CTEST_IMPL_CAPTURE_FAILED 1
+#define CTEST_IMPL_CAPTURE_ALL 2
+
+static int ctest_capture;  // --capture, 0 or one of CTEST_IMPL_CAPTURE_*
+static int ctest_capture_fd = -1;  // reused by every test of this process
+static int ctest_capture_saved[2] = { -1, -1 };  // fds 1 and 2, while they are redirected
+
+static void capture_begin(void) {
+    if (ctest_capture_fd < 0) {
+        ctest_capture_fd = memfd_create("ctest-capture", MFD_CLOEXEC);
+        if (ctest_capture_fd < 0) return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    if (ftruncate(ctest_capture_fd, 0) != 0 || lseek(ctest_capture_fd, 0, SEEK_SET) != 0) return;
+    ctest_capture_saved[0] = dup(STDOUT_FILENO);
+    ctest_capture_saved[1] = dup(STDERR_FILENO);
+    if (ctest_capture_saved[0] < 0 || ctest_capture_saved[1] < 0) {
+        if (ctest_capture_saved[0] >= 0) close(ctest_capture_saved[0]);
+        if (ctest_capture_saved[1] >= 0) close(ctest_capture_saved[1]);
+        ctest_capture_saved[0] = ctest_capture_saved[1] = -1;
+        return;
+    }
+    // Both share the memfd's offset, so their writes stay in order
+    dup2(ctest_capture_fd, STDOUT_FILENO);
+    dup2(ctest_capture_fd, STDERR_FILENO);
+}
+
+// Stop redirecting, and return the size of what was captured
+static size_t capture_end(void) {
+    struct stat info;
+    if (ctest_capture_saved[0] < 0) return 0;
+    fflush(stdout);
+    fflush(stderr);
+    dup2(ctest_capture_saved[0], STDOUT_FILENO);
+    dup2(ctest_capture_saved[1], STDERR_FILENO);
+    close(ctest_capture_saved[0]);
+    close(ctest_capture_saved[1]);
+    ctest_capture_saved[0] = ctest_capture_saved[1] = -1;
+    if (fstat(ctest_capture_fd, &info) != 0 || info.st_size <= 0) return 0;
+    return (size_t)info.st_size;
+}
+
+// Show the `size` captured bytes, read in place from a mapping of the memfd
+static void capture_report(size_t size) {
+    const char* text = (const char*)mmap(NULL, size, PROT_READ, MAP_SHARED, ctest_capture_fd, 0);
+    const char* line = text;
+    if (text == (const char*)MAP_FAILED) return;
+    while (line < text + size) {
+        const char* newline = (const char*)memchr(line, '\n', (size_t)(text + size - line));
+        const char* end = newline ? newline : text + size;
+        fprintf(ctest_report, "  OUT: %.*s\n", (int)(end - line), line);
+        line = end + (newline ? 1 : 0);
+    }
+    if (ctest_event_fd >= 0) {
+        uint32_t length;
+        struct iovec parts[2];
+        event_string(parts, &length, text, size);
+        event_emit(CTEST_EVENT_OUTPUT, parts, 2);
+    }
+    munmap((void*)text, size);
+}
+#endif
+
+#ifdef CTEST_SEGFAULT
+#include <signal.h>
+static void sighandler(int signum)
+{
+    const char msg_color[] = ANSI_BRED "[SIGSEGV: Segmentation fault]" ANSI_NORMAL "\n";
+    const char msg_nocolor[] = "[SIGSEGV: Segmentation fault]\n";
+
+    const char* msg = color_output ? msg_color : msg_nocolor;
+#ifdef CTEST_IMPL_HAS_CAPTURE
+    // Report the crash where the results go, not in the capture
+    if (ctest_capture_saved[0] >= 0) dup2(ctest_capture_saved[0], STDOUT_FILENO);
+#endif
+    // Without the text report, there is nowhere to print it
+    if (ctest_report == stdout) write(STDOUT_FILENO, msg, (unsigned int)strlen(msg));
+    event_flush();
+
+    /* "Unregister" the signal handler and send the signal back to the process
+     * so it can terminate as expected */
+    signal(signum, SIG_DFL);
+#if !defined(_WIN32) || defined(__CYGWIN__)
+    kill(getpid(), signum);
+#endif
+}
+#endif
+
+static int ctest_rusage;  // --rusage
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+
+// ru_maxrss is in KB, except on macOS where it is in bytes
+#ifdef __APPLE__
+#define CTEST_IMPL_MAXRSS_KB(usage) ((usage).ru_maxrss / 1024)
+#else
+#define CTEST_IMPL_MAXRSS_KB(usage) ((usage).ru_maxrss)
+#endif
+
+// The whole process, so that CTEST_THREADED threads are counted too
+static long rss_peak(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return CTEST_IMPL_MAXRSS_KB(usage);
+}
+
+static uint64_t timeval_ns(struct timeval value) {
+    return (uint64_t)value.tv_sec * 1000000000u + (uint64_t)value.tv_usec * 1000u;
+}
+
+// Print and send what a test used since `before`
+static void report_rusage(const struct rusage* before) {
+    struct rusage after;
+    getrusage(RUSAGE_SELF, &after);
+    uint64_t values[7] = {
+        (uint64_t)(CTEST_IMPL_MAXRSS_KB(after) - CTEST_IMPL_MAXRSS_KB(*before)),
+        (uint64_t)(after.ru_minflt - before->ru_minflt),
+        (uint64_t)(after.ru_majflt - before->ru_majflt),
+        (uint64_t)(after.ru_nvcsw - before->ru_nvcsw),
+        (uint64_t)(after.ru_nivcsw - before->ru_nivcsw),
+        timeval_ns(after.ru_utime) - timeval_ns(before->ru_utime),
+        timeval_ns(after.ru_stime) - timeval_ns(before->ru_stime),
+    };
+    fprintf(ctest_report, "  RUSAGE: max rss +%" PRIu64 " KB, %" PRIu64 " minor faults, %" PRIu64 " major faults, %" PRIu64
+           " voluntary switches, %" PRIu64 " involuntary switches, %.3f ms user, %.3f ms system\n",
+           values[0], values[1], values[2], values[3], values[4], (double)values[5] / 1e6, (double)values[6] / 1e6);
+    if (ctest_event_fd >= 0) {
+        struct iovec part = { values, sizeof(values) };
+        event_emit(CTEST_EVENT_RUSAGE, &part, 1);
+    }
+}
+#else
+static long rss_peak(void) { return 0; }
+#endif
+
+static long ctest_rss_start;  // rss_peak() when the current test started
+
+void assert_max_rss_delta(long kb, const char* caller, int line) {
+    const long delta = rss_peak() - ctest_rss_start;
+    if (delta > kb) {
+        CTEST_IMPL_ERR_AT(caller, line, "%s:%d  peak RSS grew by %ld KB, more than %ld KB", caller, line, delta, kb);
+    }
+}
+
+#ifdef CTEST_IMPL_HAS_PROFILE
+#include <elf.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+#define CTEST_IMPL_PROFILE_INTERVAL_US 1000
+#define CTEST_IMPL_PROFILE_DEPTH 64
+#define CTEST_IMPL_PROFILE_WORDS (1u << 20)
+
+/* --profile: while a test body runs, SIGPROF interrupts it every millisecond
+ * of CPU time. The handler follows the frame pointers from the interrupted
+ * code up to the frame that called the body, and appends the return
+ * addresses to a buffer allocated up front, as [depth, leaf, ..., outermost].
+ * After the test, the stacks are counted, symbolized from the executable's
+ * .symtab and written as "suite;test;outermost;...;leaf count" lines.
+ */
+static const char* ctest_profile_path;  // --profile
+static int ctest_profile_fd = -1;
+static uintptr_t* ctest_profile_samples;
+static size_t ctest_profile_used;  // words of ctest_profile_samples, taken atomically by the handler
+static unsigned long ctest_profile_lost;  // samples that didn't fit
+static volatile sig_atomic_t ctest_profile_armed;
+
+struct ctest_symbol {
+    uintptr_t start;  // run time address
+    uintptr_t size;
+    const char* name;
+};
+
+static struct ctest_symbol* ctest_symbols;
+static size_t ctest_symbol_count;
+static char* ctest_symbol_names;
+static int ctest_symbols_loaded;
+
+static void profile_handler(int signum, siginfo_t* info, void* context) {
+    const ucontext_t* interrupted = (const ucontext_t*)context;
+    uintptr_t stack[CTEST_IMPL_PROFILE_DEPTH];
+    // The interrupted frames are above this one, on the same stack
+    const char* bottom = (const char*)stack;
+    const char* top = ctest_profile_top;
+    const uintptr_t* frame;
+    size_t depth = 0;
+    size_t at;
+    (void)signum;
+    (void)info;
+
+    if (!ctest_profile_armed) return;
+#if defined(__x86_64__)
+    stack[depth++] = (uintptr_t)interrupted->uc_mcontext.gregs[16];  // REG_RIP
+    frame = (const uintptr_t*)interrupted->uc_mcontext.gregs[10];  // REG_RBP
+#else
+    stack[depth++] = (uintptr_t)interrupted->uc_mcontext.pc;
+    frame = (const uintptr_t*)interrupted->uc_mcontext.regs[29];
+#endif
+    // Each frame starts with the caller's frame and the return address
+    while (top && depth < CTEST_IMPL_PROFILE_DEPTH && (const char*)frame > bottom && (const char*)frame < top
+           && (uintptr_t)frame % sizeof(uintptr_t) == 0) {
+        const uintptr_t* caller = (const uintptr_t*)frame[0];
+        if ((const char*)caller >= top || caller <= frame) break;
+        // Inside the call instruction, which may be the last one of its function
+        stack[depth++] = frame[1] - 1;
+        frame = caller;
+    }
+
+    at = __atomic_fetch_add(&ctest_profile_used, depth + 1, __ATOMIC_RELAXED);
+    if (at + depth + 1 > CTEST_IMPL_PROFILE_WORDS) {
+        __atomic_fetch_add(&ctest_profile_lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    ctest_profile_samples[at] = depth;
+    memcpy(&ctest_profile_samples[at + 1], stack, depth * sizeof(*stack));
+}
+
+static int compare_symbols(const void* a, const void* b) {
+    const struct ctest_symbol* first = (const struct ctest_symbol*)a;
+    const struct ctest_symbol* second = (const struct ctest_symbol*)b;
+    return first->start < second->start ? -1 : first->start > second->start;
+}
+
+static int read_at(int fd, void* data, size_t size, uint64_t offset) {
+    return pread(fd, data, size, (off_t)offset) == (ssize_t)size ? 0 : -1;
+}
+
+// Load the functions of the executable's symbol table. Without one, the stacks have addresses.
+static void profile_load_symbols(void) {
+    const int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    Elf64_Ehdr header;
+    Elf64_Shdr* sections = NULL;
+    Elf64_Sym* symbols = NULL;
+    uintptr_t bias = 0;
+    size_t names_size = 0;
+    size_t count = 0;
+    size_t i;
+    int found = 0;
+
+    ctest_symbols_loaded = 1;
+    if (fd < 0) return;
+    if (read_at(fd, &header, sizeof(header), 0) != 0 || memcmp(header.e_ident, ELFMAG, SELFMAG) != 0
+        || header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_shentsize != sizeof(Elf64_Shdr)) {
+        close(fd);
+        return;
+    }
+    sections = (Elf64_Shdr*)malloc(sizeof(*sections) * (header.e_shnum ? header.e_shnum : 1));
+    if (!sections || read_at(fd, sections, sizeof(*sections) * header.e_shnum, header.e_shoff) != 0) header.e_shnum = 0;
+
+    for (i = 0; i < header.e_shnum; i++) {
+        const Elf64_Shdr* table = &sections[i];
+        if (table->sh_type != SHT_SYMTAB || table->sh_link >= header.e_shnum) continue;
+        count = table->sh_size / sizeof(Elf64_Sym);
+        symbols = (Elf64_Sym*)malloc(table->sh_size ? table->sh_size : 1);
+        ctest_symbol_names = (char*)malloc(sections[table->sh_link].sh_size + 1);
+        ctest_symbols = (struct ctest_symbol*)malloc(sizeof(*ctest_symbols) * (count ? count : 1));
+        if (!symbols || !ctest_symbol_names || !ctest_symbols
+            || read_at(fd, symbols, table->sh_size, table->sh_offset) != 0
+            || read_at(fd, ctest_symbol_names, sections[table->sh_link].sh_size, sections[table->sh_link].sh_offset) != 0) {
+            count = 0;
+            break;
+        }
+        names_size = sections[table->sh_link].sh_size;
+        ctest_symbol_names[names_size] = 0;
+        break;
+    }
+
+    for (i = 0; i < count; i++) {
+        const Elf64_Sym* symbol = &symbols[i];
+        if (ELF64_ST_TYPE(symbol->st_info) != STT_FUNC || symbol->st_value == 0 || symbol->st_name >= names_size) continue;
+        ctest_symbols[ctest_symbol_count].start = (uintptr_t)symbol->st_value;
+        ctest_symbols[ctest_symbol_count].size = (uintptr_t)symbol->st_size;
+        ctest_symbols[ctest_symbol_count].name = ctest_symbol_names + symbol->st_name;
+        // Where it was loaded, as the executable may be position independent
+        if (!found && strcmp(ctest_symbols[ctest_symbol_count].name, "ctest_main") == 0) {
+            bias = (uintptr_t)&ctest_main - (uintptr_t)symbol->st_value;
+            found = 1;
+        }
+        ctest_symbol_count++;
+    }
+    if (!found) ctest_symbol_count = 0;
+    for (i = 0; i < ctest_symbol_count; i++) ctest_symbols[i].start += bias;
+    qsort(ctest_symbols, ctest_symbol_count, sizeof(*ctest_symbols), compare_symbols);
+    free(symbols);
+    free(sections);
+    close(fd);
+}
+
+// The function containing `address`, or NULL
+static const struct ctest_symbol* profile_symbol(uintptr_t address) {
+    size_t low = 0;
+    size_t high = ctest_symbol_count;
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        if (ctest_symbols[middle].start <= address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == 0) return NULL;
+    const struct ctest_symbol* symbol = &ctest_symbols[low - 1];
+    return address < symbol->start + (symbol->size ? symbol->size : 1) ? symbol : NULL;
+}
+
+// Open the --profile file and install the SIGPROF handler. Print why and return -1 if that fails.
+static int profile_open(void) {
+    struct sigaction action;
+    ctest_profile_fd = open(ctest_profile_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    ctest_profile_samples = (uintptr_t*)malloc(sizeof(*ctest_profile_samples) * CTEST_IMPL_PROFILE_WORDS);
+    if (ctest_profile_fd < 0 || !ctest_profile_samples) {
+        fprintf(stderr, "--profile: can't write '%s': %s\n", ctest_profile_path, strerror(errno));
+        return -1;
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = profile_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    return 0;
+}
+
+static void profile_close(void) {
+    if (ctest_profile_fd < 0) return;
+    signal(SIGPROF, SIG_IGN);
+    close(ctest_profile_fd);
+    ctest_profile_fd = -1;
+    free(ctest_profile_samples);
+    ctest_profile_samples = NULL;
+    free(ctest_symbols);
+    free(ctest_symbol_names);
+    ctest_symbols = NULL;
+    ctest_symbol_names = NULL;
+    ctest_symbol_count = 0;
+    ctest_symbols_loaded = 0;
+    ctest_profile_used = 0;
+    ctest_profile_lost = 0;
+}
+
+static void profile_start(void) {
+    struct itimerval timer = { { 0, CTEST_IMPL_PROFILE_INTERVAL_US }, { 0, CTEST_IMPL_PROFILE_INTERVAL_US } };
+    if (ctest_profile_fd < 0) return;
+    ctest_profile_used = 0;
+    ctest_profile_lost = 0;
+    ctest_profile_armed = 1;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// The recorded samples, in order of their stacks so that equal ones are next to each other
+static int compare_samples(const void* a, const void* b) {
+    const uintptr_t* first = &ctest_profile_samples[*(const size_t*)a];
+    const uintptr_t* second = &ctest_profile_samples[*(const size_t*)b];
+    size_t i;
+    if (first[0] != second[0]) return first[0] < second[0] ? -1 : 1;
+    for (i = 1; i <= first[0]; i++) {
+        if (first[i] != second[i]) return first[i] < second[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static void profile_output(const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t written = write(ctest_profile_fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return;
+        data += written;
+        size -= (size_t)written;
+    }
+}
+
+// Append `text` to the folded output in `buffer`, writing it out at line ends once it fills up
+static void profile_write(char* buffer, size_t* used, size_t capacity, const char* text, int line_end) {
+    const size_t length = strlen(text);
+    if (*used + length < capacity) {
+        memcpy(buffer + *used, text, length);
+        *used += length;
+    }
+    if (line_end && *used > capacity / 2) {
+        // Whole lines, so that --jobs children appending to the file don't mix them up
+        profile_output(buffer, *used);
+        *used = 0;
+    }
+}
+
+// Stop sampling, and write the stacks of `test`
+static void profile_finish(const struct ctest* test) {
+    struct itimerval timer;
+    size_t* samples;
+    size_t count = 0;
+    size_t used;
+    size_t at;
+    size_t i;
+    char* output;
+    size_t length = 0;
+    const size_t capacity = 65536;
+    char number[64];
+
+    if (ctest_profile_fd < 0 || !ctest_profile_armed) return;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    ctest_profile_armed = 0;
+
+    used = ctest_profile_used < CTEST_IMPL_PROFILE_WORDS ? ctest_profile_used : CTEST_IMPL_PROFILE_WORDS;
+    for (at = 0; at < used && at + 1 + ctest_profile_samples[at] <= used; at += 1 + ctest_profile_samples[at]) count++;
+    samples = (size_t*)malloc(sizeof(*samples) * (count ? count : 1));
+    output = (char*)malloc(capacity);
+    if (!samples || !output) {
+        free(samples);
+        free(output);
+        return;
+    }
+    if (count && !ctest_symbols_loaded) profile_load_symbols();
+    for (at = 0, i = 0; i < count; at += 1 + ctest_profile_samples[at]) {
+        size_t frame;
+        // Addresses in the same function are the same frame
+        for (frame = 1; frame <= ctest_profile_samples[at]; frame++) {
+            const struct ctest_symbol* symbol = profile_symbol(ctest_profile_samples[at + frame]);
+            if (symbol) ctest_profile_samples[at + frame] = symbol->start;
+        }
+        samples[i++] = at;
+    }
+    qsort(samples, count, sizeof(*samples), compare_samples);
+
+    for (i = 0; i < count;) {
+        const uintptr_t* stack = &ctest_profile_samples[samples[i]];
+        size_t same = 1;
+        size_t frame;
+        while (i + same < count && compare_samples(&samples[i], &samples[i + same]) == 0) same++;
+        profile_write(output, &length, capacity, test->ssname, 0);
+        profile_write(output, &length, capacity, ";", 0);
+        profile_write(output, &length, capacity, test->ttname, 0);
+        for (frame = stack[0]; frame > 0; frame--) {
+            const struct ctest_symbol* symbol = profile_symbol(stack[frame]);
+            const char* name = symbol ? symbol->name : number;
+            if (!symbol) snprintf(number, sizeof(number), "0x%lx", (unsigned long)stack[frame]);
+            profile_write(output, &length, capacity, ";", 0);
+            profile_write(output, &length, capacity, name, 0);
+        }
+        snprintf(number, sizeof(number), " %lu\n", (unsigned long)same);
+        profile_write(output, &length, capacity, number, 1);
+        i += same;
+    }
+    if (ctest_profile_lost) {
+        snprintf(number, sizeof(number), ";[lost] %lu\n", ctest_profile_lost);
+        profile_write(output, &length, capacity, test->ssname, 0);
+        profile_write(output, &length, capacity, ";", 0);
+        profile_write(output, &length, capacity, test->ttname, 0);
+        profile_write(output, &length, capacity, number, 1);
+    }
+    profile_output(output, length);
+    free(output);
+    free(samples);
+}
+#endif
+
+// Fixture storage. Tests run one at a time in a process, so one zeroed,
+// cache-line aligned slot, sized for the largest CTEST_DATA so far, is
+// enough. With --jobs every child has its own. C++ fixtures are constructed
+// in it and destroyed after teardown, or when the test fails.
+#define CTEST_IMPL_FIXTURE_ALIGN 64
+static unsigned char* ctest_fixture_block;
+static size_t ctest_fixture_capacity;
+static struct ctest* ctest_fixture_owner;  // whose C++ fixture is alive in the slot
+static void* ctest_fixture_data;
+
+static void* fixture_slot(size_t size) {
+    unsigned char* slot;
+    if (size > ctest_fixture_capacity) {
+        free(ctest_fixture_block);
+        ctest_fixture_block = (unsigned char*)malloc(size + CTEST_IMPL_FIXTURE_ALIGN);
+        ctest_fixture_capacity = ctest_fixture_block ? size : 0;
+        if (!ctest_fixture_block) return NULL;
+    }
+    slot = ctest_fixture_block + CTEST_IMPL_FIXTURE_ALIGN - (uintptr_t)ctest_fixture_block % CTEST_IMPL_FIXTURE_ALIGN;
+    memset(slot, 0, size);
+    return slot;
+}
+
+static void fixture_destroy(void) {
+    struct ctest* owner = ctest_fixture_owner;
+    // Cleared first, a destructor that fails can't destroy it twice
+    ctest_fixture_owner = NULL;
+    if (owner) owner->fixture(ctest_fixture_data, 0);
+}
+
+// Run setup, the test and teardown. Messages are left in ctest_errorbuffer.
+static enum ctest_status run_test(struct ctest* test) {
+    const uint64_t first_span = ctest_trace_next;
+    ctest_errorbuffer[0] = 0;
+    ctest_errorsize = MSG_SIZE-1;
+    ctest_errormsg = ctest_errorbuffer;
+#ifdef CTEST_LAZY_LOG
+    log_flush(0);
+#endif
+
+    if (setjmp(ctest_err) != 0) {
+        trace_close_open(first_span);
+#ifdef CTEST_IMPL_HAS_PROFILE
+        profile_finish(test);
+#endif
+        fixture_destroy();
+        return CTEST_STATUS_FAILED;
+    }
+
+#ifndef CTEST_IMPL_HAS_ASYNC
+    if (test->kind == CTEST_KIND_ASYNC) {
+        CTEST_ERR("CTEST_ASYNC tests need ctest_main to be compiled as C++20 on Linux, this one (e.g. the ctest library) wasn't");
+    }
+#endif
+    void* data = test->data_size ? fixture_slot(test->data_size) : NULL;
+    if (test->data_size && !data) {
+        CTEST_ERR("cannot allocate %lu bytes for the fixture", (unsigned long)test->data_size);
+    }
+    if (data && test->fixture) {
+        test->fixture(data, 1);
+        ctest_fixture_owner = test;
+        ctest_fixture_data = data;
+    }
+    ctest_rss_start = rss_peak();
+    if (test->setup && *test->setup) {
+        uint64_t span = trace_begin("phase", "setup");
+        (*test->setup)(data);
+        ctest_trace_end(&span);
+    }
+    {
+        uint64_t span = trace_begin("phase", "run");
+#ifdef CTEST_IMPL_HAS_PROFILE
+        ctest_profile_top = (const char*)&span;
+        profile_start();
+#endif
+        if (data)
+            test->run.unary(data);
+        else
+            test->run.nullary();
+#ifdef CTEST_IMPL_HAS_PROFILE
+        profile_finish(test);
+#endif
+        ctest_trace_end(&span);
+    }
+    if (test->teardown && *test->teardown) {
+        uint64_t span = trace_begin("phase", "teardown");
+        (*test->teardown)(data);
+        ctest_trace_end(&span);
+    }
+    fixture_destroy();
+#ifdef CTEST_LAZY_LOG
+    log_flush(ctest_verbose);
+#endif
+    // if we got here it's ok
+    return CTEST_STATUS_OK;
+}
+
+static int ctest_retries;
+
+static enum ctest_status report_test(struct ctest* test, int idx, int total, uint64_t* duration_out) {
+    enum ctest_status status;
+    uint64_t duration = 0;
+    int ran = 0;
+    int attempt = 0;
+    int blocked = 0;
+    char failure[MSG_SIZE];
+#if !defined(_WIN32)
+    struct rusage usage;
+#endif
+#ifdef CTEST_IMPL_HAS_CAPTURE
+    size_t captured = 0;
+#endif
+
+    ctest_trace_test = test;
+    uint64_t test_span = trace_begin("test", NULL);
+    fprintf(ctest_report, "TEST %d/%d %s:%s\n", idx, total, test->ssname, test->ttname);
+    fflush(ctest_report);
+    event_test_start(idx, total, test, test_tags(test));
+    callback_start(test, idx, total);
+
+    if (test->skip) {
+        status = CTEST_STATUS_SKIPPED;
+    } else if (dependency_failed(test)) {
+        status = CTEST_STATUS_SKIPPED;
+        blocked = 1;
+    } else if (cache_hit(test)) {
+        status = CTEST_STATUS_CACHED;
+    } else {
+#if !defined(_WIN32)
+        if (ctest_rusage) getrusage(RUSAGE_SELF, &usage);
+#endif
+        for (;;) {
+            if (ctest_cpu_cache_cold) cpu_cache_sweep();
+#ifdef CTEST_IMPL_HAS_CAPTURE
+            if (ctest_capture) capture_begin();
+#endif
+            const uint64_t started = ctest_now_ns();
+            status = run_test(test);
+            duration = ctest_now_ns() - started;
+#ifdef CTEST_IMPL_HAS_CAPTURE
+            if (ctest_capture) captured = capture_end();
+#endif
+            if (status != CTEST_STATUS_FAILED || attempt == ctest_retries) break;
+            // Keep what the failed attempt printed, to show with [FLAKY]
+            memcpy(failure, ctest_errorbuffer, sizeof(failure));
+            attempt++;
+        }
+        if (status == CTEST_STATUS_OK && attempt > 0) status = CTEST_STATUS_FLAKY;
+        ran = 1;
+    }
+
+    uint64_t report_span = trace_begin("phase", "report");
+    if (blocked)
+        color_print(ANSI_BYELLOW, "[SKIPPED: dependency failed]");
+    else
+        print_status(status);
+    if (status == CTEST_STATUS_FLAKY) {
+        fprintf(ctest_report, "%s  FLAKY: passed on attempt %d of %d\n", failure, attempt + 1, ctest_retries + 1);
+    } else if (ran && ctest_errorsize != MSG_SIZE-1) {
+        fprintf(ctest_report, "%s", ctest_errorbuffer);
+    }
+#ifdef CTEST_IMPL_HAS_CAPTURE
+    if (captured && (ctest_capture == CTEST_IMPL_CAPTURE_ALL || status == CTEST_STATUS_FAILED)) capture_report(captured);
+#endif
+#if !defined(_WIN32)
+    if (ran && ctest_rusage) report_rusage(&usage);
+#endif
+    event_test_end(status, duration);
+    callback_end(test, status, duration);
+    if (status == CTEST_STATUS_OK) cache_store(test);
+    if (ctest_outcome) ctest_outcome[test_index(test)] = (unsigned char)status;
+    ctest_trace_end(&report_span);
+    ctest_trace_end(&test_span);
+    ctest_trace_test = NULL;
+    if (duration_out) *duration_out = duration;
+    return status;
+}
+
+static int ctest_jobs = 1;  // --jobs
+
+// --cpus pins the runner to a list of CPUs, so that the scheduler doesn't
+// migrate the tests. Its threads and --jobs children stay on them, and each
+// --jobs child is pinned to one of them. cpu_set_t needs _GNU_SOURCE.
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#include <sched.h>
+#define CTEST_IMPL_HAS_AFFINITY 1
+
+static int ctest_cpus[CPU_SETSIZE];  // --cpus
+static int ctest_cpu_count;
+
+// Parse a list like "0,2,4-7" into ctest_cpus
+static int parse_cpus(const char* list) {
+    ctest_cpu_count = 0;
+    while (*list) {
+        char* end;
+        const long first = strtol(list, &end, 10);
+        long last = first;
+        long cpu;
+        if (end == list || first < 0) return -1;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) return -1;
+        }
+        if (last < first || last >= CPU_SETSIZE || ctest_cpu_count + (last - first) >= CPU_SETSIZE) return -1;
+        for (cpu = first; cpu <= last; cpu++) ctest_cpus[ctest_cpu_count++] = (int)cpu;
+        if (*end == ',') end++;
+        else if (*end) return -1;
+        list = end;
+    }
+    return ctest_cpu_count ? 0 : -1;
+}
+
+static int pin_cpus(const int* cpus, int count) {
+    cpu_set_t set;
+    int i;
+    CPU_ZERO(&set);
+    for (i = 0; i < count; i++) CPU_SET(cpus[i], &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+#endif
+
+// --watch needs inotify and readlink, which strict C modes don't declare
+#if defined(__linux__) && (defined(_GNU_SOURCE) || !defined(__STRICT_ANSI__))
+#define CTEST_IMPL_HAS_WATCH 1
+#define CTEST_IMPL_WATCH_DIRS 16
+
+// --watch, see watch_loop. Each run it starts gets --watch-state=FD, a file with
+// the results of the previous run, to put the tests that failed first and to
+// only show the results that changed.
+static int ctest_watch;
+static const char* ctest_watch_dirs[CTEST_IMPL_WATCH_DIRS];  // --watch-dir
+static int ctest_watch_dir_count;
+static int ctest_watch_fd = -1;
+static unsigned char* ctest_watch_previous;  // status of each test in the previous run, or CTEST_IMPL_NOT_SELECTED
+static int ctest_watch_hidden;  // results not shown because they didn't change
+
+// Whether the result of `test` differs from the previous --watch run
+static int watch_changed(const struct ctest* test, enum ctest_status status) {
+    if (status == CTEST_STATUS_CACHED) status = CTEST_STATUS_OK;
+    if (ctest_watch_previous[test_index(test)] != (unsigned char)status) return 1;
+    ctest_watch_hidden++;
+    return 0;
+}
+
+static enum ctest_status watch_report(struct ctest* test, int idx, int total, uint64_t* duration);
+#endif
+
+// --coordinator and --worker need sockets and getaddrinfo, which strict C modes don't declare
+#if !defined(_WIN32) && (defined(_GNU_SOURCE) || !defined(__STRICT_ANSI__))
+#define CTEST_IMPL_HAS_DISTRIBUTED 1
+
+static const char* ctest_coordinator;  // --coordinator
+static const char* ctest_worker;  // --worker
+
+static void run_distributed(struct ctest** tests, int count, struct ctest_counts* counts, struct ctest_result* results);
+#endif
+
+#if !defined(_WIN32)
+static void run_parallel(struct ctest** tests, int count, struct ctest_counts* counts, struct ctest_result* results);
+#endif
+
+// Run `tests` in order. If given, `results` receives the outcome of each test.
+static void run_tests(struct ctest** tests, int count, struct ctest_counts* counts, struct ctest_result* results) {
+    int idx = 1;
+    int i;
+#ifdef CTEST_IMPL_HAS_ASYNC
+    int async_done = 0;
+#endif
+
+    reset_outcomes(tests, count);
+#ifdef CTEST_IMPL_HAS_DISTRIBUTED
+    if (ctest_coordinator) {
+        run_distributed(tests, count, counts, results);
+        return;
+    }
+#endif
+#if !defined(_WIN32)
+    if (ctest_jobs > 1) {
+        run_parallel(tests, count, counts, results);
+        return;
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        struct ctest* test = tests[i];
+#ifdef CTEST_IMPL_HAS_ASYNC
+        if (test->kind == CTEST_KIND_ASYNC && !test->skip) {
+            if (!async_done) {
+                ctest_async::ctest_impl_async_run(tests, count, &idx, counts, results);
+                async_done = 1;
+            }
+            continue;
+        }
+#endif
+        uint64_t duration;
+        enum ctest_status status;
+#ifdef CTEST_IMPL_HAS_WATCH
+        if (ctest_watch_previous)
+            status = watch_report(test, idx++, count, &duration);
+        else
+#endif
+            status = report_test(test, idx++, count, &duration);
+        count_status(counts, status);
+        if (results) {
+            results[i].status = status;
+            results[i].duration = duration;
+        }
+    }
+}
+
+static int ctest_shuffle;
+static uint64_t ctest_seed;
+static int ctest_bisect;
+static int ctest_list;
+
+// splitmix64, so that a seed gives the same order on every platform
+static uint64_t random_next(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Put `tests` in the order to run them in, as indices into `tests` in `order`
+static void order_tests(struct ctest** ordered, int* order, struct ctest** tests, int count, uint64_t seed) {
+    uint64_t state = seed;
+    int i;
+    for (i = 0; i < count; i++) order[i] = i;
+    if (ctest_shuffle) {
+        for (i = count - 1; i > 0; i--) {
+            int j = (int)(random_next(&state) % (uint64_t)(i + 1));
+            int swap = order[i];
+            order[i] = order[j];
+            order[j] = swap;
+        }
+    }
+    for (i = 0; i < count; i++) ordered[i] = tests[order[i]];
+    order_dependencies(ordered, order, count);
+}
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/wait.h>
+
+// Run `tests` in a forked, silent child. Return the status of the last test.
+// Order-dependence comes from state left behind by earlier tests, so the
+// children are forked from a process which hasn't run any test yet.
+static enum ctest_status bisect_trial(struct ctest** tests, int count) {
+    int status;
+    // Every stream, or the child would write what they buffer again
+    fflush(NULL);
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        struct ctest_counts counts = { 0, 0, 0, 0 };
+        struct ctest_result* results = (struct ctest_result*)calloc((size_t)count, sizeof(*results));
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        ctest_event_fd = -1;
+        ctest_cache_dir = NULL;
+        ctest_trace_ring = NULL;
+        ctest_retries = 0;
+        ctest_callbacks = NULL;
+        run_tests(tests, count, &counts, results);
+        fflush(stdout);
+        _exit(results[count - 1].status == CTEST_STATUS_FAILED ? 1 : 0);
+    }
+
+    if (pid < 0 || waitpid(pid, &status, 0) != pid) return CTEST_STATUS_FAILED;
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? CTEST_STATUS_OK : CTEST_STATUS_FAILED;
+}
+
+// Whether `failing` fails when run after the `count` tests of `before`
+static int bisect_fails(struct ctest** trial, struct ctest* const* before, int count, struct ctest* failing) {
+    memcpy(trial, before, sizeof(*trial) * (size_t)count);
+    trial[count] = failing;
+    return bisect_trial(trial, count + 1) == CTEST_STATUS_FAILED;
+}
+
+// Find the fewest tests, among those that ran before `tests[target]`, it needs
+// to fail. This is delta debugging: the candidates are split in chunks, and a
+// chunk, or all but a chunk, that still makes it fail replaces them. Otherwise
+// the chunks get smaller, down to single tests, so that no test of the result
+// can be left out.
+static void bisect_test(struct ctest** tests, int target) {
+    struct ctest** candidates = (struct ctest**)malloc(sizeof(*candidates) * (size_t)(target + 1));
+    struct ctest** rest = (struct ctest**)malloc(sizeof(*rest) * (size_t)(target + 1));
+    struct ctest** trial = (struct ctest**)malloc(sizeof(*trial) * (size_t)(target + 1));
+    struct ctest* failing = tests[target];
+    int count = target;
+    int chunks = 2;
+    int i;
+
+    memcpy(candidates, tests, sizeof(*candidates) * (size_t)target);
+
+    if (bisect_fails(trial, candidates, 0, failing)) {
+        fprintf(ctest_report, "BISECT: %s:%s fails on its own\n", failing->ssname, failing->ttname);
+    } else if (!bisect_fails(trial, candidates, count, failing)) {
+        fprintf(ctest_report, "BISECT: %s:%s did not fail again in the same order\n", failing->ssname, failing->ttname);
+    } else {
+        while (count > 1) {
+            int reduced = 0;
+            // A chunk alone, then all but a chunk, keeping the original order
+            for (i = 0; i < chunks && !reduced; i++) {
+                const int begin = count * i / chunks;
+                const int end = count * (i + 1) / chunks;
+                if (bisect_fails(trial, candidates + begin, end - begin, failing)) {
+                    memmove(candidates, candidates + begin, sizeof(*candidates) * (size_t)(end - begin));
+                    count = end - begin;
+                    chunks = 2;
+                    reduced = 1;
+                }
+            }
+            // With 2 chunks, all but one is the other one, which was just tried
+            for (i = 0; i < chunks && !reduced && chunks > 2; i++) {
+                const int begin = count * i / chunks;
+                const int end = count * (i + 1) / chunks;
+                memcpy(rest, candidates, sizeof(*rest) * (size_t)begin);
+                memcpy(rest + begin, candidates + end, sizeof(*rest) * (size_t)(count - end));
+                if (bisect_fails(trial, rest, count - (end - begin), failing)) {
+                    count -= end - begin;
+                    memcpy(candidates, rest, sizeof(*candidates) * (size_t)count);
+                    chunks = chunks - 1 > 2 ? chunks - 1 : 2;
+                    reduced = 1;
+                }
+            }
+            if (reduced) continue;
+            if (chunks >= count) break;
+            chunks = chunks * 2 < count ? chunks * 2 : count;
+        }
+
+        if (count == 1) {
+            fprintf(ctest_report, "BISECT: %s:%s fails when run after %s:%s\n",
+                   failing->ssname, failing->ttname, candidates[0]->ssname, candidates[0]->ttname);
+        } else {
+            fprintf(ctest_report, "BISECT: %s:%s fails when run after all of", failing->ssname, failing->ttname);
+            for (i = 0; i < count; i++) fprintf(ctest_report, " %s:%s", candidates[i]->ssname, candidates[i]->ttname);
+            fprintf(ctest_report, "\n");
+        }
+    }
+
+    free(trial);
+    free(rest);
+    free(candidates);
+}
+
+// Run `tests` in a child process, then bisect every test that failed
+static void bisect_order(struct ctest** tests, int count, struct ctest_counts* counts) {
+    struct ctest_result* results = (struct ctest_result*)calloc((size_t)(count ? count : 1), sizeof(*results));
+    int fds[2];
+    int i;
+
+    if (pipe(fds) == -1) {
+        run_tests(tests, count, counts, results);
+        free(results);
+        return;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        ctest_callbacks = NULL;
+        run_tests(tests, count, counts, results);
+        fflush(NULL);
+        event_flush();
+        trace_write();
+        write(fds[1], counts, sizeof(*counts));
+        write(fds[1], results, sizeof(*results) * (size_t)count);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    char* output = (char*)counts;
+    size_t expected = sizeof(*counts);
+    size_t received = 0;
+    while (pid > 0 && received < expected) {
+        ssize_t size = read(fds[0], output + received, expected - received);
+        if (size <= 0) break;
+        received += (size_t)size;
+        if (received == expected && output == (char*)counts) {
+            output = (char*)results;
+            expected = sizeof(*results) * (size_t)count;
+            received = 0;
+        }
+    }
+    close(fds[0]);
+    if (pid > 0) waitpid(pid, NULL, 0);
+    // The child has written the trace of the run
+    free(ctest_trace_ring);
+    ctest_trace_ring = NULL;
+    for (i = 0; i < count && received == expected; i++) {
+        callback_start(tests[i], i + 1, count);
+        callback_end(tests[i], results[i].status, results[i].duration);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (results[i].status == CTEST_STATUS_FAILED) bisect_test(tests, i);
+    }
+
+    free(results);
+}
+
+// A forked child running one test for run_parallel
+struct ctest_job {
+    pid_t pid;
+    int position;
+    int result_fd;  // the child writes its struct ctest_result here
+    int output;  // unlinked files for its stdout and its event records
+    int events;  // -1 without CTEST_EVENT_FD
+    int trace;  // an unlinked file for its trace spans, -1 without --trace
+    uint64_t started;
+};
+
+static int ctest_worker_events;  // in a --worker, whether the coordinator wants event records
+
+// What a test printed and sent, kept until the tests before it are reported
+struct ctest_job_output {
+    int started;
+    int done;
+    int local;  // reported by the parent: skipped, blocked by a dependency or failed to fork
+    int lost;  // workers lost while running it, see run_distributed
+    struct ctest_result result;
+    char* text;
+    size_t text_size;
+    char* events;
+    size_t events_size;
+};
+
+static int temporary_file(void) {
+    static unsigned int counter;
+    const char* directory = getenv("TMPDIR");
+    char path[4096];
+    int fd;
+    snprintf(path, sizeof(path), "%s/ctest.%ld.%u", directory && directory[0] ? directory : "/tmp",
+             (long)getpid(), counter++);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) unlink(path);
+    return fd;
+}
+
+// Read all of `fd`, then close it
+static char* read_whole(int fd, size_t* size) {
+    const off_t length = lseek(fd, 0, SEEK_END);
+    char* data = (char*)malloc(length > 0 ? (size_t)length : 1);
+    *size = 0;
+    lseek(fd, 0, SEEK_SET);
+    while (data && *size < (size_t)length) {
+        const ssize_t count = read(fd, data + *size, (size_t)length - *size);
+        if (count <= 0) break;
+        *size += (size_t)count;
+    }
+    close(fd);
+    return data;
+}
+
+// Write the spans recorded since `first` to `fd`, for the parent to merge into its own
+static void trace_save(int fd, uint64_t first) {
+    uint64_t span = first + CTEST_TRACE_CAPACITY < ctest_trace_next ? ctest_trace_next - CTEST_TRACE_CAPACITY : first;
+    while (span < ctest_trace_next) {
+        const uint64_t at = span % CTEST_TRACE_CAPACITY;
+        uint64_t count = ctest_trace_next - span;
+        if (count > CTEST_TRACE_CAPACITY - at) count = CTEST_TRACE_CAPACITY - at;
+        if (write(fd, &ctest_trace_ring[at], sizeof(*ctest_trace_ring) * count) < 0) return;
+        span += count;
+    }
+}
+
+// Record the spans a child saved, except its span of the whole test, which
+// job_finish records from the fork. Their names and tests point to memory the
+// child had since the fork, which the parent has too.
+static void trace_merge(const char* data, size_t size) {
+    struct ctest_trace_span span;
+    size_t offset;
+    for (offset = 0; offset + sizeof(span) <= size; offset += sizeof(span)) {
+        memcpy(&span, data + offset, sizeof(span));
+        if (span.name == NULL && strcmp(span.category, "test") == 0) continue;
+        trace_record(span.category, span.name, span.test, span.begin, span.end, span.track);
+    }
+}
+
+static void job_close(struct ctest_job* job) {
+    if (job->output >= 0) close(job->output);
+    if (job->events >= 0) close(job->events);
+    if (job->trace >= 0) close(job->trace);
+}
+
+// `slot` is the job's number among the running ones, from 0
+static int job_start(struct ctest_job* job, int slot, struct ctest* test, int position, int idx, int total) {
+    int fds[2] = { -1, -1 };
+    const int capture_events = ctest_event_fd >= 0 || ctest_worker_events;
+    job->output = temporary_file();
+    job->events = capture_events ? temporary_file() : -1;
+    job->trace = ctest_trace_ring ? temporary_file() : -1;
+    if (
+        job->output < 0 || (capture_events && job->events < 0) || (ctest_trace_ring && job->trace < 0)
+        || pipe(fds) == -1
+    ) {
+        job_close(job);
+        return -1;
+    }
+
+    fflush(NULL);
+    event_flush();
+    // Before the fork, so that the test span holds the spans of the child
+    job->started = ctest_now_ns();
+    job->pid = fork();
+    if (job->pid == 0) {
+        struct ctest_result result;
+        const uint64_t first_span = ctest_trace_next;
+        close(fds[0]);
+        // Without the text report, the test prints where it would without --jobs
+        if (ctest_report == stdout) dup2(job->output, STDOUT_FILENO);
+        ctest_event_fd = job->events;
+        // Its spans go on the track of its test span, see job_finish
+        ctest_trace_track = slot + 1;
+        ctest_callbacks = NULL;
+#ifdef CTEST_IMPL_HAS_CAPTURE
+        // Its own, the parent's is shared with the other children
+        if (ctest_capture_fd >= 0) close(ctest_capture_fd);
+        ctest_capture_fd = -1;
+#endif
+#ifdef CTEST_IMPL_HAS_AFFINITY
+        if (ctest_cpu_count && ctest_jobs > 1) pin_cpus(&ctest_cpus[slot % ctest_cpu_count], 1);
+#else
+        (void)slot;
+#endif
+        result.status = report_test(test, idx, total, &result.duration);
+        fflush(NULL);
+        event_flush();
+        if (job->trace >= 0) trace_save(job->trace, first_span);
+        write(fds[1], &result, sizeof(result));
+        _exit(0);
+    }
+    close(fds[1]);
+    if (job->pid < 0) {
+        close(fds[0]);
+        job_close(job);
+        return -1;
+    }
+    job->position = position;
+    job->result_fd = fds[0];
+    return 0;
+}
+
+static void job_finish(struct ctest_job* job, int status, struct ctest_job_output* output, struct ctest* test, int track) {
+    const uint64_t finished = ctest_now_ns();
+    output->text = read_whole(job->output, &output->text_size);
+    output->events = job->events >= 0 ? read_whole(job->events, &output->events_size) : NULL;
+    if (read(job->result_fd, &output->result, sizeof(output->result)) != (ssize_t)sizeof(output->result)) {
+        // Killed before it could report, e.g. by a crash
+        char message[64];
+        const int length = snprintf(message, sizeof(message), "  ERR: killed by signal %d\n",
+                                    WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+        char* text = (char*)realloc(output->text, output->text_size + (size_t)length);
+        if (text) {
+            memcpy(text + output->text_size, message, (size_t)length);
+            output->text = text;
+            output->text_size += (size_t)length;
+        }
+        output->result.status = CTEST_STATUS_FAILED;
+        output->result.duration = finished - job->started;
+    }
+    close(job->result_fd);
+    if (job->trace >= 0) {
+        size_t size = 0;
+        char* spans = read_whole(job->trace, &size);
+        if (spans) trace_merge(spans, size);
+        free(spans);
+    }
+    trace_record("test", NULL, test, job->started, finished, track);
+    if (ctest_outcome) ctest_outcome[test_index(test)] = (unsigned char)output->result.status;
+    output->done = 1;
+    job->pid = 0;
+}
+
+// Print the reports of the tests that are done, from `*next_print` up to the
+// first one that isn't, in the order of `tests`
+static void print_outputs(struct ctest** tests, int count, struct ctest_job_output* outputs, const int* numbers,
+                          int* next_print, struct ctest_counts* counts, struct ctest_result* results) {
+    while (*next_print < count && outputs[*next_print].done) {
+        struct ctest_job_output* output = &outputs[*next_print];
+        struct ctest* test = tests[*next_print];
+        struct ctest_result result = output->result;
+        if (output->done == -1) {
+            (*next_print)++;
+            continue;
+        }
+        if (output->local) {
+#ifdef CTEST_IMPL_HAS_WATCH
+            if (ctest_watch_previous)
+                result.status = watch_report(test, numbers[*next_print], count, &result.duration);
+            else
+#endif
+                result.status = report_test(test, numbers[*next_print], count, &result.duration);
+        } else if (!output->text) {
+            // Every worker that tried to run it went away
+            fprintf(ctest_report, "TEST %d/%d %s:%s\n", numbers[*next_print], count, test->ssname, test->ttname);
+            event_test_start(numbers[*next_print], count, test, test_tags(test));
+            print_status(result.status);
+            fprintf(ctest_report, "  ERR: %d workers were lost while running it\n", output->lost);
+            fflush(ctest_report);
+            event_test_end(result.status, result.duration);
+            callback_start(test, numbers[*next_print], count);
+            callback_end(test, result.status, result.duration);
+        } else {
+#ifdef CTEST_IMPL_HAS_WATCH
+            if (!ctest_watch_previous || watch_changed(test, result.status))
+#endif
+                fwrite(output->text, 1, output->text_size, ctest_report);
+            fflush(ctest_report);
+            if (output->events_size && ctest_event_fd >= 0) {
+                struct iovec part = { output->events, output->events_size };
+                event_flush();
+                event_write(&part, 1);
+            }
+            free(output->text);
+            free(output->events);
+            callback_start(test, numbers[*next_print], count);
+            callback_end(test, result.status, result.duration);
+        }
+        count_status(counts, result.status);
+        if (results) results[*next_print] = result;
+        (*next_print)++;
+    }
+}
+
+// Run `tests` in up to ctest_jobs forked children at a time. A test starts
+// once its dependencies have finished. Reports are printed in the order of
+// `tests`, as if they had run one after the other.
+static void run_parallel(struct ctest** tests, int count, struct ctest_counts* counts, struct ctest_result* results) {
+    struct ctest_job* jobs = (struct ctest_job*)calloc((size_t)ctest_jobs, sizeof(*jobs));
+    struct ctest_job_output* outputs = (struct ctest_job_output*)calloc((size_t)(count > 0 ? count : 1), sizeof(*outputs));
+    int* numbers = (int*)malloc(sizeof(*numbers) * (size_t)(count > 0 ? count : 1));
+    int idx = 1;
+    int running = 0;
+    int next_start = 0;
+    int next_print = 0;
+    int i;
+
+#ifdef CTEST_IMPL_HAS_ASYNC
+    // They share one event loop, so they run together in this process first
+    for (i = 0; i < count; i++) {
+        if (tests[i]->kind == CTEST_KIND_ASYNC && !tests[i]->skip) {
+            ctest_async::ctest_impl_async_run(tests, count, &idx, counts, results);
+            break;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (tests[i]->kind == CTEST_KIND_ASYNC && !tests[i]->skip) outputs[i].started = outputs[i].done = -1;
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        if (outputs[i].done != -1) numbers[i] = idx++;
+    }
+
+    while (next_print < count) {
+        for (i = next_start; i < count && running < ctest_jobs; i++) {
+            struct ctest* test = tests[i];
+            int slot;
+            if (outputs[i].started || !dependencies_done(test)) continue;
+            outputs[i].started = 1;
+            if (test->skip || dependency_failed(test)) {
+                outputs[i].local = outputs[i].done = 1;
+                if (ctest_outcome) ctest_outcome[test_index(test)] = CTEST_STATUS_SKIPPED;
+                continue;
+            }
+            for (slot = 0; jobs[slot].pid != 0; slot++) { }
+            if (job_start(&jobs[slot], slot, test, i, numbers[i], count) != 0) {
+                if (running > 0) {
+                    // Try again once a child has finished
+                    outputs[i].started = 0;
+                } else {
+                    // Everything before it is done, so it is reported, and run, next
+                    outputs[i].local = outputs[i].done = 1;
+                }
+                break;
+            }
+            running++;
+        }
+        while (next_start < count && outputs[next_start].started) next_start++;
+
+        print_outputs(tests, count, outputs, numbers, &next_print, counts, results);
+
+        if (running > 0) {
+            int status;
+            const pid_t pid = waitpid(-1, &status, 0);
+            if (pid < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (i = 0; i < ctest_jobs; i++) {
+                if (jobs[i].pid != pid) continue;
+                job_finish(&jobs[i], status, &outputs[jobs[i].position], tests[jobs[i].position], i + 1);
+                running--;
+                break;
+            }
+        }
+    }
+
+    free(numbers);
+    free(outputs);
+    free(jobs);
+}
+
+#ifdef CTEST_IMPL_HAS_WATCH
+#include <poll.h>
+#include <sys/inotify.h>
+
+#ifndef CTEST_WATCH_DEBOUNCE_MS
+#define CTEST_WATCH_DEBOUNCE_MS 200  // quiet time after the last write before --watch runs the tests again
+#endif
+
+// report_test, but the report is only shown if the result changed since the previous --watch run
+static enum ctest_status watch_report(struct ctest* test, int idx, int total, uint64_t* duration) {
+    const int output = temporary_file();
+    const int saved = output >= 0 ? dup(STDOUT_FILENO) : -1;
+    enum ctest_status status;
+    size_t size;
+    char* text;
+
+    if (saved < 0) {
+        if (output >= 0) close(output);
+        return report_test(test, idx, total, duration);
+    }
+    fflush(NULL);
+    dup2(output, STDOUT_FILENO);
+    status = report_test(test, idx, total, duration);
+    fflush(NULL);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    text = read_whole(output, &size);
+    if (text && watch_changed(test, status)) fwrite(text, 1, size, ctest_report);
+    free(text);
+    return status;
+}
+
+// Read the results of the previous run from --watch-state, and move the tests
+// that failed in it to the front of `tests`. Lines are "<status> suite:test".
+static void watch_load(struct ctest** tests, int count) {
+    int* sorted = (int*)malloc(sizeof(*sorted) * (size_t)ctest_section_size);
+    struct ctest** failed_first = (struct ctest**)malloc(sizeof(*failed_first) * (size_t)(count ? count : 1));
+    size_t size;
+    char* text = read_whole(dup(ctest_watch_fd), &size);
+    char* line = text;
+    int sorted_count = 0;
+    int moved = 0;
+    int i;
+
+    ctest_watch_previous = (unsigned char*)malloc((size_t)ctest_section_size);
+    memset(ctest_watch_previous, CTEST_IMPL_NOT_SELECTED, (size_t)ctest_section_size);
+    // Results are recorded through ctest_outcome, which only exists when there are dependencies
+    if (!ctest_outcome) ctest_outcome = (unsigned char*)malloc((size_t)ctest_section_size);
+    for (i = 0; i < ctest_section_size; i++) {
+        if (&ctest_section[i] != &CTEST_IMPL_TNAME(suite, test)) sorted[sorted_count++] = i;
+    }
+    qsort(sorted, (size_t)sorted_count, sizeof(*sorted), compare_tests);
+
+    while (text && line < text + size) {
+        char* end = (char*)memchr(line, '\n', (size_t)(text + size - line));
+        char* colon;
+        if (!end) break;
+        *end = 0;
+        colon = strchr(line, ':');
+        if (line[0] >= '0' && line[0] <= '9' && line[1] == ' ' && colon) {
+            const int index = find_test(sorted, sorted_count, line + 2, (size_t)(colon - line - 2), colon + 1);
+            if (index >= 0) ctest_watch_previous[index] = (unsigned char)(line[0] - '0');
+        }
+        line = end + 1;
+    }
+
+    if (failed_first) {
+        for (i = 0; i < count; i++) {
+            if (ctest_watch_previous[test_index(tests[i])] == CTEST_STATUS_FAILED) failed_first[moved++] = tests[i];
+        }
+        for (i = 0; i < count; i++) {
+            if (ctest_watch_previous[test_index(tests[i])] != CTEST_STATUS_FAILED) failed_first[moved++] = tests[i];
+        }
+        memcpy(tests, failed_first, sizeof(*tests) * (size_t)count);
+    }
+    free(failed_first);
+    free(text);
+    free(sorted);
+}
+
+// Replace --watch-state with the results of this run. Tests that didn't run keep their previous result.
+static void watch_save(void) {
+    char line[1024];
+    int i;
+
+    if (ctest_watch_hidden) fprintf(ctest_report, "WATCH: %d unchanged results not shown\n", ctest_watch_hidden);
+    if (ftruncate(ctest_watch_fd, 0) != 0 || lseek(ctest_watch_fd, 0, SEEK_SET) != 0) return;
+    for (i = 0; i < ctest_section_size; i++) {
+        int status = ctest_outcome[i] < CTEST_IMPL_PENDING ? ctest_outcome[i] : ctest_watch_previous[i];
+        if (status == CTEST_IMPL_NOT_SELECTED) continue;
+        if (status == CTEST_STATUS_CACHED) status = CTEST_STATUS_OK;
+        const int length = snprintf(line, sizeof(line), "%d %s:%s\n", status, ctest_section[i].ssname, ctest_section[i].ttname);
+        if (length > 0 && (size_t)length < sizeof(line) && write(ctest_watch_fd, line, (size_t)length) != length) return;
+    }
+}
+
+// Run the executable at `path` and wait for it to finish
+static void watch_run(const char* path, const char** arguments) {
+    pid_t pid;
+    int status = 0;
+
+    fflush(NULL);
+    pid = fork();
+    if (pid == 0) {
+        execv(path, (char* const*)arguments);
+        fprintf(stderr, "WATCH: can't run %s: %s\n", path, strerror(errno));
+        _exit(127);
+    }
+    if (pid < 0) {
+        fprintf(stderr, "WATCH: can't run %s: %s\n", path, strerror(errno));
+        return;
+    }
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) { }
+    if (WIFSIGNALED(status)) fprintf(ctest_report, "WATCH: the run was killed by signal %d\n", WTERMSIG(status));
+}
+
+// Wait for `name` in the watch `directory`, or anything in the other watches, to
+// change, then for the writes to stop (a linker writes in bursts) and `path` to
+// be executable. Return -1 once `directory` is no longer watched.
+static int watch_wait(int notify, int directory, const char* name, const char* path) {
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+    int changed = 0;
+
+    for (;;) {
+        struct pollfd descriptor = { notify, POLLIN, 0 };
+        const int ready = poll(&descriptor, 1, changed ? CTEST_WATCH_DEBOUNCE_MS : -1);
+        ssize_t length;
+        ssize_t offset;
+
+        if (ready < 0 && errno != EINTR) return -1;
+        if (ready == 0) {
+            if (access(path, X_OK) == 0) return 0;
+            // Removed, e.g. by a clean, wait for it to be built again
+            changed = 0;
+            continue;
+        }
+        if (ready < 0) continue;
+        length = read(notify, buffer.bytes, sizeof(buffer.bytes));
+        if (length < 0 && errno == EINTR) continue;
+        if (length <= 0) return -1;
+        for (offset = 0; offset < length;) {
+            const struct inotify_event* event = (const struct inotify_event*)(buffer.bytes + offset);
+            if ((event->mask & IN_IGNORED) && event->wd == directory) return -1;
+            if (!(event->mask & IN_IGNORED) && (event->wd != directory || (event->len && strcmp(event->name, name) == 0))) {
+                changed = 1;
+            }
+            offset += (ssize_t)(sizeof(struct inotify_event) + event->len);
+        }
+    }
+}
+
+// --watch: run the tests in a child, then again every time the executable is
+// rebuilt or a --watch-dir changes. The child is the executable as it is on
+// disk at that time, so it has the new tests. Runs until interrupted, or until
+// the executable's directory can't be watched any more.
+static int watch_loop(int argc, const char* argv[]) {
+    const uint32_t executable_events = IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB;
+    const uint32_t source_events = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE;
+    char path[4096];
+    char state_argument[32];
+    const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    const char** arguments = (const char**)malloc(sizeof(*arguments) * (size_t)(argc + 2));
+    const int state = temporary_file();
+    const int notify = inotify_init1(IN_CLOEXEC);
+    int directory = -1;
+    int count = 0;
+    char* slash = NULL;
+    int i;
+
+    if (length > 0) {
+        path[length] = 0;
+        slash = strrchr(path, '/');
+    }
+    if (slash) {
+        *slash = 0;
+        directory = notify >= 0 ? inotify_add_watch(notify, slash == path ? "/" : path, executable_events) : -1;
+        *slash = '/';
+    }
+    if (!arguments || state < 0 || directory < 0) {
+        fprintf(stderr, "--watch: can't watch the executable: %s\n", strerror(errno));
+        free(arguments);
+        if (state >= 0) close(state);
+        if (notify >= 0) close(notify);
+        return 1;
+    }
+    for (i = 0; i < ctest_watch_dir_count; i++) {
+        if (inotify_add_watch(notify, ctest_watch_dirs[i], source_events) < 0) {
+            fprintf(stderr, "--watch-dir: can't watch '%s': %s\n", ctest_watch_dirs[i], strerror(errno));
+            free(arguments);
+            close(state);
+            close(notify);
+            return 1;
+        }
+    }
+
+    // The same arguments, but for a single run
+    for (i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--watch") == 0 || strncmp(argv[i], "--watch-dir=", 12) == 0) continue;
+        arguments[count++] = argv[i];
+    }
+    snprintf(state_argument, sizeof(state_argument), "--watch-state=%d", state);
+    arguments[count++] = state_argument;
+    arguments[count] = NULL;
+
+    for (;;) {
+        watch_run(path, arguments);
+        fprintf(ctest_report, "WATCH: waiting for %s to change\n", path);
+        fflush(ctest_report);
+        if (watch_wait(notify, directory, slash + 1, path) != 0) break;
+        fprintf(ctest_report, "WATCH: changes detected, running the tests again\n");
+    }
+    *slash = 0;
+    fprintf(ctest_report, "WATCH: stopped, %s is no longer watched\n", slash == path ? "/" : path);
+
+    free(arguments);
+    close(state);
+    close(notify);
+    return 0;
+}
+#endif
+
+#ifdef CTEST_IMPL_HAS_DISTRIBUTED
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* The protocol between --coordinator and --worker, in host byte order as both
+ * ends run the same executable:
+ *
+ *   worker:      u32 CTEST_IMPL_WORKER_MAGIC, u32 size of the .ctest section
+ *   coordinator: u32 flags, CTEST_IMPL_WANT_*
+ *   coordinator: u32 count, then per test: u32 number, u32 total, u32 length, "suite:test"
+ *   worker:      per test of the batch: struct ctest_result, u32 output size,
+ *                u32 events size, output, events
+ *
+ * A worker asks for a batch by saying hello or by sending the last result of
+ * its batch. A batch of 0 tests means there is no more work.
+ */
+#define CTEST_IMPL_WORKER_MAGIC 0x63746573u
+#define CTEST_IMPL_WANT_EVENTS 1
+#define CTEST_IMPL_WANT_COLORS 2
+#define CTEST_IMPL_BATCH_SIZE 16  // most tests a worker is given at once
+#define CTEST_IMPL_MAX_LOST 3  // a test fails once this many workers went away while running it
+
+// A connected worker
+struct ctest_link {
+    int fd;  // -1 once it is gone
+    int ready;  // said hello
+    int batch[CTEST_IMPL_BATCH_SIZE];  // positions of the tests it is running
+    int batch_size;
+    int batch_done;  // results received
+    unsigned char* input;  // received, not handled yet
+    size_t input_used;
+    size_t input_capacity;
+};
+
+static int ctest_listen_fd = -1;
+static struct ctest_link* ctest_links;
+static int ctest_link_count;
+
+static int write_all(int fd, const void* data, size_t size) {
+    const char* next = (const char*)data;
+    while (size > 0) {
+        const ssize_t written = write(fd, next, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return -1;
+        next += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void* data, size_t size) {
+    char* next = (char*)data;
+    while (size > 0) {
+        const ssize_t count = read(fd, next, size);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return -1;
+        next += count;
+        size -= (size_t)count;
+    }
+    return 0;
+}
+
+static int unix_socket(const char* path, int listening) {
+    struct sockaddr_un address;
+    int fd;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (listening) unlink(path);
+    if (listening ? bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0
+                  : connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int tcp_socket(const char* host_and_port, int listening) {
+    const char* colon = strrchr(host_and_port, ':');
+    struct addrinfo hints;
+    struct addrinfo* found;
+    struct addrinfo* candidate;
+    char host[256];
+    const int one = 1;
+    int fd = -1;
+
+    if (!colon || (size_t)(colon - host_and_port) >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, host_and_port, (size_t)(colon - host_and_port));
+    host[colon - host_and_port] = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &found) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (candidate = found; candidate; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd < 0) continue;
+        if (listening) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (listening ? bind(fd, candidate->ai_addr, candidate->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0
+                      : connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+// A socket listening on, or connected to, `address`: "unix:PATH" or "HOST:PORT"
+static int socket_open(const char* address, int listening) {
+    if (strncmp(address, "unix:", 5) == 0) return unix_socket(address + 5, listening);
+    return tcp_socket(address, listening);
+}
+
+// Start listening for workers. Print why and return -1 if that fails.
+static int coordinator_open(void) {
+    ctest_listen_fd = socket_open(ctest_coordinator, 1);
+    if (ctest_listen_fd < 0) {
+        fprintf(stderr, "--coordinator: can't listen on '%s': %s\n", ctest_coordinator, strerror(errno));
+        return -1;
+    }
+    // A worker that went away is handled, writing to it mustn't kill the run
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "COORDINATOR: waiting for workers on %s\n", ctest_coordinator);
+    return 0;
+}
+
+// Tell the workers there is no more work, and stop listening
+static void coordinator_close(void) {
+    const uint32_t done = 0;
+    int i;
+    if (ctest_listen_fd < 0) return;
+    for (i = 0; i < ctest_link_count; i++) {
+        if (ctest_links[i].ready) write_all(ctest_links[i].fd, &done, sizeof(done));
+        close(ctest_links[i].fd);
+        free(ctest_links[i].input);
+    }
+    free(ctest_links);
+    ctest_links = NULL;
+    ctest_link_count = 0;
+    close(ctest_listen_fd);
+    ctest_listen_fd = -1;
+    if (strncmp(ctest_coordinator, "unix:", 5) == 0) unlink(ctest_coordinator + 5);
+}
+
+// Close `link`, and put the tests it didn't finish back in the queue, or
+// fail them once they have lost too many workers
+static void link_drop(struct ctest_link* link, struct ctest** tests, struct ctest_job_output* outputs, int* next_start) {
+    int i;
+    for (i = link->batch_done; i < link->batch_size; i++) {
+        const int position = link->batch[i];
+        struct ctest_job_output* output = &outputs[position];
+        if (++output->lost < CTEST_IMPL_MAX_LOST) {
+            output->started = 0;
+            if (position < *next_start) *next_start = position;
+            continue;
+        }
+        output->result.status = CTEST_STATUS_FAILED;
+        output->result.duration = 0;
+        output->done = 1;
+        if (ctest_outcome) ctest_outcome[test_index(tests[position])] = CTEST_STATUS_FAILED;
+    }
+    close(link->fd);
+    link->fd = -1;
+    link->batch_size = link->batch_done = 0;
+}
+
+// Give the idle `link` the next tests that can start, at most `size`. Tests
+// that don't need to run are marked for the coordinator to report.
+static int link_send(struct ctest_link* link, struct ctest** tests, int count, struct ctest_job_output* outputs,
+                     const int* numbers, int* next_start, int size) {
+    size_t length = sizeof(uint32_t);
+    unsigned char* message;
+    unsigned char* next;
+    int sent;
+    int i;
+
+    for (i = *next_start; i < count && link->batch_size < size; i++) {
+        struct ctest* test = tests[i];
+        if (outputs[i].started || !dependencies_done(test)) continue;
+        outputs[i].started = 1;
+        if (test->skip || dependency_failed(test)) {
+            outputs[i].local = outputs[i].done = 1;
+            if (ctest_outcome) ctest_outcome[test_index(test)] = CTEST_STATUS_SKIPPED;
+            continue;
+        }
+        link->batch[link->batch_size++] = i;
+        length += 3 * sizeof(uint32_t) + strlen(test->ssname) + 1 + strlen(test->ttname);
+    }
+    while (*next_start < count && outputs[*next_start].started) (*next_start)++;
+    if (link->batch_size == 0) return 0;
+
+    message = (unsigned char*)malloc(length);
+    if (!message) return -1;
+    next = message;
+    uint32_t value = (uint32_t)link->batch_size;
+    memcpy(next, &value, sizeof(value));
+    next += sizeof(value);
+    for (i = 0; i < link->batch_size; i++) {
+        const struct ctest* test = tests[link->batch[i]];
+        const size_t suite = strlen(test->ssname);
+        const size_t name = strlen(test->ttname);
+        uint32_t header[3] = { (uint32_t)numbers[link->batch[i]], (uint32_t)count, (uint32_t)(suite + 1 + name) };
+        memcpy(next, header, sizeof(header));
+        next += sizeof(header);
+        memcpy(next, test->ssname, suite);
+        next[suite] = ':';
+        memcpy(next + suite + 1, test->ttname, name);
+        next += suite + 1 + name;
+    }
+    sent = write_all(link->fd, message, length);
+    free(message);
+    return sent;
+}
+
+// Read what `link` sent, and handle every complete message. Return -1 if it went away or misbehaved.
+static int link_receive(struct ctest_link* link, struct ctest** tests, struct ctest_job_output* outputs) {
+    size_t used = 0;
+    ssize_t count;
+
+    if (link->input_capacity - link->input_used < 65536) {
+        unsigned char* input = (unsigned char*)realloc(link->input, link->input_capacity + 65536);
+        if (!input) return -1;
+        link->input = input;
+        link->input_capacity += 65536;
+    }
+    count = read(link->fd, link->input + link->input_used, link->input_capacity - link->input_used);
+    if (count < 0 && errno == EINTR) return 0;
+    if (count <= 0) return -1;
+    link->input_used += (size_t)count;
+
+    for (;;) {
+        const unsigned char* data = link->input + used;
+        const size_t available = link->input_used - used;
+        struct ctest_job_output* output;
+        struct ctest_result result;
+        uint32_t sizes[2];
+
+        if (!link->ready) {
+            uint32_t hello[2];
+            uint32_t flags = (ctest_event_fd >= 0 ? CTEST_IMPL_WANT_EVENTS : 0) | (color_output ? CTEST_IMPL_WANT_COLORS : 0);
+            if (available < sizeof(hello)) break;
+            memcpy(hello, data, sizeof(hello));
+            if (hello[0] != CTEST_IMPL_WORKER_MAGIC || hello[1] != (uint32_t)ctest_section_size) {
+                fprintf(stderr, "COORDINATOR: rejected a worker that doesn't run the same tests\n");
+                return -1;
+            }
+            if (write_all(link->fd, &flags, sizeof(flags)) != 0) return -1;
+            link->ready = 1;
+            used += sizeof(hello);
+            continue;
+        }
+        if (link->batch_done == link->batch_size) {
+            // Nothing is expected from an idle worker
+            if (available) return -1;
+            break;
+        }
+        if (available < sizeof(result) + sizeof(sizes)) break;
+        memcpy(&result, data, sizeof(result));
+        memcpy(sizes, data + sizeof(result), sizeof(sizes));
+        if (available - sizeof(result) - sizeof(sizes) < (size_t)sizes[0] + sizes[1]) break;
+        data += sizeof(result) + sizeof(sizes);
+
+        output = &outputs[link->batch[link->batch_done]];
+        output->result = result;
+        output->text = (char*)malloc(sizes[0] ? sizes[0] : 1);
+        output->text_size = output->text ? sizes[0] : 0;
+        if (output->text) memcpy(output->text, data, output->text_size);
+        output->events = sizes[1] ? (char*)malloc(sizes[1]) : NULL;
+        output->events_size = output->events ? sizes[1] : 0;
+        if (output->events) memcpy(output->events, data + sizes[0], output->events_size);
+        output->done = 1;
+        if (ctest_outcome) ctest_outcome[test_index(tests[link->batch[link->batch_done]])] = (unsigned char)result.status;
+        used += sizeof(result) + sizeof(sizes) + sizes[0] + sizes[1];
+        if (++link->batch_done == link->batch_size) link->batch_size = link->batch_done = 0;
+    }
+    memmove(link->input, link->input + used, link->input_used - used);
+    link->input_used -= used;
+    return 0;
+}
+
+// Run `tests` on the workers connected to --coordinator, which can come and
+// go. Reports are printed in the order of `tests`, as if they had run here.
+static void run_distributed(struct ctest** tests, int count, struct ctest_counts* counts, struct ctest_result* results) {
+    struct ctest_job_output* outputs = (struct ctest_job_output*)calloc((size_t)(count > 0 ? count : 1), sizeof(*outputs));
+    int* numbers = (int*)malloc(sizeof(*numbers) * (size_t)(count > 0 ? count : 1));
+    struct pollfd* descriptors = NULL;
+    int idx = 1;
+    int next_start = 0;
+    int next_print = 0;
+    int i;
+
+#ifdef CTEST_IMPL_HAS_ASYNC
+    // They share one event loop, so they run together in this process first
+    for (i = 0; i < count; i++) {
+        if (tests[i]->kind == CTEST_KIND_ASYNC && !tests[i]->skip) {
+            ctest_async::ctest_impl_async_run(tests, count, &idx, counts, results);
+            break;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (tests[i]->kind == CTEST_KIND_ASYNC && !tests[i]->skip) outputs[i].started = outputs[i].done = -1;
+    }
+#endif
+    for (i = 0; i < count; i++) {
+        if (outputs[i].done != -1) numbers[i] = idx++;
+    }
+
+    for (;;) {
+        int workers = 0;
+        int live = 0;
+
+        for (i = 0; i < ctest_link_count; i++) workers += ctest_links[i].ready;
+        for (i = 0; i < ctest_link_count; i++) {
+            struct ctest_link* link = &ctest_links[i];
+            // Smaller batches as the queue runs out, so that the workers finish together
+            int size = (count - next_start) / (2 * (workers ? workers : 1));
+            if (size < 1) size = 1;
+            if (size > CTEST_IMPL_BATCH_SIZE) size = CTEST_IMPL_BATCH_SIZE;
+            if (!link->ready || link->batch_size) continue;
+            if (link_send(link, tests, count, outputs, numbers, &next_start, size) != 0) {
+                link_drop(link, tests, outputs, &next_start);
+            }
+        }
+
+        print_outputs(tests, count, outputs, numbers, &next_print, counts, results);
+        if (next_print == count) break;
+
+        // Forget the workers that went away
+        for (i = 0; i < ctest_link_count; i++) {
+            if (ctest_links[i].fd >= 0) {
+                ctest_links[live++] = ctest_links[i];
+            } else {
+                free(ctest_links[i].input);
+            }
+        }
+        ctest_link_count = live;
+
+        struct pollfd* grown = (struct pollfd*)realloc(descriptors, sizeof(*descriptors) * (size_t)(ctest_link_count + 1));
+        if (!grown) break;
+        descriptors = grown;
+        descriptors[0].fd = ctest_listen_fd;
+        descriptors[0].events = POLLIN;
+        for (i = 0; i < ctest_link_count; i++) {
+            descriptors[i + 1].fd = ctest_links[i].fd;
+            descriptors[i + 1].events = POLLIN;
+        }
+        if (poll(descriptors, (nfds_t)(ctest_link_count + 1), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (i = 0; i < ctest_link_count; i++) {
+            if (!descriptors[i + 1].revents) continue;
+            if (link_receive(&ctest_links[i], tests, outputs) != 0) link_drop(&ctest_links[i], tests, outputs, &next_start);
+        }
+        if (descriptors[0].revents & POLLIN) {
+            const int fd = accept(ctest_listen_fd, NULL, NULL);
+            struct ctest_link* links = fd >= 0 ? (struct ctest_link*)realloc(ctest_links, sizeof(*links) * (size_t)(ctest_link_count + 1)) : NULL;
+            if (links) {
+                ctest_links = links;
+                memset(&ctest_links[ctest_link_count], 0, sizeof(*links));
+                ctest_links[ctest_link_count++].fd = fd;
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    free(descriptors);
+    free(numbers);
+    free(outputs);
+}
+
+// Run the test named `name` ("suite:test") in a forked child, and send its report on `fd`
+static int worker_test(int fd, const int* sorted, int sorted_count, int idx, int total, const char* name) {
+    const char* colon = strchr(name, ':');
+    const int index = colon ? find_test(sorted, sorted_count, name, (size_t)(colon - name), colon + 1) : -1;
+    struct ctest_job job;
+    struct ctest_job_output output;
+    uint32_t sizes[2];
+    int status = 0;
+    int sent;
+
+    if (index < 0 || job_start(&job, 0, &ctest_section[index], 0, idx, total) != 0) return -1;
+    while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR) { }
+    memset(&output, 0, sizeof(output));
+    job_finish(&job, status, &output, &ctest_section[index], 1);
+    sizes[0] = (uint32_t)output.text_size;
+    sizes[1] = (uint32_t)output.events_size;
+    sent = write_all(fd, &output.result, sizeof(output.result)) == 0
+        && write_all(fd, sizes, sizeof(sizes)) == 0
+        && write_all(fd, output.text, output.text_size) == 0
+        && write_all(fd, output.events, output.events_size) == 0;
+    free(output.text);
+    free(output.events);
+    return sent ? 0 : -1;
+}
+
+// --worker: connect to the coordinator, retrying for a while as it may not be
+// listening yet, then run the batches of tests it sends, each in a forked child
+static int worker_run(void) {
+    const uint32_t hello[2] = { CTEST_IMPL_WORKER_MAGIC, (uint32_t)ctest_section_size };
+    const struct timespec retry = { 0, 100000000 };
+    int* sorted = (int*)malloc(sizeof(*sorted) * (size_t)ctest_section_size);
+    int sorted_count = 0;
+    uint32_t flags;
+    int connected = 1;
+    int result = 1;
+    int fd = -1;
+    int attempt;
+    int i;
+
+    for (attempt = 0; attempt < 100 && (fd = socket_open(ctest_worker, 0)) < 0; attempt++) nanosleep(&retry, NULL);
+    if (fd < 0 || !sorted) {
+        fprintf(stderr, "--worker: can't connect to '%s': %s\n", ctest_worker, strerror(errno));
+        if (fd >= 0) close(fd);
+        free(sorted);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (write_all(fd, hello, sizeof(hello)) != 0 || read_all(fd, &flags, sizeof(flags)) != 0) {
+        fprintf(stderr, "--worker: the coordinator at '%s' turned this worker down\n", ctest_worker);
+        close(fd);
+        free(sorted);
+        return 1;
+    }
+    // The reports are the coordinator's output, and so are the event records
+    ctest_event_fd = -1;
+    ctest_worker_events = (flags & CTEST_IMPL_WANT_EVENTS) != 0;
+    color_output = (flags & CTEST_IMPL_WANT_COLORS) != 0;
+    for (i = 0; i < ctest_section_size; i++) {
+        if (&ctest_section[i] != &CTEST_IMPL_TNAME(suite, test)) sorted[sorted_count++] = i;
+    }
+    qsort(sorted, (size_t)sorted_count, sizeof(*sorted), compare_tests);
+
+    while (connected) {
+        uint32_t batch;
+        if (read_all(fd, &batch, sizeof(batch)) != 0) break;
+        if (batch == 0) {
+            result = 0;
+            break;
+        }
+        for (; batch > 0 && connected; batch--) {
+            uint32_t header[3];  // number, total, name length
+            char* name = NULL;
+            connected = read_all(fd, header, sizeof(header)) == 0
+                && (name = (char*)malloc((size_t)header[2] + 1)) != NULL
+                && read_all(fd, name, header[2]) == 0;
+            if (connected) {
+                name[header[2]] = 0;
+                connected = worker_test(fd, sorted, sorted_count, (int)header[0], (int)header[1], name) == 0;
+            }
+            free(name);
+        }
+    }
+    if (result != 0) fprintf(stderr, "--worker: lost the coordinator at '%s'\n", ctest_worker);
+    close(fd);
+    free(sorted);
+    return result;
+}
+#endif
+#else
+static void bisect_order(struct ctest** tests, int count, struct ctest_counts* counts) {
+    fprintf(ctest_report, "BISECT: --bisect-order is not supported on this platform\n");
+    run_tests(tests, count, counts, NULL);
+}
+#endif
+
+static int ctest_repeat;  // 0 if not given
+static int ctest_until_fail;
+
+// Pass rate and duration spread of a test across --repeat iterations
+struct ctest_stats {
+    int runs;
+    int passes;
+    uint64_t min;
+    uint64_t max;
+    double mean;
+    double m2;  // sum of squared differences from the mean, see Welford's algorithm
+};
+
+static void add_stats(struct ctest_stats* stats, const struct ctest_result* result) {
+    const double duration = (double)result->duration;
+    double delta;
+
+    if (result->status == CTEST_STATUS_SKIPPED) return;
+    if (stats->runs == 0 || result->duration < stats->min) stats->min = result->duration;
+    if (result->duration > stats->max) stats->max = result->duration;
+    stats->runs++;
+    if (result->status != CTEST_STATUS_FAILED) stats->passes++;
+    delta = duration - stats->mean;
+    stats->mean += delta / stats->runs;
+    stats->m2 += delta * (duration - stats->mean);
+}
+
+static void print_stats(struct ctest** tests, int count, const struct ctest_stats* stats) {
+    int i;
+    for (i = 0; i < count; i++) {
+        const struct ctest_stats* s = &stats[i];
+        if (s->runs == 0) continue;
+        fprintf(ctest_report, "STATS %s:%s %d/%d passed (%.2f%%), %.1f us mean, %.1f us stddev, %.1f-%.1f us\n",
+               tests[i]->ssname, tests[i]->ttname, s->passes, s->runs, 100.0 * s->passes / s->runs,
+               s->mean / 1e3, (s->runs > 1 ? sqrt(s->m2 / (s->runs - 1)) : 0.0) / 1e3,
+               (double)s->min / 1e3, (double)s->max / 1e3);
+    }
+}
+
+// Run `tests` --repeat times, or until one fails with --until-fail
+static void run_repeated(struct ctest** tests, int count, struct ctest_counts* counts) {
+    const int iterations = ctest_repeat ? ctest_repeat : (ctest_until_fail ? INT_MAX : 1);
+    const size_t size = (size_t)(count ? count : 1);
+    struct ctest** ordered = (struct ctest**)malloc(sizeof(*ordered) * size);
+    int* order = (int*)malloc(sizeof(*order) * size);
+    struct ctest_result* results = (struct ctest_result*)calloc(size, sizeof(*results));
+    struct ctest_stats* stats = (struct ctest_stats*)calloc(size, sizeof(*stats));
+    int iteration;
+    int i;
+
+    for (iteration = 1; iteration <= iterations; iteration++) {
+        const int failed = counts->num_fail;
+
+        if (iterations == INT_MAX)
+            fprintf(ctest_report, "ITERATION %d\n", iteration);
+        else if (iterations > 1)
+            fprintf(ctest_report, "ITERATION %d/%d\n", iteration, iterations);
+
+        // Each iteration is shuffled differently, but can still be replayed from the seed
+        order_tests(ordered, order, tests, count, ctest_seed + (uint64_t)(iteration - 1));
+        run_tests(ordered, count, counts, results);
+        for (i = 0; i < count; i++) add_stats(&stats[order[i]], &results[i]);
+
+        if (ctest_until_fail && counts->num_fail > failed) break;
+    }
+
+    if (iterations > 1) print_stats(tests, count, stats);
+
+    free(stats);
+    free(results);
+    free(order);
+    free(ordered);
+}
+
+// Noise detection, for runs whose results are timings: with CTEST_COMPLEXITY
+// tests or --repeat. Other processes competing for the CPUs, frequency scaling
+// or a frequency change during the run add a warning to the RESULTS line.
+#if defined(__linux__)
+#define CTEST_IMPL_HAS_NOISE 1
+
+struct ctest_noise {
+    double load;  // 1 minute load average
+    long cpus;  // online
+    unsigned long khz;  // frequency of the first CPU the tests run on, 0 if unknown
+    char governor[32];  // its cpufreq governor, empty if unknown
+};
+
+static struct ctest_noise ctest_noise_start;
+static int ctest_noise_check;
+
+// Read the first line of `path`, without its newline
+static int read_line(const char* path, char* line, size_t size) {
+    FILE* file = fopen(path, "r");
+    int found;
+    if (!file) return 0;
+    found = fgets(line, (int)size, file) != NULL;
+    fclose(file);
+    if (found) line[strcspn(line, "\n")] = '\0';
+    return found;
+}
+
+static void noise_sample(struct ctest_noise* noise) {
+    char path[96];
+    char line[64];
+    int cpu = 0;
+#ifdef CTEST_IMPL_HAS_AFFINITY
+    if (ctest_cpu_count) cpu = ctest_cpus[0];
+#endif
+    memset(noise, 0, sizeof(*noise));
+    if (read_line("/proc/loadavg", line, sizeof(line))) noise->load = strtod(line, NULL);
+    noise->cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+    if (read_line(path, line, sizeof(line))) noise->khz = strtoul(line, NULL, 10);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+    read_line(path, noise->governor, sizeof(noise->governor));
+}
+
+// Whether any of `tests` is timed, see CTEST_META_TIMED
+static int noise_timed(struct ctest** tests, int count) {
+    struct ctest_meta* meta;
+    int i;
+    if (ctest_repeat > 1) return 1;
+    for (meta = ctest_meta_begin; meta != ctest_meta_end && meta->kind != CTEST_META_TIMED; meta++) { }
+    if (meta == ctest_meta_end) return 0;
+    for (i = 0; i < count; i++) {
+        if (!tests[i]->skip && find_meta(tests[i], CTEST_META_TIMED)) return 1;
+    }
+    return 0;
+}
+
+// Write why the run since noise_sample(&ctest_noise_start) was noisy into `text`, or nothing
+static void noise_describe(char* text, size_t size) {
+    const struct ctest_noise* start = &ctest_noise_start;
+    struct ctest_noise end;
+    const char* separator = ", noisy: ";
+    size_t length = 0;
+    int written = 0;
+
+    text[0] = '\0';
+    noise_sample(&end);
+    // The other processes, and the jobs, need more CPUs than there are
+    if (start->cpus > 0 && start->load + ctest_jobs > (double)start->cpus + 0.5) {
+        if (ctest_jobs > 1)
+            written = snprintf(text, size, "%sload %.2f + %d jobs on %ld CPUs", separator, start->load, ctest_jobs, start->cpus);
+        else
+            written = snprintf(text, size, "%sload %.2f on %ld CPUs", separator, start->load, start->cpus);
+        if (written > 0) length += (size_t)written;
+        separator = ", ";
+    }
+    if (start->governor[0] && strcmp(start->governor, "performance") != 0 && length < size) {
+        written = snprintf(text + length, size - length, "%s%s CPU governor", separator, start->governor);
+        if (written > 0) length += (size_t)written;
+        separator = ", ";
+    }
+    if (start->khz && end.khz && length < size
+        && (start->khz > end.khz ? start->khz - end.khz : end.khz - start->khz) * 10 > start->khz) {
+        snprintf(text + length, size - length, "%sCPU at %lu then %lu MHz", separator, start->khz / 1000, end.khz / 1000);
+    }
+}
+#endif
+
+static int parse_arguments(int argc, const char* argv[], ctest_filter_func* filter) {
+    int positional = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if (strncmp(arg, "--", 2) != 0) {
+            if (positional == 0) {
+                suite_name = arg;
+                *filter = suite_filter;
+            } else if (positional == 1) {
+                test_expression = arg;
+            }
+            positional++;
+        } else if (strcmp(arg, "--shuffle") == 0) {
+            ctest_shuffle = 1;
+        } else if (strncmp(arg, "--seed=", 7) == 0) {
+            ctest_shuffle = 1;
+            ctest_seed = strtoull(arg + 7, NULL, 10);
+        } else if (strcmp(arg, "--bisect-order") == 0) {
+            ctest_bisect = 1;
+        } else if (strncmp(arg, "--repeat=", 9) == 0) {
+            ctest_repeat = atoi(arg + 9);
+            if (ctest_repeat < 1) {
+                fprintf(stderr, "invalid option '%s'\n", arg);
+                return -1;
+            }
+        } else if (strcmp(arg, "--until-fail") == 0) {
+            ctest_until_fail = 1;
+        } else if (strncmp(arg, "--retries=", 10) == 0) {
+            ctest_retries = atoi(arg + 10);
+            if (ctest_retries < 0) {
+                fprintf(stderr, "invalid option '%s'\n", arg);
+                return -1;
+            }
+        } else if (strcmp(arg, "--list") == 0) {
+            ctest_list = 1;
+        } else if (strncmp(arg, "--tags=", 7) == 0) {
+            ctest_tags = arg + 7;
+        } else if (strncmp(arg, "--changed-since=", 16) == 0) {
+            ctest_changed_since = arg + 16;
+            if (ctest_changed_since[0] == '\0') {
+                fprintf(stderr, "invalid option '%s'\n", arg);
+                return -1;
+            }
+        } else if (strncmp(arg, "--cache-dir=", 12) == 0) {
+            ctest_cache_dir = arg + 12;
+        } else if (strncmp(arg, "--trace=", 8) == 0) {
+            ctest_trace_path = arg + 8;
+        } else if (strncmp(arg, "--jobs=", 7) == 0) {
+            ctest_jobs = atoi(arg + 7);
+            if (ctest_jobs < 1) {
+                fprintf(stderr, "invalid option '%s'\n", arg);
+                return -1;
+            }
+        } else if (strcmp(arg, "--rusage") == 0) {
+            ctest_rusage = 1;
+        } else if (strcmp(arg, "--verbose") == 0) {
+            ctest_verbose = 1;
+#ifdef CTEST_IMPL_HAS_CAPTURE
+        } else if (strcmp(arg, "--capture=failed") == 0) {
+            ctest_capture = CTEST_IMPL_CAPTURE_FAILED;
+        } else if (strcmp(arg, "--capture=all") == 0) {
+            ctest_capture = CTEST_IMPL_CAPTURE_ALL;
+#else
+        } else if (strncmp(arg, "--capture=", 10) == 0) {
+            fprintf(stderr, "'%s' needs memfd_create, which this platform or build (without _GNU_SOURCE) doesn't have\n", arg);
+            return -1;
+#endif
+        } else if (strcmp(arg, "--cpu-cache=warm") == 0 || strcmp(arg, "--cpu-cache=cold") == 0) {
+            ctest_cpu_cache_cold = arg[12] == 'c';
+#ifdef CTEST_IMPL_HAS_AFFINITY
+        } else if (strncmp(arg, "--cpus=", 7) == 0) {
+            if (parse_cpus(arg + 7) != 0) {
+                fprintf(stderr, "invalid option '%s'\n", arg);
+                return -1;
+            }
+#else
+        } else if (strncmp(arg, "--cpus=", 7) == 0) {
+            fprintf(stderr, "'%s' needs sched_setaffinity, which this platform or build (without _GNU_SOURCE) doesn't have\n", arg);
+            return -1;
+#endif
+#ifdef CTEST_IMPL_HAS_PROFILE
+        } else if (strncmp(arg, "--profile=", 10) == 0) {
+            ctest_profile_path = arg + 10;
+#else
+        } else if (strncmp(arg, "--profile=", 10) == 0) {
+            fprintf(stderr, "'%s' needs setitimer and the registers of x86-64 or ARM64 Linux, which this build doesn't have\n", arg);
+            return -1;
+#endif
+        } else if (strcmp(arg, "--update-golden") == 0) {
+            ctest_golden_update = 1;
+        } else if (strcmp(arg, "--no-cache") == 0) {
+            ctest_cache_read = 0;
+        } else if (strncmp(arg, "--coverage-map=", 15) == 0) {
+            if (load_coverage_map(arg + 15) != 0) return -1;
+#ifdef CTEST_IMPL_HAS_DISTRIBUTED
+        } else if (strncmp(arg, "--coordinator=", 14) == 0) {
+            ctest_coordinator = arg + 14;
+        } else if (strncmp(arg, "--worker=", 9) == 0) {
+            ctest_worker = arg + 9;
+#else
+        } else if (strncmp(arg, "--coordinator=", 14) == 0 || strncmp(arg, "--worker=", 9) == 0) {
+            fprintf(stderr, "'%s' needs sockets, which this platform or build doesn't have\n", arg);
+            return -1;
+#endif
+#ifdef CTEST_IMPL_HAS_WATCH
+        } else if (strcmp(arg, "--watch") == 0) {
+            ctest_watch = 1;
+        } else if (strncmp(arg, "--watch-dir=", 12) == 0) {
+            if (ctest_watch_dir_count == CTEST_IMPL_WATCH_DIRS) {
+                fprintf(stderr, "at most %d --watch-dir can be given\n", CTEST_IMPL_WATCH_DIRS);
+                return -1;
+            }
+            ctest_watch_dirs[ctest_watch_dir_count++] = arg + 12;
+            ctest_watch = 1;
+        } else if (strncmp(arg, "--watch-state=", 14) == 0) {
+            ctest_watch_fd = atoi(arg + 14);
+#else
+        } else if (strncmp(arg, "--watch", 7) == 0) {
+            fprintf(stderr, "'%s' needs inotify, which this platform or build doesn't have\n", arg);
+            return -1;
+#endif
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", arg);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// The defaults of the options, which every ctest_run starts from
+static void reset_options(void) {
+    suite_name = NULL;
+    test_expression = NULL;
+    ctest_shuffle = 0;
+    ctest_seed = 0;
+    ctest_bisect = 0;
+    ctest_list = 0;
+    ctest_repeat = 0;
+    ctest_until_fail = 0;
+    ctest_retries = 0;
+    ctest_tags = NULL;
+    ctest_changed_since = NULL;
+    ctest_changed_by_time = 0;
+    ctest_changed_time = 0;
+    ctest_changed_last_file = NULL;
+    ctest_changed_last = 0;
+    ctest_cache_dir = NULL;
+    ctest_cache_read = 1;
+    ctest_trace_path = NULL;
+    ctest_jobs = 1;
+    ctest_rusage = 0;
+    ctest_verbose = 0;
+    ctest_cpu_cache_cold = 0;
+    ctest_golden_update = 0;
+    ctest_complexity_expected = -1;
+    ctest_trace_test = NULL;
+    ctest_trace_track = 0;
+    ctest_worker_events = 0;
+#ifdef CTEST_LAZY_LOG
+    ctest_log_head = ctest_log_tail = 0;
+    ctest_log_count = 0;
+    ctest_log_dropped = 0;
+#endif
+#ifdef CTEST_IMPL_HAS_NOISE
+    ctest_noise_check = 0;
+#endif
+#ifdef CTEST_IMPL_HAS_CAPTURE
+    ctest_capture = 0;
+#endif
+#ifdef CTEST_IMPL_HAS_PROFILE
+    ctest_profile_path = NULL;
+#endif
+#ifdef CTEST_IMPL_HAS_AFFINITY
+    ctest_cpu_count = 0;
+#endif
+#ifdef CTEST_IMPL_HAS_DISTRIBUTED
+    ctest_coordinator = NULL;
+    ctest_worker = NULL;
+#endif
+#ifdef CTEST_IMPL_HAS_WATCH
+    ctest_watch = 0;
+    ctest_watch_dir_count = 0;
+    ctest_watch_fd = -1;
+    ctest_watch_hidden = 0;
+#endif
+}
+
+// Check the options together, once they are all set
+static int check_options(void) {
+    if (ctest_shuffle && ctest_seed == 0) {
+        ctest_seed = ctest_now_ns() ^ (uint64_t)time(NULL);
+    }
+    if (ctest_bisect && (ctest_repeat > 1 || ctest_until_fail)) {
+        fprintf(stderr, "--bisect-order runs the tests once, it can't be used with --repeat or --until-fail\n");
+        return -1;
+    }
+    if (ctest_bisect && ctest_jobs > 1) {
+        fprintf(stderr, "--bisect-order runs the tests one after the other, it can't be used with --jobs\n");
+        return -1;
+    }
+#ifdef CTEST_IMPL_HAS_DISTRIBUTED
+    if (ctest_coordinator && (ctest_jobs > 1 || ctest_bisect)) {
+        fprintf(stderr, "--coordinator runs the tests on its workers, it can't be used with --jobs or --bisect-order\n");
+        return -1;
+    }
+#endif
+#if defined(_WIN32)
+    ctest_jobs = 1;
+#endif
+    if (ctest_repeat > 1 || ctest_until_fail) {
+        // Every iteration should run the tests, not find them in the cache
+        ctest_cache_read = 0;
+    }
+    if (ctest_changed_since && ctest_changed_since[strspn(ctest_changed_since, "0123456789")] == '\0') {
+        ctest_changed_by_time = 1;
+        ctest_changed_time = strtoumax(ctest_changed_since, NULL, 10);
+    }
+
+    return 0;
+}
+
+// Free what run_selected set up, whichever way it ends, and return `status`
+static int run_finish(struct ctest** tests, int status) {
+#ifdef CTEST_IMPL_HAS_DISTRIBUTED
+    coordinator_close();
+#endif
+#ifdef CTEST_IMPL_HAS_PROFILE
+    profile_close();
+#endif
+#ifdef CTEST_IMPL_HAS_WATCH
+    free(ctest_watch_previous);
+    ctest_watch_previous = NULL;
+#endif
+    free(tests);
+    free(ctest_coverage_map);
+    free(ctest_coverage_entries);
+    free(ctest_coverage_changed);
+    free(ctest_dep_first);
+    free(ctest_dep_list);
+    free(ctest_outcome);
+    free(ctest_tag_masks);
+    free(ctest_tag_text);
+    ctest_coverage_map = NULL;
+    ctest_coverage_entries = NULL;
+    ctest_coverage_count = 0;
+    ctest_coverage_changed = NULL;
+    ctest_dep_first = NULL;
+    ctest_dep_list = NULL;
+    ctest_outcome = NULL;
+    ctest_tag_masks = NULL;
+    ctest_tag_text = NULL;
+    free(ctest_fixture_block);
+    ctest_fixture_block = NULL;
+    ctest_fixture_capacity = 0;
+    golden_close();
+    free(ctest_cpu_cache_buffer);
+    ctest_cpu_cache_buffer = NULL;
+#ifdef CTEST_IMPL_HAS_CAPTURE
+    if (ctest_capture_fd >= 0) close(ctest_capture_fd);
+    ctest_capture_fd = -1;
+#endif
+    free(ctest_trace_ring);
+    ctest_trace_ring = NULL;
+    return status;
+}
+
+// Run the tests `filter` selects with the options that were set, and print
+// the report. Return the exit code of ctest_main if it isn't the number of
+// failed tests, e.g. 1 if the tests can't be run, or 0.
+__attribute__((no_sanitize_address)) static int run_selected(int argc, const char* argv[], ctest_filter_func filter,
+                                                             struct ctest_counts* result) {
+    struct ctest_counts counts = { 0, 0, 0, 0 };
+    int total = 0;
+
+#ifdef CTEST_IMPL_HAS_WATCH
+    if (ctest_watch) {
+        if (!argv) {
+            fprintf(stderr, "--watch restarts the executable, it needs ctest_options.argv\n");
+            return 1;
+        }
+        return watch_loop(argc, argv);
+    }
+#else
+    (void)argc;
+#endif
+#ifdef CTEST_IMPL_HAS_AFFINITY
+    if (ctest_cpu_count && pin_cpus(ctest_cpus, ctest_cpu_count) != 0) {
+        fprintf(stderr, "cannot pin the tests to --cpus: %s\n", strerror(errno));
+        return 1;
+    }
+#endif
+#ifdef CTEST_NO_COLORS
+    color_output = 0;
+#else
+    color_output = isatty(1);
+#endif
+    cache_open(argv ? argv[0] : NULL);
+    trace_open();
+    const uint64_t run_started = ctest_now_ns();
+    uint64_t span = trace_begin("runner", "discover");
+
+    struct ctest* ctest_begin = &CTEST_IMPL_TNAME(suite, test);
+    struct ctest* ctest_end = &CTEST_IMPL_TNAME(suite, test);
+    // find begin and end of section by comparing magics
+    while (1) {
+        struct ctest* t = ctest_begin-1;
+        if (t->magic != CTEST_IMPL_MAGIC) break;
+        ctest_begin--;
+    }
+    while (1) {
+        struct ctest* t = ctest_end+1;
+        if (t->magic != CTEST_IMPL_MAGIC) break;
+        ctest_end++;
+    }
+    ctest_end++;    // end after last one
+
+    ctest_meta_begin = &CTEST_IMPL_META_NAME(suite, test, anchor);
+    ctest_meta_end = &CTEST_IMPL_META_NAME(suite, test, anchor);
+    while ((ctest_meta_begin-1)->magic == CTEST_IMPL_MAGIC) ctest_meta_begin--;
+    while ((ctest_meta_end+1)->magic == CTEST_IMPL_MAGIC) ctest_meta_end++;
+    ctest_meta_end++;
+    ctest_section = ctest_begin;
+    ctest_section_size = (int)(ctest_end - ctest_begin);
+    if (load_tags() != 0) return run_finish(NULL, 1);
+    ctest_trace_end(&span);
+#ifdef CTEST_IMPL_HAS_PROFILE
+    if (ctest_profile_path && profile_open() != 0) return run_finish(NULL, 1);
+#endif
+#ifdef CTEST_IMPL_HAS_DISTRIBUTED
+    if (ctest_worker) return run_finish(NULL, worker_run());
+#endif
+
+    span = trace_begin("runner", "filter");
+    struct ctest** tests = (struct ctest**)malloc(sizeof(struct ctest*) * (size_t)(ctest_end - ctest_begin));
+    struct ctest* test;
+    for (test = ctest_begin; test != ctest_end; test++) {
+        if (test == &CTEST_IMPL_TNAME(suite, test)) continue;
+        if (!filter(test)) continue;
+        if (ctest_changed_since && !test_changed(test)) continue;
+        if (ctest_tags && !tags_match(test)) continue;
+        tests[total++] = test;
+    }
+    ctest_trace_end(&span);
+
+    if (load_dependencies() != 0) return run_finish(tests, 1);
+    select_dependencies(tests, &total);
+#ifdef CTEST_IMPL_HAS_WATCH
+    if (ctest_watch_fd >= 0) watch_load(tests, total);
+#endif
+    if (order_dependencies(tests, NULL, total) != 0) return run_finish(tests, 1);
+
+    if (ctest_list) {
+        int i;
+        for (i = 0; i < total; i++) {
+            const char* tags = test_tags(tests[i]);
+            fprintf(ctest_report, "%s:%s %s:%d%s%s\n", tests[i]->ssname, tests[i]->ttname, tests[i]->file, tests[i]->line,
+                   tags[0] ? " " : "", tags);
+        }
+        return run_finish(tests, 0);
+    }
+
+#ifdef CTEST_IMPL_HAS_DISTRIBUTED
+    if (ctest_coordinator && coordinator_open() != 0) return run_finish(tests, 1);
+#endif
+#ifdef CTEST_IMPL_HAS_NOISE
+    ctest_noise_check = noise_timed(tests, total);
+    if (ctest_noise_check) noise_sample(&ctest_noise_start);
+#endif
+    if (ctest_bisect) {
+        struct ctest** ordered = (struct ctest**)malloc(sizeof(*ordered) * (size_t)(total ? total : 1));
+        int* order = (int*)malloc(sizeof(*order) * (size_t)(total ? total : 1));
+        order_tests(ordered, order, tests, total, ctest_seed);
+        bisect_order(ordered, total, &counts);
+        free(order);
+        free(ordered);
+    } else {
+        run_repeated(tests, total, &counts);
+    }
+#ifdef CTEST_IMPL_HAS_WATCH
+    if (ctest_watch_previous) watch_save();
+#endif
+    total = counts.num_ok + counts.num_fail + counts.num_skip;
+    // Wall time on the clock of the callbacks, which CPU time undercounts with --jobs or tests that wait
+    const uint64_t run_duration = ctest_now_ns() - run_started;
+
+    const char* color = (counts.num_fail) ? ANSI_BRED : ANSI_GREEN;
+    char results[320];
+    int length = snprintf(results, sizeof(results), "RESULTS: %d tests (%d ok, %d failed, %d skipped) ran in %.1f ms",
+             total, counts.num_ok, counts.num_fail, counts.num_skip, (double)run_duration / 1e6);
+    if (counts.num_flaky && length > 0 && (size_t)length < sizeof(results)) {
+        length += snprintf(results + length, sizeof(results) - (size_t)length, ", %d flaky", counts.num_flaky);
+    }
+    if (ctest_shuffle && length > 0 && (size_t)length < sizeof(results)) {
+        length += snprintf(results + length, sizeof(results) - (size_t)length, ", seed %" PRIu64, ctest_seed);
+    }
+#ifdef CTEST_IMPL_HAS_NOISE
+    if (ctest_noise_check && length > 0 && (size_t)length < sizeof(results)) {
+        noise_describe(results + length, sizeof(results) - (size_t)length);
+    }
+#endif
+    color_print(color, results);
+    trace_write();
+    event_summary(total, counts.num_ok, counts.num_fail, counts.num_skip, run_duration);
+    *result = counts;
+    return run_finish(tests, 0);
+}
+
+struct ctest_run_result ctest_run(const struct ctest_options* options, struct ctest_callbacks* callbacks) {
+    struct ctest_run_result result;
+    struct ctest_counts counts = { 0, 0, 0, 0 };
+    ctest_filter_func filter = suite_all;
+    const uint64_t started = ctest_now_ns();
+
+    memset(&result, 0, sizeof(result));
+    ctest_report = stdout;
+#ifdef CTEST_SEGFAULT
+    signal(SIGSEGV, sighandler);
+#endif
+    reset_options();
+    if (options->argc > 1 && parse_arguments(options->argc, options->argv, &filter) != 0) {
+        result.error = run_finish(NULL, 1);
+        return result;
+    }
+    if (options->suite) {
+        suite_name = options->suite;
+        test_expression = options->test;
+        filter = suite_filter;
+    }
+    if (options->jobs > 0) ctest_jobs = options->jobs;
+    if (options->repeat > 0) ctest_repeat = options->repeat;
+    if (check_options() != 0) {
+        result.error = run_finish(NULL, 1);
+        return result;
+    }
+
+    event_open();
+    if (options->reporter != CTEST_REPORTER_TEXT) {
+        // Its own stream, so that stdout, which the caller may be using, is left alone
+#if defined(_WIN32)
+        ctest_report = fopen("NUL", "w");
+#else
+        ctest_report = fopen("/dev/null", "w");
+#endif
+        if (!ctest_report) {
+            ctest_report = stdout;
+            fprintf(stderr, "cannot open the null device for the report\n");
+            result.error = run_finish(NULL, 1);
+            return result;
+        }
+#if !defined(_WIN32)
+        ctest_event_fd = options->reporter == CTEST_REPORTER_EVENTS ? options->event_fd : -1;
+#endif
+    }
+    ctest_callbacks = callbacks;
+    result.error = run_selected(options->argc, options->argv, filter, &counts);
+    ctest_callbacks = NULL;
+    if (ctest_report != stdout) fclose(ctest_report);
+    ctest_report = stdout;
+
+    result.total = counts.num_ok + counts.num_fail + counts.num_skip;
+    result.ok = counts.num_ok;
+    result.failed = counts.num_fail;
+    result.skipped = counts.num_skip;
+    result.flaky = counts.num_flaky;
+    result.duration = ctest_now_ns() - started;
+    return result;
+}
+
+int ctest_main(int argc, const char *argv[])
+{
+    struct ctest_options options;
+    struct ctest_run_result result;
+
+    memset(&options, 0, sizeof(options));
+    options.argc = argc;
+    options.argv = argv;
+    result = ctest_run(&options, NULL);
+    return result.error ? result.error : result.failed;
 }
 
 #endif
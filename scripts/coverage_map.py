@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Build the test to source file map read by `--coverage-map`.
+
+Build the test binary with coverage (e.g. `-O0 --coverage`), then run:
+
+    coverage_map.py ./test > tests.map
+    ./test --coverage-map=tests.map --changed-since=$(git diff --name-only HEAD | paste -sd,)
+
+Each test is run on its own and every source file with a line it executed is
+written as a "suite:test<TAB>file" line. Requires gcov 9 or newer.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+
+def list_tests(binary):
+    output = subprocess.run([binary, "--list"], check=True, capture_output=True, text=True).stdout
+
+    return [line.split(" ", 1)[0] for line in output.splitlines() if line]
+
+
+def find_gcda(directory):
+    for root, _, files in os.walk(directory):
+        for name in files:
+            if name.endswith(".gcda"):
+                yield os.path.join(root, name)
+
+
+def covered_files(objects, root):
+    gcda = list(find_gcda(objects))
+
+    if not gcda:
+        return set()
+
+    output = subprocess.run(
+        ["gcov", "--json-format", "--stdout", *gcda],
+        check=True,
+        capture_output=True,
+        text=True,
+        cwd=objects,
+    ).stdout
+    files = set()
+
+    for document in output.splitlines():
+        if not document.strip():
+            continue
+
+        report = json.loads(document)
+        directory = report.get("current_working_directory", objects)
+
+        for source in report.get("files", []):
+            if any(line["count"] for line in source["lines"]):
+                path = os.path.normpath(os.path.join(directory, source["file"]))
+                files.add(os.path.relpath(path, root) if root else path)
+
+    return files
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("binary", help="ctest binary built with coverage")
+    parser.add_argument("--objects", default=".", help="directory searched for .gcda files (default: .)")
+    parser.add_argument("--root", help="write paths relative to this directory, e.g. the repository")
+    arguments = parser.parse_args()
+
+    binary = os.path.abspath(arguments.binary)
+    objects = os.path.abspath(arguments.objects)
+    root = os.path.abspath(arguments.root) if arguments.root else None
+
+    for test in list_tests(binary):
+        for path in find_gcda(objects):
+            os.remove(path)
+
+        # The name filters are prefixes, so this may also run other tests. That
+        # only adds files to the map, which at worst selects a test too often.
+        subprocess.run([binary, *test.split(":", 1)], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+        for path in sorted(covered_files(objects, root)):
+            sys.stdout.write(f"{test}\t{path}\n")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,8 @@
+// The runner and the assertions, compiled once for the ctest library.
+// Test files then include ctest.h without defining CTEST_MAIN.
+#define CTEST_MAIN
+// For memfd_create, sched_setaffinity and dl_iterate_phdr, which g++ gets by default:
+// without it the library would lack --capture, --cpus and the build ID of the cache
+#define _GNU_SOURCE
+
+#include "ctest.h"
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+// Its own output, which goes to stdout even without the text report
+CTEST(api, passing) {
+    printf("printed by the test\n");
+}
+
+CTEST(api, failing) {
+    ASSERT_FAIL();
+}
+
+CTEST(other, not_selected) {
+}
+
+struct tally {
+    int started;
+    int ended;
+    int timed;  // ended with a duration
+};
+
+static void on_start(void* context, const char* suite, const char* test, int index, int total) {
+    struct tally* tally = (struct tally*)context;
+    tally->started++;
+    printf("start %d/%d %s:%s\n", index, total, suite, test);
+}
+
+static void on_end(void* context, const char* suite, const char* test, enum ctest_status status, uint64_t duration) {
+    struct tally* tally = (struct tally*)context;
+    tally->ended++;
+    if (duration > 0) tally->timed++;
+    printf("end %s:%s %d\n", suite, test, (int)status);
+}
+
+// Runs the "api" suite twice in this process, with the --jobs given as the argument
+int main(int argc, const char *argv[]) {
+    struct ctest_options options;
+    struct ctest_callbacks callbacks;
+    struct tally tally;
+    int run;
+
+    memset(&options, 0, sizeof(options));
+    options.suite = "api";
+    options.jobs = argc > 1 ? atoi(argv[1]) : 0;
+    options.reporter = CTEST_REPORTER_NONE;
+    for (run = 1; run <= 2; run++) {
+        struct ctest_run_result result;
+        memset(&tally, 0, sizeof(tally));
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.context = &tally;
+        callbacks.test_start = on_start;
+        callbacks.test_end = on_end;
+        result = ctest_run(&options, &callbacks);
+        printf("run %d: error %d, %d total, %d ok, %d failed, %d skipped, %d started, %d ended, %d timed\n", run,
+               result.error, result.total, result.ok, result.failed, result.skipped, tally.started, tally.ended, tally.timed);
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <stdexcept>
+#include <unistd.h>
+
+#define CTEST_MAIN
+
+#define CTEST_SEGFAULT
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+using namespace std::chrono_literals;
+
+static ctest_async::task wait_and_read(int fd, char* output)
+{
+    co_await ctest_async::readable(fd);
+    ASSERT_EQUAL(1, read(fd, output, 1));
+}
+
+CTEST(sync, before) { ASSERT_TRUE(true); }
+
+CTEST_ASYNC(timers, first) { co_await ctest_async::sleep_for(300ms); }
+
+CTEST_ASYNC(timers, second) { co_await ctest_async::sleep_for(300ms); }
+
+CTEST_ASYNC(timers, third) { co_await ctest_async::sleep_for(300ms); }
+
+CTEST_ASYNC(pipes, ping)
+{
+    int fds[2];
+    ASSERT_EQUAL(0, pipe(fds));
+
+    char received = 0;
+    auto reader = wait_and_read(fds[0], &received);
+
+    co_await ctest_async::sleep_for(10ms);
+    co_await ctest_async::writable(fds[1]);
+    ASSERT_EQUAL(1, write(fds[1], "x", 1));
+    co_await reader;
+
+    close(fds[0]);
+    close(fds[1]);
+    ASSERT_EQUAL('x', received);
+}
+
+CTEST_ASYNC(failures, assertion)
+{
+    CTEST_LOG("before the wait");
+    co_await ctest_async::sleep_for(10ms);
+    ASSERT_EQUAL(1, 2);
+    CTEST_LOG("never printed");
+}
+
+CTEST_ASYNC(failures, nested_assertion)
+{
+    int fds[2];
+    ASSERT_EQUAL(0, pipe(fds));
+    close(fds[1]);
+
+    char received = 0;
+    co_await wait_and_read(fds[0], &received);  // EOF, read returns 0
+    close(fds[0]);
+}
+
+CTEST_ASYNC(failures, exception)
+{
+    co_await ctest_async::sleep_for(1ms);
+    throw std::runtime_error("boom");
+}
+
+CTEST(sync, after) { ASSERT_TRUE(true); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,20 @@
+#include <stdio.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+CTEST(cache, pure) { ASSERT_EQUAL(4, 2 + 2); }
+
+CTEST_INPUTS(cache, reads_input, "cache_input.txt");
+CTEST(cache, reads_input) {
+    FILE* file = fopen("cache_input.txt", "r");
+    ASSERT_NOT_NULL(file);
+    fclose(file);
+}
+
+CTEST(cache, fails) { ASSERT_FAIL(); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+CTEST(capture, passing) {
+    printf("quiet\n");
+}
+
+// stdout is buffered, so its lines come after the unbuffered writes. The
+// last line has no newline.
+CTEST(capture, failing) {
+    printf("to stdout\n");
+    fprintf(stderr, "to stderr\n");
+    write(STDOUT_FILENO, "written\n", 8);
+    printf("unterminated");
+    CTEST_LOG("logged");
+    ASSERT_FAIL();
+}
+
+CTEST(capture, silent) {
+}
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -1,57 +1,312 @@
 #ifndef CLI_HPP
 #define CLI_HPP
 
-#include <array> // std::array
-#include <cstdio> // popen, pclose
-#include <stdlib.h> // WIFEXITED, WEXITSTATUS
-#include <iostream> // std::cout, std::cerr
+#include <algorithm>  // std::min
+#include <chrono>  // std::chrono::steady_clock
+#include <cerrno>  // errno, EINTR
+#include <fcntl.h>  // O_CLOEXEC
+#include <functional>  // std::function
+#include <iostream>  // std::cerr
+#include <poll.h>  // poll
+#include <spawn.h>  // posix_spawnp, posix_spawn_file_actions_addchdir_np
 #include <string>
+#include <string_view>
+#include <sys/resource.h>  // struct rusage
+#include <sys/wait.h>  // wait4, WIFEXITED, WEXITSTATUS, WIFSIGNALED, WTERMSIG
+#include <unistd.h>  // pipe2, read, close
+#include <vector>
+
+extern char** environ;
 
 namespace cli
 {
     enum ExitCode
     {
         ExitCode_BAD_EXIT,
-        ExitCode_PCLOSE_FAILED,
-        ExitCode_POPEN_FAILED,
+        ExitCode_SPAWN_FAILED,
+        ExitCode_WAIT_FAILED,
+        ExitCode_SIGNALED,
         ExitCode_SUCCESS,
     };
 
+    struct Options {
+        // Extra "NAME=value" variables, added on top of the current environment
+        std::vector<std::string> environment;
+
+        // If set, stdout is passed here as it is read instead of being stored in Result::std_out
+        std::function<void(std::string_view)> on_std_out;
+
+        // If set, this descriptor of the child is also connected to a pipe, stored in Result::captured
+        int capture_fd {-1};
+
+        // If set, called with the process id of the child once it has started
+        std::function<void(pid_t)> on_start;
+
+        // If set, the working directory of the child. The current one is left alone.
+        std::string directory;
+    };
+
     struct Result {
         ExitCode exit_code;
         std::string std_out;
+        std::string std_err;
+        std::string captured;
+
+        int status {0};  // The exit status, if the process exited normally
+        int signal {0};  // The terminating signal, if the process was killed
+        std::chrono::nanoseconds wall_time {0};
+        struct rusage usage {};
     };
 
-    Result execute_command(std::string const command)
+    namespace details
     {
-        FILE* pipe = popen(command.c_str(), "r");
+        std::size_t const READ_SIZE = 64 * 1024;
+
+        // Read whatever `fd` has available. Return false once it reaches EOF.
+        inline bool read_some(int fd, std::string& output, std::function<void(std::string_view)> const& on_read)
+        {
+            std::size_t const size = output.size();
+            // Read straight into the output so there is no intermediate copy
+            output.resize(size + READ_SIZE);
+            ssize_t const count = read(fd, output.data() + size, READ_SIZE);
+            output.resize(size + (count > 0 ? static_cast<std::size_t>(count) : 0));
 
-        if (!pipe) {
-            std::cerr << "popen() failed!" << std::endl;
+            if (count < 0)
+            {
+                return errno == EINTR || errno == EAGAIN;
+            }
 
-            return Result{ExitCode_POPEN_FAILED, ""};
+            if (count > 0 && on_read)
+            {
+                on_read(std::string_view{output}.substr(size));
+                output.clear();
+            }
+
+            return count != 0;
         }
 
-        std::array<char, 128> buffer;
-        std::string std_out;
+        inline std::vector<char*> make_environment(std::vector<std::string> const& extra)
+        {
+            std::vector<char*> output;
+
+            for (char** variable = environ; *variable; ++variable)
+            {
+                std::string_view const existing {*variable};
+                bool overridden {false};
+
+                for (auto const& added : extra)
+                {
+                    // "NAME=value", or a bare "NAME" which only hides the inherited one
+                    std::string_view const name = std::string_view{added}.substr(0, added.find('='));
+
+                    if (
+                        existing.size() > name.size()
+                        && existing.substr(0, name.size()) == name
+                        && existing[name.size()] == '='
+                    )
+                    {
+                        overridden = true;
+
+                        break;
+                    }
+                }
+
+                if (!overridden)
+                {
+                    output.push_back(*variable);
+                }
+            }
+
+            for (auto const& added : extra)
+            {
+                output.push_back(const_cast<char*>(added.c_str()));
+            }
+
+            output.push_back(nullptr);
+
+            return output;
+        }
+    }
+
+    // Run `arguments` directly (no shell), capturing its stdout and stderr.
+    inline Result execute(std::vector<std::string> const& arguments, Options const& options = {})
+    {
+        Result result {};
+        result.exit_code = ExitCode_SPAWN_FAILED;
+        auto const start = std::chrono::steady_clock::now();
+
+        if (arguments.empty())
+        {
+            std::cerr << "execute() needs at least the program to run!" << std::endl;
+
+            return result;
+        }
+
+        // stdout, stderr and Options::capture_fd
+        int pipes[3][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+        int const targets[3] = {STDOUT_FILENO, STDERR_FILENO, options.capture_fd};
+        int const count = options.capture_fd < 0 ? 2 : 3;
+
+        for (int index = 0; index < count; ++index)
+        {
+            if (pipe2(pipes[index], O_CLOEXEC) == -1)
+            {
+                std::cerr << "pipe2() failed!" << std::endl;
+
+                for (int opened = 0; opened < index; ++opened)
+                {
+                    close(pipes[opened][0]);
+                    close(pipes[opened][1]);
+                }
+
+                return result;
+            }
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+
+        for (int index = 0; index < count; ++index)
+        {
+            posix_spawn_file_actions_adddup2(&actions, pipes[index][1], targets[index]);
+        }
+
+        if (!options.directory.empty())
+        {
+            posix_spawn_file_actions_addchdir_np(&actions, options.directory.c_str());
+        }
+
+        std::vector<char*> argv;
+
+        for (auto const& argument : arguments)
+        {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+
+        argv.push_back(nullptr);
+
+        auto environment = details::make_environment(options.environment);
+
+        pid_t pid;
+        int const spawned = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environment.data());
+        posix_spawn_file_actions_destroy(&actions);
 
-        while (std::fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-            std_out += buffer.data();
+        for (int index = 0; index < count; ++index)
+        {
+            close(pipes[index][1]);
         }
 
-        int status = pclose(pipe);
+        if (spawned != 0)
+        {
+            std::cerr << "posix_spawnp() failed!" << std::endl;
+
+            for (int index = 0; index < count; ++index)
+            {
+                close(pipes[index][0]);
+            }
+
+            return result;
+        }
+
+        if (options.on_start)
+        {
+            options.on_start(pid);
+        }
+
+        struct pollfd descriptors[3] = {
+            {pipes[0][0], POLLIN, 0},
+            {pipes[1][0], POLLIN, 0},
+            {pipes[2][0], POLLIN, 0},
+        };
+        std::string* outputs[3] = {&result.std_out, &result.std_err, &result.captured};
+        std::function<void(std::string_view)> const no_callback;
+        std::function<void(std::string_view)> const* callbacks[3] = {&options.on_std_out, &no_callback, &no_callback};
+        int open = count;
+
+        while (open)
+        {
+            if (poll(descriptors, static_cast<nfds_t>(count), -1) == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                break;
+            }
 
-        if (status == -1) {
-            std::cerr << "pclose() failed!" << std::endl;
+            for (int index = 0; index < count; ++index)
+            {
+                if (descriptors[index].fd < 0 || !descriptors[index].revents)
+                {
+                    continue;
+                }
 
-            return Result{ExitCode_PCLOSE_FAILED, ""};
+                if (!details::read_some(descriptors[index].fd, *outputs[index], *callbacks[index]))
+                {
+                    close(descriptors[index].fd);
+                    descriptors[index].fd = -1;
+                    --open;
+                }
+            }
         }
 
-        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-            return Result{ExitCode_BAD_EXIT, std_out};
+        for (auto const& descriptor : descriptors)
+        {
+            if (descriptor.fd >= 0)
+            {
+                close(descriptor.fd);
+            }
+        }
+
+        int status;
+
+        while (wait4(pid, &status, 0, &result.usage) == -1)
+        {
+            if (errno != EINTR)
+            {
+                std::cerr << "wait4() failed!" << std::endl;
+                result.exit_code = ExitCode_WAIT_FAILED;
+
+                return result;
+            }
+        }
+
+        result.wall_time = std::chrono::steady_clock::now() - start;
+
+        if (WIFSIGNALED(status))
+        {
+            result.signal = WTERMSIG(status);
+            result.exit_code = ExitCode_SIGNALED;
+        }
+        else
+        {
+            result.status = WEXITSTATUS(status);
+            result.exit_code = result.status == 0 ? ExitCode_SUCCESS : ExitCode_BAD_EXIT;
+        }
+
+        return result;
+    }
+
+    // Run a space-separated `command`. The command is split on spaces, it is not given to a shell.
+    inline Result execute_command(std::string const& command, Options const& options = {})
+    {
+        std::vector<std::string> arguments;
+        std::size_t start = 0;
+
+        while (start < command.size())
+        {
+            auto const end = std::min(command.find(' ', start), command.size());
+
+            if (end != start)
+            {
+                arguments.push_back(command.substr(start, end - start));
+            }
+
+            start = end + 1;
         }
 
-        return Result{ExitCode_SUCCESS, std_out};
+        return execute(arguments, options);
     }
 }
 
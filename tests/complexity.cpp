@@ -0,0 +1,32 @@
+#include <stdlib.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+// volatile, so that the compiler can't skip or fold the loops
+static volatile size_t complexity_sink;
+
+CTEST_COMPLEXITY(complexity, linear, 256, 2048, 16384, 131072) {
+    size_t i;
+    EXPECT_COMPLEXITY(N);
+    for (i = 0; i < n; i++) complexity_sink = complexity_sink + i;
+}
+
+// Declared better than it is
+CTEST_COMPLEXITY(complexity, quadratic, 256, 512, 1024, 2048) {
+    size_t i;
+    size_t j;
+    EXPECT_COMPLEXITY(N_LOG_N);
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) complexity_sink = complexity_sink + j;
+    }
+}
+
+CTEST_COMPLEXITY(complexity, too_few_sizes, 10, 100) {
+    complexity_sink = n;
+}
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,20 @@
+#include <signal.h>
+#include <stdio.h>
+
+#define CTEST_MAIN
+
+#define CTEST_SEGFAULT
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+CTEST(crash, before) { ASSERT_TRUE(true); }
+
+CTEST(crash, segfault) {
+    fprintf(stderr, "about to crash\n");
+    raise(SIGSEGV);
+}
+
+CTEST(crash, after) { ASSERT_TRUE(true); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,20 @@
+#include <stdio.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+CTEST_DEPENDS(cycle, a, "cycle:b");
+CTEST(cycle, a) { }
+
+CTEST_DEPENDS(cycle, b, "cycle:c");
+CTEST(cycle, b) { }
+
+CTEST_DEPENDS(cycle, c, "cycle:a");
+CTEST(cycle, c) { }
+
+CTEST(cycle, unrelated) { }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,30 @@
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+// Declared before what it depends on, to check that it is moved after it
+CTEST_DEPENDS(depends, uses_prerequisite, "depends:prerequisite");
+CTEST(depends, uses_prerequisite) { }
+
+CTEST(depends, prerequisite) { }
+
+CTEST(depends, broken) { ASSERT_FAIL(); }
+
+CTEST_DEPENDS(depends, needs_broken, "depends:prerequisite", "depends:broken");
+CTEST(depends, needs_broken) { ASSERT_FAIL(); }
+
+CTEST_DEPENDS(depends, transitively, "depends:needs_broken");
+CTEST(depends, transitively) { ASSERT_FAIL(); }
+
+CTEST(slow, first) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }
+CTEST(slow, second) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }
+CTEST(slow, third) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }
+CTEST(slow, fourth) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,165 @@
+#ifndef EVENTS_HPP
+#define EVENTS_HPP
+
+#include <algorithm>  // std::min
+#include <cstdint>
+#include <cstring>  // std::memcpy
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <ctest.h>
+
+namespace events {
+
+// A decoded CTEST_EVENT_FD record. Only the fields of its `type` are set.
+struct Event
+{
+    ctest_event_type type {CTEST_EVENT_TEST_START};
+
+    std::uint32_t index {0};
+    std::uint32_t total {0};
+    std::string suite_name;
+    std::string test_name;
+    std::string tags;
+
+    std::string file;
+    std::uint32_t line {0};
+    std::string message;
+
+    ctest_status status {CTEST_STATUS_OK};
+    std::uint64_t duration {0};  // In nanoseconds
+
+    std::uint32_t number_ok {0};
+    std::uint32_t number_failed {0};
+    std::uint32_t number_skipped {0};
+
+    std::uint64_t max_rss_delta {0};  // In KB
+    std::uint64_t minor_faults {0};
+    std::uint64_t major_faults {0};
+    std::uint64_t voluntary_switches {0};
+    std::uint64_t involuntary_switches {0};
+    std::uint64_t user_time {0};  // In nanoseconds
+    std::uint64_t system_time {0};  // In nanoseconds
+};
+
+namespace details
+{
+    class Reader
+    {
+    public:
+        explicit Reader(std::string_view payload) : m_payload{payload} {}
+
+        template <typename T>
+        T number()
+        {
+            T value {};
+
+            if (m_payload.size() >= sizeof(T))
+            {
+                std::memcpy(&value, m_payload.data(), sizeof(T));
+                m_payload.remove_prefix(sizeof(T));
+            }
+
+            return value;
+        }
+
+        std::string string()
+        {
+            auto const size = std::min<std::size_t>(number<std::uint32_t>(), m_payload.size());
+            std::string value {m_payload.substr(0, size)};
+            m_payload.remove_prefix(size);
+
+            return value;
+        }
+
+    private:
+        std::string_view m_payload;
+    };
+
+    inline Event decode(ctest_event_type type, std::string_view payload)
+    {
+        Reader reader {payload};
+        Event event {};
+        event.type = type;
+
+        switch (type)
+        {
+            case CTEST_EVENT_TEST_START:
+                event.index = reader.number<std::uint32_t>();
+                event.total = reader.number<std::uint32_t>();
+                event.suite_name = reader.string();
+                event.test_name = reader.string();
+                event.tags = reader.string();
+
+                break;
+            case CTEST_EVENT_LOG:
+            case CTEST_EVENT_OUTPUT:
+                event.message = reader.string();
+
+                break;
+            case CTEST_EVENT_ASSERT:
+                event.line = reader.number<std::uint32_t>();
+                event.file = reader.string();
+                event.message = reader.string();
+
+                break;
+            case CTEST_EVENT_TEST_END:
+                event.status = static_cast<ctest_status>(reader.number<std::uint32_t>());
+                event.duration = reader.number<std::uint64_t>();
+
+                break;
+            case CTEST_EVENT_SUMMARY:
+                event.total = reader.number<std::uint32_t>();
+                event.number_ok = reader.number<std::uint32_t>();
+                event.number_failed = reader.number<std::uint32_t>();
+                event.number_skipped = reader.number<std::uint32_t>();
+                event.duration = reader.number<std::uint64_t>();
+
+                break;
+            case CTEST_EVENT_RUSAGE:
+                event.max_rss_delta = reader.number<std::uint64_t>();
+                event.minor_faults = reader.number<std::uint64_t>();
+                event.major_faults = reader.number<std::uint64_t>();
+                event.voluntary_switches = reader.number<std::uint64_t>();
+                event.involuntary_switches = reader.number<std::uint64_t>();
+                event.user_time = reader.number<std::uint64_t>();
+                event.system_time = reader.number<std::uint64_t>();
+
+                break;
+        }
+
+        return event;
+    }
+}
+
+// Decode every complete record of `data`. Incomplete trailing bytes are ignored.
+inline std::vector<Event> decode(std::string_view data)
+{
+    std::vector<Event> output;
+
+    while (data.size() >= sizeof(ctest_event_header))
+    {
+        ctest_event_header header;
+        std::memcpy(&header, data.data(), sizeof(header));
+
+        if (data.size() - sizeof(header) < header.size)
+        {
+            break;
+        }
+
+        output.push_back(
+            details::decode(
+                static_cast<ctest_event_type>(header.type),
+                data.substr(sizeof(header), header.size)
+            )
+        );
+        data.remove_prefix(sizeof(header) + header.size);
+    }
+
+    return output;
+}
+
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+// Every test of the suite gets the same pooled slot, which must look fresh each time
+CTEST_DATA(big) {
+    int setup_runs;
+    int used;
+    char buffer[64 * 1024];
+};
+
+CTEST_SETUP(big) {
+    ASSERT_EQUAL(0, data->setup_runs);
+    data->setup_runs++;
+}
+
+CTEST_TEARDOWN(big) {
+    memset(data->buffer, 0xff, sizeof(data->buffer));
+}
+
+#define USE(data) \
+    ASSERT_EQUAL(1, (data)->setup_runs); \
+    ASSERT_EQUAL(0, (data)->used); \
+    ASSERT_EQUAL(0, (data)->buffer[sizeof((data)->buffer) - 1]); \
+    ASSERT_EQUAL(0, (uintptr_t)(data) % 64); \
+    (data)->used = 1
+
+CTEST2(big, first) { USE(data); }
+CTEST2(big, second) { USE(data); }
+
+CTEST_DATA(small) {
+    int value;
+};
+
+CTEST2(small, starts_zeroed) {
+    ASSERT_EQUAL(0, data->value);
+    data->value = 42;
+}
+
+CTEST2(big, after_another_suite) { USE(data); }
+
+// C++ fixtures are constructed in the slot, and destroyed after teardown
+static int text_alive;
+
+struct text_counter {
+    text_counter() { text_alive++; }
+    ~text_counter() { text_alive--; }
+};
+
+CTEST_DATA(text) {
+    std::string value {"constructed, and long enough to be on the heap"};
+    text_counter counter;
+};
+
+CTEST_SETUP(text) {
+    ASSERT_EQUAL(1, text_alive);
+    ASSERT_STR("constructed, and long enough to be on the heap", data->value.c_str());
+}
+
+CTEST_TEARDOWN(text) {
+    ASSERT_EQUAL(1, text_alive);
+}
+
+CTEST2(text, first) { data->value += ", then changed"; }
+CTEST2(text, second) { data->value += ", then changed"; }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
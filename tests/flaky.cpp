@@ -0,0 +1,20 @@
+#include <stdio.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+// Tests whose outcome depends on how many times they already ran
+
+static int every_other_runs = 0;
+static int third_runs = 0;
+
+CTEST(flaky, every_other) { ASSERT_EQUAL(1, every_other_runs++ % 2); }
+
+CTEST(flaky, third) { ASSERT_NOT_EQUAL(3, ++third_runs); }
+
+CTEST(flaky, steady) { ASSERT_TRUE(1); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+// The golden files are relative to the working directory
+
+CTEST(golden, matches) { ASSERT_MATCHES_GOLDEN("golden_files/hello.txt", "hello\n", 6); }
+
+CTEST(golden, shares_the_mapping) { ASSERT_MATCHES_GOLDEN("golden_files/hello.txt", "hello\n", 6); }
+
+CTEST(golden, differs) { ASSERT_MATCHES_GOLDEN("golden_files/differs.txt", "hellO\n", 6); }
+
+CTEST(golden, missing) { ASSERT_MATCHES_GOLDEN("golden_files/missing.txt", "new\n", 4); }
+
+CTEST(golden, empty) { ASSERT_MATCHES_GOLDEN("golden_files/empty.txt", "", 0); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
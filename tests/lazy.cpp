@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#define CTEST_LAZY_LOG
+#define CTEST_LAZY_LOG_SIZE 1024
+
+#include "ctest.h"
+
+CTEST(lazy, passing) {
+    int i;
+    for (i = 0; i < 3; i++) CTEST_LOG("step %d", i);
+}
+
+// Every kind of conversion, formatted as printf would once it fails
+CTEST(lazy, failing) {
+    char word[] = {'a', 'b', 'c', 'd'};  // not terminated
+    char changed[16];
+    strcpy(changed, "before");
+    CTEST_LOG("%d %5i %-3ld| %lld %hhd %zu %td %jd", -1, 42, 7L, -8LL, (signed char)9, (size_t)10, (ptrdiff_t)-11, (intmax_t)12);
+    CTEST_LOG("%u %#x %X %o %c %%", 1u, 255u, 255u, 8u, 'z');
+    CTEST_LOG("%.2f %8.3e %g %Lf", 3.14159, 1234.5, 0.5, (long double)2.5);
+    CTEST_LOG("[%s] [%.*s] [%*s] [%-*.*s] [%ls]", changed, 3, word, 4, "r", 4, 2, "left", L"wide");
+    // The string was copied when logged
+    strcpy(changed, "after");
+    CTEST_ERR("failed");
+}
+
+// The ring keeps the newest messages
+CTEST(lazy, overflow) {
+    int i;
+    for (i = 0; i < 1000; i++) CTEST_LOG("message %d", i);
+    ASSERT_FAIL();
+}
+
+// A message the ring can't hold is recorded as text, cut to fit
+CTEST(lazy, larger_than_the_ring) {
+    char text[2048];
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    CTEST_LOG("%s", text);
+    ASSERT_FAIL();
+}
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,31 @@
+// Linked against the prebuilt ctest library, so no CTEST_MAIN here
+#include <stdio.h>
+
+#include "ctest.h"
+
+CTEST(library, plain) {
+    printf("from the library\n");
+    ASSERT_EQUAL(4, 2 + 2);
+}
+
+CTEST_DATA(library)
+{
+    int value;
+    int torn_down;
+};
+
+CTEST_SETUP(library) { data->value = 42; }
+
+CTEST_TEARDOWN(library) { data->torn_down = 1; }
+
+CTEST2(library, fixture) { ASSERT_EQUAL(42, data->value); }
+
+CTEST2(library, own_data) { ASSERT_EQUAL(0, data->torn_down); }
+
+CTEST(library, fails) { ASSERT_STR("expected", "actual"); }
+
+CTEST_SKIP(library, skipped) { ASSERT_FAIL(); }
+
+CTEST_THREADED(library, threaded, 2) { ASSERT_INTERVAL(0, 1, thread_index); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
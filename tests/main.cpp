@@ -1,4 +1,15 @@
-#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <signal.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <vector>
 #include <stdio.h>
 
 #define CTEST_MAIN
@@ -8,6 +19,7 @@
 #include <ctest.h>
 
 #include "cli.hpp"
+#include "events.hpp"
 #include "parser.hpp"
 #include "pather.hpp"
 
@@ -28,6 +40,37 @@ CTEST(simple, single_assert)
 }
 
 
+CTEST(simple, crash_is_a_signal)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("crash"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(cli::ExitCode_SIGNALED, raw.exit_code);
+    ASSERT_EQUAL(SIGSEGV, raw.signal);
+    ASSERT_STR("about to crash\n", raw.std_err.c_str());
+    ASSERT_FALSE(results.finished);
+    ASSERT_EQUAL(2, results.cases.size());
+    ASSERT_EQUAL(parser::TestStatus_OK, results.cases[0].return_status);
+    ASSERT_EQUAL(parser::TestStatus_SEGFAULT, results.cases[1].return_status);
+}
+
+
+CTEST(simple, stream_std_out)
+{
+    parser::StreamParser stream;
+    cli::Options options;
+    options.on_std_out = [&stream](std::string_view chunk) { stream.feed(chunk); };
+
+    auto const raw = cli::execute({pather::make_absolute("arguments"), "suitey"}, options);
+    auto const& results = stream.finish();
+
+    ASSERT_EQUAL(cli::ExitCode_SUCCESS, raw.exit_code);
+    ASSERT_TRUE(raw.std_out.empty());
+    ASSERT_TRUE(raw.wall_time.count() > 0);
+    ASSERT_EQUAL(3, results.cases.size());
+}
+
+
 CTEST(arguments, no_arguments)
 {
     auto const raw = cli::execute_command(pather::make_absolute("arguments"));
@@ -98,6 +141,1161 @@ CTEST(miscellaneous, mytests)
     ASSERT_EQUAL(11, results.number_ok);
     ASSERT_EQUAL(22, results.number_failed);
     ASSERT_EQUAL(2, results.number_skipped);
+    ASSERT_EQUAL(35, results.cases.size());
+    ASSERT_EQUAL(
+        22,
+        std::count_if(
+            results.cases.begin(),
+            results.cases.end(),
+            [](auto const& test){ return test.return_status == parser::TestStatus_FAILED; }
+        )
+    );
+}
+
+
+CTEST(parser, messages_attach_to_their_test)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("mytests memtest test2"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(1, results.cases.size());
+    auto const& test_result = results.cases[0];
+    ASSERT_EQUAL(parser::TestStatus_FAILED, test_result.return_status);
+    ASSERT_EQUAL(3, test_result.messages.size());
+    ASSERT_EQUAL(parser::MessageKind_LOG, test_result.messages[0].kind);
+    ASSERT_EQUAL(parser::MessageKind_ERR, test_result.messages[2].kind);
+    ASSERT_STRSTR(test_result.messages[2].text.c_str(), "shouldn't come here");
+}
+
+
+CTEST(parser, chunks_split_anywhere)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("mytests"));
+    auto const expected = parser::parse_std_out(raw.std_out);
+    std::string_view const text {raw.std_out};
+
+    parser::StreamParser stream;
+
+    for (std::size_t index = 0; index < text.size(); ++index)
+    {
+        stream.feed(text.substr(index, 1));
+    }
+
+    auto const& results = stream.finish();
+
+    ASSERT_TRUE(results.finished);
+    ASSERT_EQUAL(expected.cases.size(), results.cases.size());
+
+    for (std::size_t index = 0; index < results.cases.size(); ++index)
+    {
+        ASSERT_STR(expected.cases[index].test_name.c_str(), results.cases[index].test_name.c_str());
+        ASSERT_EQUAL(expected.cases[index].return_status, results.cases[index].return_status);
+        ASSERT_EQUAL(expected.cases[index].messages.size(), results.cases[index].messages.size());
+    }
+}
+
+
+CTEST(parser, colored_output)
+{
+    auto const results = parser::parse_std_out(
+        "TEST 1/1 suite:name\n"
+        "\033[01;31m[FAIL]\033[0m\n"
+        "\033[0;33m  ERR: file.c:4  expected 1, got 2\033[0m\n"
+        "\033[0;31mRESULTS: 1 tests (0 ok, 1 failed, 0 skipped) ran in 0.5 ms\033[0m\n"
+    );
+
+    ASSERT_TRUE(results.finished);
+    ASSERT_EQUAL(1, results.number_failed);
+    ASSERT_EQUAL(1, results.cases.size());
+    ASSERT_EQUAL(parser::TestStatus_FAILED, results.cases[0].return_status);
+    ASSERT_STR("file.c:4  expected 1, got 2", results.cases[0].messages[0].text.c_str());
+    ASSERT_DBL_NEAR(0.5, results.total_time);
+}
+
+
+CTEST(events, event_fd)
+{
+    cli::Options options;
+    options.environment = {"CTEST_EVENT_FD=3"};
+    options.capture_fd = 3;
+
+    auto const raw = cli::execute({pather::make_absolute("mytests")}, options);
+    auto const text = parser::parse_std_out(raw.std_out);
+    auto const records = events::decode(raw.captured);
+
+    ASSERT_FALSE(records.empty());
+    ASSERT_EQUAL(CTEST_EVENT_SUMMARY, records.back().type);
+    ASSERT_EQUAL(35, records.back().total);
+    ASSERT_EQUAL(11, records.back().number_ok);
+    ASSERT_EQUAL(22, records.back().number_failed);
+    ASSERT_EQUAL(2, records.back().number_skipped);
+
+    std::size_t index = 0;
+
+    for (auto const& record : records)
+    {
+        if (record.type == CTEST_EVENT_TEST_START)
+        {
+            ASSERT_STR(text.cases[index].suite_name.c_str(), record.suite_name.c_str());
+            ASSERT_STR(text.cases[index].test_name.c_str(), record.test_name.c_str());
+        }
+        else if (record.type == CTEST_EVENT_TEST_END)
+        {
+            ASSERT_EQUAL(
+                text.cases[index].return_status == parser::TestStatus_FAILED,
+                record.status == CTEST_STATUS_FAILED
+            );
+            ++index;
+        }
+    }
+
+    ASSERT_EQUAL(35, index);
+}
+
+
+CTEST(events, assertion_location)
+{
+    cli::Options options;
+    options.environment = {"CTEST_EVENT_FD=3"};
+    options.capture_fd = 3;
+
+    auto const raw = cli::execute({pather::make_absolute("mytests"), "memtest", "test2"}, options);
+    auto const records = events::decode(raw.captured);
+
+    std::vector<ctest_event_type> types;
+
+    for (auto const& record : records)
+    {
+        types.push_back(record.type);
+    }
+
+    std::vector<ctest_event_type> const expected {
+        CTEST_EVENT_TEST_START,
+        CTEST_EVENT_LOG,
+        CTEST_EVENT_LOG,
+        CTEST_EVENT_ASSERT,
+        CTEST_EVENT_TEST_END,
+        CTEST_EVENT_SUMMARY,
+    };
+    ASSERT_TRUE(expected == types);
+
+    auto const& failure = records[3];
+    ASSERT_STRSTR(failure.file.c_str(), "mytests.cpp");
+    ASSERT_TRUE(failure.line > 0);
+    ASSERT_STRSTR(failure.message.c_str(), "shouldn't come here");
+    ASSERT_STRSTR(records[2].message.c_str(), "buffer=");
+    ASSERT_EQUAL(CTEST_STATUS_FAILED, records[4].status);
+}
+
+
+CTEST(events, disabled_by_default)
+{
+    cli::Options options;
+    options.capture_fd = 3;
+
+    auto const raw = cli::execute({pather::make_absolute("single")}, options);
+
+    ASSERT_EQUAL(cli::ExitCode_SUCCESS, raw.exit_code);
+    ASSERT_TRUE(raw.captured.empty());
+}
+
+
+CTEST(async, run_concurrently)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("async"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_EQUAL(9, cases.size());
+    ASSERT_EQUAL(6, results.number_ok);
+    ASSERT_EQUAL(3, results.number_failed);
+
+    // The three 300 ms timers overlap instead of adding up
+    ASSERT_TRUE(raw.wall_time < std::chrono::milliseconds(800));
+
+    ASSERT_STR("before", cases[0].test_name.c_str());
+    ASSERT_STR("after", cases[8].test_name.c_str());
+
+    for (auto const& test : cases)
+    {
+        auto const expected = test.suite_name == "failures" ? parser::TestStatus_FAILED : parser::TestStatus_OK;
+        ASSERT_EQUAL(expected, test.return_status);
+    }
+}
+
+
+CTEST(async, assertions_report_per_test)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("async failures"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_EQUAL(3, cases.size());
+
+    ASSERT_EQUAL(2, cases[0].messages.size());
+    ASSERT_STR("before the wait", cases[0].messages[0].text.c_str());
+    ASSERT_STRSTR(cases[0].messages[1].text.c_str(), "assertion failed, 1 == 2");
+
+    ASSERT_EQUAL(1, cases[1].messages.size());
+    ASSERT_STRSTR(cases[1].messages[0].text.c_str(), "assertion failed, 1 == 0");
+
+    ASSERT_EQUAL(1, cases[2].messages.size());
+    ASSERT_STR("unhandled exception: boom", cases[2].messages[0].text.c_str());
+}
+
+
+CTEST(order, seed_replays_the_same_order)
+{
+    auto const shuffled = parser::parse_std_out(cli::execute_command(pather::make_absolute("mytests --seed=42")).std_out);
+    auto const replayed = parser::parse_std_out(cli::execute_command(pather::make_absolute("mytests --seed=42")).std_out);
+    auto const ordered = parser::parse_std_out(cli::execute_command(pather::make_absolute("mytests")).std_out);
+
+    ASSERT_TRUE(shuffled.shuffled);
+    ASSERT_EQUAL(42, shuffled.seed);
+    ASSERT_FALSE(ordered.shuffled);
+    ASSERT_EQUAL(ordered.cases.size(), shuffled.cases.size());
+    ASSERT_EQUAL(ordered.number_failed, shuffled.number_failed);
+
+    auto const names = [](parser::TestResults const& results)
+    {
+        std::vector<std::string> output;
+
+        for (auto const& test : results.cases)
+        {
+            output.push_back(test.suite_name + ":" + test.test_name);
+        }
+
+        return output;
+    };
+
+    ASSERT_TRUE(names(shuffled) == names(replayed));
+    ASSERT_TRUE(names(shuffled) != names(ordered));
+
+    auto sorted = names(shuffled);
+    auto expected = names(ordered);
+    std::sort(sorted.begin(), sorted.end());
+    std::sort(expected.begin(), expected.end());
+    ASSERT_TRUE(sorted == expected);
+}
+
+
+CTEST(order, shuffle_picks_a_seed)
+{
+    auto const results = parser::parse_std_out(cli::execute_command(pather::make_absolute("order --shuffle")).std_out);
+
+    ASSERT_TRUE(results.finished);
+    ASSERT_TRUE(results.shuffled);
+    ASSERT_EQUAL(9, results.cases.size());
+}
+
+
+CTEST(order, unknown_option)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("order --shufle"));
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_STR("unknown option '--shufle'\n", raw.std_err.c_str());
+    ASSERT_TRUE(raw.std_out.empty());
+}
+
+
+CTEST(order, bisect_finds_the_polluter)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("order --bisect-order"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_EQUAL(9, results.cases.size());
+    ASSERT_EQUAL(3, results.number_failed);
+    ASSERT_STRSTR(raw.std_out.c_str(), "BISECT: order:victim fails when run after order:polluter\n");
+    ASSERT_STRSTR(raw.std_out.c_str(), "BISECT: order:broken fails on its own\n");
+    ASSERT_STRSTR(raw.std_out.c_str(), "BISECT: order:pair_victim fails when run after all of order:pair_first order:pair_second\n");
+}
+
+
+CTEST(changes, list_records_locations)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("order --list"));
+
+    ASSERT_EQUAL(cli::ExitCode_SUCCESS, raw.exit_code);
+    ASSERT_STRSTR(raw.std_out.c_str(), "order:first ");
+    ASSERT_STRSTR(raw.std_out.c_str(), "order.cpp:14\n");
+    ASSERT_STRSTR(raw.std_out.c_str(), "order:broken ");
+    ASSERT_STRSTR(raw.std_out.c_str(), "order.cpp:26\n");
+    ASSERT_EQUAL(9, std::count(raw.std_out.begin(), raw.std_out.end(), '\n'));
+}
+
+
+CTEST(changes, changed_files)
+{
+    auto const unrelated = parser::parse_std_out(
+        cli::execute_command(pather::make_absolute("order --changed-since=src/other.c,main.cpp")).std_out
+    );
+    auto const changed = parser::parse_std_out(
+        cli::execute_command(pather::make_absolute("order --changed-since=src/other.c,tests/order.cpp")).std_out
+    );
+
+    ASSERT_TRUE(unrelated.finished);
+    ASSERT_EQUAL(0, unrelated.cases.size());
+    ASSERT_EQUAL(9, changed.cases.size());
+
+    auto const empty = cli::execute_command(pather::make_absolute("order --changed-since="));
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, empty.exit_code);
+    ASSERT_STR("invalid option '--changed-since='\n", empty.std_err.c_str());
+}
+
+
+CTEST(changes, coverage_map)
+{
+    auto const directory = pather::make_temporary_directory("coverage");
+    ASSERT_FALSE(directory.empty());
+    auto const map = directory + "/order.map";
+    std::ofstream{map} << "order:third\tsrc/state.c\norder:first\tinclude/shared.h\n"
+                           "order:victim\tinclude/shared.h\norder:victim\tsrc/state.c\n";
+
+    auto const raw = cli::execute_command(
+        pather::make_absolute("order --coverage-map=" + map + " --changed-since=src/state.c")
+    );
+    auto const results = parser::parse_std_out(raw.std_out);
+    std::filesystem::remove_all(directory);
+
+    ASSERT_EQUAL(2, results.cases.size());
+    ASSERT_STR("victim", results.cases[0].test_name.c_str());
+    ASSERT_STR("third", results.cases[1].test_name.c_str());
+
+    auto const missing = cli::execute_command(pather::make_absolute("order --coverage-map=missing.map"));
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, missing.exit_code);
+    ASSERT_STR("cannot open coverage map 'missing.map'\n", missing.std_err.c_str());
+}
+
+
+CTEST(cache, skips_unchanged_passes)
+{
+    // The inputs and the caches are relative to the working directory of the helper
+    auto const directory = pather::make_temporary_directory("cache");
+    ASSERT_FALSE(directory.empty());
+    std::ofstream{directory + "/cache_input.txt"} << "1";
+
+    cli::Options options;
+    options.environment = {"CTEST_CACHE_DIR=cache"};
+    options.directory = directory;
+    auto const statuses = [&options](std::string const& arguments)
+    {
+        auto const results = parser::parse_std_out(
+            cli::execute_command(pather::make_absolute("cached" + arguments), options).std_out
+        );
+        std::vector<parser::TestStatus> output;
+
+        for (auto const& test : results.cases)
+        {
+            output.push_back(test.return_status);
+        }
+
+        return output;
+    };
+    using Statuses = std::vector<parser::TestStatus>;
+
+    auto const first = statuses("");
+    auto const second = statuses("");
+    std::ofstream{directory + "/cache_input.txt"} << "2";
+    auto const changed = statuses("");
+    auto const forced = statuses(" --no-cache");
+    auto const other_directory = statuses(" --cache-dir=cache_other");
+
+    std::filesystem::remove_all(directory);
+
+    ASSERT_TRUE((first == Statuses{parser::TestStatus_OK, parser::TestStatus_OK, parser::TestStatus_FAILED}));
+    ASSERT_TRUE((second == Statuses{parser::TestStatus_CACHED, parser::TestStatus_CACHED, parser::TestStatus_FAILED}));
+    ASSERT_TRUE((changed == Statuses{parser::TestStatus_CACHED, parser::TestStatus_OK, parser::TestStatus_FAILED}));
+    ASSERT_TRUE((forced == Statuses{parser::TestStatus_OK, parser::TestStatus_OK, parser::TestStatus_FAILED}));
+    ASSERT_TRUE((other_directory == forced));
+}
+
+
+CTEST(trace, phases_and_scopes)
+{
+    auto const directory = pather::make_temporary_directory("trace");
+    ASSERT_FALSE(directory.empty());
+    auto const path = directory + "/trace.json";
+
+    auto const raw = cli::execute_command(pather::make_absolute("trace --trace=" + path));
+    std::ifstream file {path};
+    std::string const trace {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    std::filesystem::remove_all(directory);
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_STRSTR(trace.c_str(), "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":0},\"traceEvents\":[");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"runner\",\"name\":\"discover\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"runner\",\"name\":\"filter\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"test\",\"name\":\"traced:with_fixture\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"phase\",\"name\":\"setup\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"phase\",\"name\":\"run\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"phase\",\"name\":\"teardown\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"phase\",\"name\":\"report\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"scope\",\"name\":\"outer \\\"scope\\\"\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"scope\",\"name\":\"inner\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"scope\",\"name\":\"left by an assertion\"");
+    ASSERT_STRSTR(trace.c_str(), "\"name\":\"thread_name\",\"args\":{\"name\":\"tests\"}}\n]}\n");
+}
+
+
+CTEST(trace, merges_the_spans_of_jobs)
+{
+    auto const directory = pather::make_temporary_directory("trace");
+    ASSERT_FALSE(directory.empty());
+    auto const path = directory + "/trace.json";
+
+    auto const raw = cli::execute_command(pather::make_absolute("trace --jobs=2 --trace=" + path));
+    std::ifstream file {path};
+    std::string const trace {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    std::filesystem::remove_all(directory);
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    // Each test span is recorded once, by the parent, on the track of its job
+    ASSERT_STRSTR(trace.c_str(), "\"tid\":1,\"cat\":\"test\",\"name\":\"traced:with_fixture\"");
+    ASSERT_EQUAL(std::string::npos, trace.find("\"tid\":0,\"cat\":\"test\""));
+    ASSERT_STRSTR(trace.c_str(), "\"tid\":1,\"cat\":\"phase\",\"name\":\"setup\"");
+    ASSERT_STRSTR(trace.c_str(), "\"tid\":1,\"cat\":\"phase\",\"name\":\"report\"");
+    ASSERT_STRSTR(trace.c_str(), "\"tid\":1,\"cat\":\"scope\",\"name\":\"inner\"");
+    ASSERT_STRSTR(trace.c_str(), "\"cat\":\"scope\",\"name\":\"left by an assertion\"");
+}
+
+
+CTEST(trace, disabled_by_default)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("trace"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(2, results.cases.size());
+    ASSERT_TRUE(raw.std_err.empty());
+}
+
+
+CTEST(flaky, retries_mark_flaky)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("flaky --retries=2 flaky every_other"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(cli::ExitCode_SUCCESS, raw.exit_code);
+    ASSERT_EQUAL(1, results.cases.size());
+    ASSERT_EQUAL(parser::TestStatus_FLAKY, results.cases[0].return_status);
+    ASSERT_EQUAL(1, results.number_ok);
+    ASSERT_EQUAL(1, results.number_flaky);
+    ASSERT_EQUAL(1, results.cases[0].messages.size());
+    ASSERT_STRSTR(raw.std_out.c_str(), "  FLAKY: passed on attempt 2 of 3\n");
+}
+
+
+CTEST(flaky, repeat_reports_pass_rates)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("flaky --repeat=4 flaky"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(12, results.cases.size());
+    ASSERT_EQUAL(12, results.number_total);
+    ASSERT_STRSTR(raw.std_out.c_str(), "ITERATION 4/4\n");
+    ASSERT_STRSTR(raw.std_out.c_str(), "STATS flaky:every_other 2/4 passed (50.00%), ");
+    ASSERT_STRSTR(raw.std_out.c_str(), "STATS flaky:third 3/4 passed (75.00%), ");
+    ASSERT_STRSTR(raw.std_out.c_str(), "STATS flaky:steady 4/4 passed (100.00%), ");
+}
+
+
+CTEST(flaky, until_fail_stops_at_the_failure)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("flaky --until-fail flaky third"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_EQUAL(3, results.cases.size());
+    ASSERT_EQUAL(parser::TestStatus_FAILED, results.cases[2].return_status);
+    ASSERT_STRSTR(raw.std_out.c_str(), "ITERATION 3\n");
+    ASSERT_NOT_STRSTR(raw.std_out.c_str(), "ITERATION 4\n");
+    ASSERT_STRSTR(raw.std_out.c_str(), "STATS flaky:third 2/3 passed");
+}
+
+
+CTEST(threads, failures_stay_on_their_thread)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("threads"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_EQUAL(5, cases.size());
+    ASSERT_EQUAL(3, results.number_ok);
+    ASSERT_EQUAL(2, results.number_failed);
+    ASSERT_EQUAL(parser::TestStatus_OK, cases[1].return_status);
+    ASSERT_EQUAL(parser::TestStatus_OK, cases[4].return_status);
+
+    ASSERT_EQUAL(1, cases[0].messages.size());
+    ASSERT_STRSTR(cases[0].messages[0].text.c_str(), "thread times 0: ");
+    ASSERT_STRSTR(cases[0].messages[0].text.c_str(), ", 3: ");
+
+    ASSERT_EQUAL(parser::TestStatus_FAILED, cases[2].return_status);
+    ASSERT_EQUAL(3, cases[2].messages.size());
+    ASSERT_STRSTR(cases[2].messages[0].text.c_str(), "[thread 2] ");
+    ASSERT_STRSTR(cases[2].messages[0].text.c_str(), "assertion failed, 2 != 2");
+    ASSERT_STR("1 of 4 threads failed", cases[2].messages[2].text.c_str());
+
+    // Each thread logs, then fails, in whatever order they run
+    ASSERT_EQUAL(parser::TestStatus_FAILED, cases[3].return_status);
+    ASSERT_EQUAL(8, cases[3].messages.size());
+    ASSERT_STR("3 of 3 threads failed", cases[3].messages[7].text.c_str());
+    ASSERT_NOT_STRSTR(raw.std_out.c_str(), "never printed");
+}
+
+
+CTEST(golden, compare_and_update)
+{
+    // The golden files are relative to the working directory of the helper
+    auto const directory = pather::make_temporary_directory("golden");
+    ASSERT_FALSE(directory.empty());
+    std::filesystem::create_directory(directory + "/golden_files");
+    std::ofstream{directory + "/golden_files/hello.txt"} << "hello\n";
+    std::ofstream{directory + "/golden_files/differs.txt"} << "hello\n";
+    std::ofstream{directory + "/golden_files/empty.txt"};
+
+    cli::Options options;
+    options.directory = directory;
+    auto const read = [&directory](char const* path)
+    {
+        std::ifstream file {directory + "/" + path};
+
+        return std::string{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    };
+
+    auto const raw = cli::execute_command(pather::make_absolute("golden"), options);
+    auto const compared = parser::parse_std_out(raw.std_out);
+    auto const actual = read("golden_files/differs.txt.actual");
+    auto const missing_actual = read("golden_files/missing.txt.actual");
+
+    auto const update = cli::execute_command(pather::make_absolute("golden --update-golden"), options);
+    auto const updated = parser::parse_std_out(update.std_out);
+    auto const differs = read("golden_files/differs.txt");
+    auto const missing = read("golden_files/missing.txt");
+
+    auto const again = parser::parse_std_out(cli::execute_command(pather::make_absolute("golden"), options).std_out);
+
+    std::filesystem::remove_all(directory);
+
+    ASSERT_EQUAL(5, compared.cases.size());
+    ASSERT_EQUAL(3, compared.number_ok);
+    ASSERT_EQUAL(parser::TestStatus_FAILED, compared.cases[2].return_status);
+    ASSERT_EQUAL(1, compared.cases[2].messages.size());
+    ASSERT_STRSTR(
+        compared.cases[2].messages[0].text.c_str(),
+        "output differs from golden_files/differs.txt at offset 4 (expected 6 bytes, got 6), the output is in golden_files/differs.txt.actual"
+    );
+    ASSERT_STR("hellO\n", actual.c_str());
+    ASSERT_EQUAL(parser::TestStatus_FAILED, compared.cases[3].return_status);
+    ASSERT_EQUAL(1, compared.cases[3].messages.size());
+    ASSERT_STRSTR(compared.cases[3].messages[0].text.c_str(), "golden file golden_files/missing.txt is missing");
+    ASSERT_STR("new\n", missing_actual.c_str());
+
+    ASSERT_EQUAL(cli::ExitCode_SUCCESS, update.exit_code);
+    ASSERT_EQUAL(5, updated.number_ok);
+    ASSERT_EQUAL(5, updated.cases.size());
+    ASSERT_EQUAL(1, updated.cases[2].messages.size());
+    ASSERT_STR("updated golden file golden_files/differs.txt", updated.cases[2].messages[0].text.c_str());
+    ASSERT_STR("hellO\n", differs.c_str());
+    ASSERT_STR("new\n", missing.c_str());
+
+    ASSERT_EQUAL(5, again.number_ok);
+}
+
+
+CTEST(rusage, deltas_and_ceilings)
+{
+    cli::Options options;
+    options.environment = {"CTEST_EVENT_FD=3"};
+    options.capture_fd = 3;
+
+    auto const raw = cli::execute({pather::make_absolute("rusage"), "--rusage"}, options);
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const records = events::decode(raw.captured);
+    std::vector<events::Event> usages;
+
+    for (auto const& record : records)
+    {
+        if (record.type == CTEST_EVENT_RUSAGE)
+        {
+            usages.push_back(record);
+        }
+    }
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_EQUAL(3, results.cases.size());
+    ASSERT_EQUAL(parser::TestStatus_OK, results.cases[0].return_status);
+    ASSERT_EQUAL(parser::TestStatus_FAILED, results.cases[1].return_status);
+    ASSERT_STRSTR(results.cases[1].messages[0].text.c_str(), "peak RSS grew by ");
+    ASSERT_STRSTR(results.cases[1].messages[0].text.c_str(), " KB, more than 16384 KB");
+    ASSERT_EQUAL(parser::TestStatus_OK, results.cases[2].return_status);
+    ASSERT_STRSTR(raw.std_out.c_str(), "[OK]\n  RUSAGE: max rss +");
+    ASSERT_STRSTR(raw.std_out.c_str(), " involuntary switches, ");
+
+    ASSERT_EQUAL(3, usages.size());
+    ASSERT_TRUE(usages[1].max_rss_delta >= 60 * 1024);
+    ASSERT_TRUE(usages[1].minor_faults > 0);
+
+    auto const quiet = cli::execute_command(pather::make_absolute("rusage"));
+
+    ASSERT_EQUAL(std::string::npos, quiet.std_out.find("RUSAGE"));
+}
+
+
+CTEST(depends, ordered_and_skipped)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("depends"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_EQUAL(9, cases.size());
+    ASSERT_STR("prerequisite", cases[0].test_name.c_str());
+    ASSERT_STR("uses_prerequisite", cases[1].test_name.c_str());
+    ASSERT_EQUAL(parser::TestStatus_OK, cases[1].return_status);
+    ASSERT_EQUAL(parser::TestStatus_FAILED, cases[2].return_status);
+    ASSERT_STR("needs_broken", cases[3].test_name.c_str());
+    ASSERT_EQUAL(parser::TestStatus_SKIPPED, cases[3].return_status);
+    ASSERT_STR("transitively", cases[4].test_name.c_str());
+    ASSERT_EQUAL(parser::TestStatus_SKIPPED, cases[4].return_status);
+    ASSERT_STRSTR(raw.std_out.c_str(), "TEST 5/9 depends:transitively\n[SKIPPED: dependency failed]\n");
+    ASSERT_EQUAL(2, results.number_skipped);
+}
+
+
+CTEST(depends, selected_dependencies_run)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("depends depends uses"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(cli::ExitCode_SUCCESS, raw.exit_code);
+    ASSERT_EQUAL(2, results.cases.size());
+    ASSERT_STR("prerequisite", results.cases[0].test_name.c_str());
+    ASSERT_STR("uses_prerequisite", results.cases[1].test_name.c_str());
+}
+
+
+CTEST(depends, cycles_are_rejected)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("cycle"));
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_STR("", raw.std_out.c_str());
+    ASSERT_STR("dependency cycle: cycle:a -> cycle:b -> cycle:c -> cycle:a\n", raw.std_err.c_str());
+}
+
+
+CTEST(depends, jobs_match_a_serial_run)
+{
+    auto const serial = cli::execute_command(pather::make_absolute("depends"));
+    auto const parallel = cli::execute_command(pather::make_absolute("depends --jobs=4"));
+    auto const serial_results = parser::parse_std_out(serial.std_out);
+    auto const parallel_results = parser::parse_std_out(parallel.std_out);
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, parallel.exit_code);
+    ASSERT_EQUAL(serial_results.cases.size(), parallel_results.cases.size());
+
+    for (std::size_t index = 0; index < serial_results.cases.size(); ++index)
+    {
+        ASSERT_STR(serial_results.cases[index].test_name.c_str(), parallel_results.cases[index].test_name.c_str());
+        ASSERT_EQUAL(serial_results.cases[index].return_status, parallel_results.cases[index].return_status);
+    }
+
+    // The 4 slow:* tests sleep 100 ms each
+    ASSERT_TRUE(serial.wall_time >= std::chrono::milliseconds(400));
+    ASSERT_TRUE(parallel.wall_time < std::chrono::milliseconds(300));
+}
+
+
+CTEST(depends, jobs_survive_a_crash)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("crash --jobs=2"));
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_TRUE(results.finished);
+    ASSERT_EQUAL(3, results.cases.size());
+    ASSERT_EQUAL(parser::TestStatus_SEGFAULT, results.cases[1].return_status);
+    ASSERT_EQUAL(parser::TestStatus_OK, results.cases[2].return_status);
+    ASSERT_STRSTR(raw.std_out.c_str(), "  ERR: killed by signal 11\n");
+}
+
+
+CTEST(fixtures, pooled_and_reset)
+{
+    for (auto const* arguments : {"", " --repeat=3", " --jobs=2", " --shuffle"})
+    {
+        auto const raw = cli::execute_command(pather::make_absolute("fixtures") + arguments);
+        auto const results = parser::parse_std_out(raw.std_out);
+
+        ASSERT_EQUAL(cli::ExitCode_SUCCESS, raw.exit_code);
+        ASSERT_TRUE(results.finished);
+        ASSERT_EQUAL(0, results.number_failed);
+        ASSERT_TRUE(results.number_ok >= 4);
+    }
+}
+
+
+CTEST(tags, selected_by_tag)
+{
+    auto const names = [](std::string const& arguments)
+    {
+        auto const raw = cli::execute_command(pather::make_absolute("tags") + arguments);
+        std::string output;
+
+        for (auto const& test : parser::parse_std_out(raw.std_out).cases)
+        {
+            output += test.suite_name + ":" + test.test_name + " ";
+        }
+
+        return output;
+    };
+
+    ASSERT_STR("tags:fast_io tags:fast tags:untagged tags_fixture:slow ", names("").c_str());
+    ASSERT_STR("tags:fast_io tags:fast ", names(" --tags=fast").c_str());
+    ASSERT_STR("tags:fast ", names(" --tags=fast,-io").c_str());
+    ASSERT_STR("tags:fast tags:untagged tags_fixture:slow ", names(" --tags=-io").c_str());
+    ASSERT_STR("tags:fast_io tags_fixture:slow ", names(" --tags=io,slow").c_str());
+    ASSERT_STR("", names(" --tags=missing").c_str());
+
+    auto const missing = cli::execute_command(pather::make_absolute("tags --tags=missing"));
+
+    ASSERT_EQUAL(cli::ExitCode_SUCCESS, missing.exit_code);
+    ASSERT_STRSTR(missing.std_err.c_str(), "no test is tagged 'missing'");
+
+    auto const list = cli::execute_command(pather::make_absolute("tags --list"));
+
+    ASSERT_STRSTR(list.std_out.c_str(), "tags:fast_io ");
+    ASSERT_STRSTR(list.std_out.c_str(), "tags.cpp:7 fast, io\n");
+    ASSERT_STRSTR(list.std_out.c_str(), "tags.cpp:11\n");
+
+    cli::Options options;
+    options.environment = {"CTEST_EVENT_FD=3"};
+    options.capture_fd = 3;
+
+    auto const raw = cli::execute({pather::make_absolute("tags"), "--tags=slow"}, options);
+    auto const records = events::decode(raw.captured);
+
+    ASSERT_EQUAL(CTEST_EVENT_TEST_START, records[0].type);
+    ASSERT_STR("slow", records[0].test_name.c_str());
+    ASSERT_STR("slow", records[0].tags.c_str());
+}
+
+
+CTEST(watch, reruns_on_changes)
+{
+    // A copy, so that it can be "rebuilt"
+    auto const root = std::filesystem::path{pather::CURRENT_DIRECTORY} / "watch_files";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "bin");
+    std::filesystem::create_directories(root / "src");
+    auto const executable = root / "bin" / "watch";
+    std::filesystem::copy_file(pather::make_absolute("watch"), executable);
+
+    std::string output;
+    std::size_t waits {0};
+    pid_t watcher {0};
+    cli::Options options;
+    options.environment = {"WATCH_FLAG=" + (root / "src" / "flag").string(), "CTEST_EVENT_FD=3"};
+    options.capture_fd = 3;
+    options.on_start = [&](pid_t pid) { watcher = pid; };
+    options.on_std_out = [&](std::string_view chunk)
+    {
+        output += chunk;
+        std::size_t count {0};
+
+        for (auto position = output.find("WATCH: waiting"); position != std::string::npos; position = output.find("WATCH: waiting", position + 1))
+        {
+            ++count;
+        }
+
+        for (; waits < count; ++waits)
+        {
+            if (waits == 0)
+            {
+                // A source change, which makes watch:flips fail
+                std::ofstream{root / "src" / "flag"};
+            }
+            else if (waits == 1)
+            {
+                // A rebuild, which changes nothing
+                std::filesystem::copy_file(pather::make_absolute("watch"), root / "bin" / "watch.new");
+                std::filesystem::rename(root / "bin" / "watch.new", executable);
+            }
+            else
+            {
+                // It runs until interrupted
+                kill(watcher, SIGTERM);
+            }
+        }
+    };
+
+    auto const raw = cli::execute({executable.string(), "--watch", "--watch-dir=" + (root / "src").string()}, options);
+    std::filesystem::remove_all(root);
+
+    std::vector<std::string> runs;
+
+    for (std::size_t start = 0, end; (end = output.find("WATCH: waiting", start)) != std::string::npos; start = end + 1)
+    {
+        runs.push_back(output.substr(start, end - start));
+    }
+
+    ASSERT_EQUAL(cli::ExitCode_SIGNALED, raw.exit_code);
+    ASSERT_EQUAL(SIGTERM, raw.signal);
+    ASSERT_EQUAL(3, runs.size());
+
+    // Everything is new in the first run
+    ASSERT_STRSTR(runs[0].c_str(), "TEST 1/3 watch:stable\n[OK]");
+    ASSERT_STRSTR(runs[0].c_str(), "TEST 2/3 watch:flips\n[OK]");
+    ASSERT_STRSTR(runs[0].c_str(), "TEST 3/3 watch:always_fails\n[FAIL]");
+
+    // The test that failed runs first, and only the changed result is shown
+    ASSERT_STRSTR(runs[1].c_str(), "TEST 3/3 watch:flips\n[FAIL]");
+    ASSERT_EQUAL(std::string::npos, runs[1].find("watch:stable"));
+    ASSERT_EQUAL(std::string::npos, runs[1].find("watch:always_fails"));
+    ASSERT_STRSTR(runs[1].c_str(), "WATCH: 2 unchanged results not shown");
+
+    ASSERT_EQUAL(std::string::npos, runs[2].find("TEST "));
+    ASSERT_STRSTR(runs[2].c_str(), "WATCH: 3 unchanged results not shown");
+    ASSERT_STRSTR(runs[2].c_str(), "RESULTS: 3 tests (1 ok, 2 failed, 0 skipped)");
+
+    std::vector<std::string> second_run;
+    int summaries {0};
+
+    for (auto const& event : events::decode(raw.captured))
+    {
+        summaries += event.type == CTEST_EVENT_SUMMARY;
+
+        if (summaries == 1 && event.type == CTEST_EVENT_TEST_START)
+        {
+            second_run.push_back(event.test_name);
+        }
+    }
+
+    ASSERT_EQUAL(3, summaries);
+    ASSERT_EQUAL(3, second_run.size());
+    ASSERT_STR("always_fails", second_run[0].c_str());
+}
+
+
+CTEST(library, runs_like_the_header)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("library"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_TRUE(results.finished);
+    ASSERT_EQUAL(6, cases.size());
+    ASSERT_EQUAL(4, results.number_ok);
+    ASSERT_EQUAL(1, results.number_failed);
+    ASSERT_EQUAL(1, results.number_skipped);
+    ASSERT_EQUAL(parser::TestStatus_OK, cases[1].return_status);
+    ASSERT_EQUAL(parser::TestStatus_OK, cases[2].return_status);
+    ASSERT_EQUAL(parser::TestStatus_FAILED, cases[3].return_status);
+    ASSERT_STRSTR(cases[3].messages[0].text.c_str(), "assertion failed, 'expected' == 'actual'");
+    ASSERT_EQUAL(parser::TestStatus_OK, cases[5].return_status);
+}
+
+
+CTEST(library, has_the_linux_options)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("library --capture=all --cpus=0"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_STR("", raw.std_err.c_str());
+    ASSERT_TRUE(results.finished);
+    ASSERT_EQUAL(6, cases.size());
+    ASSERT_EQUAL(1, cases[0].messages.size());
+    ASSERT_EQUAL(parser::MessageKind_OUT, cases[0].messages[0].kind);
+    ASSERT_STR("from the library", cases[0].messages[0].text.c_str());
+}
+
+
+CTEST(distributed, matches_a_local_run)
+{
+    auto const local = cli::execute_command(pather::make_absolute("depends"));
+    auto const path = pather::make_absolute("ctest_coordinator.sock");
+    auto const address = "unix:" + path;
+    auto const tests = parser::parse_std_out(local.std_out).cases.size();
+
+    std::thread workers;
+    cli::Options options;
+    options.on_start = [&](pid_t)
+    {
+        workers = std::thread{[&]
+        {
+            // A worker that takes a batch and goes away, so that its tests run elsewhere
+            sockaddr_un socket_address {};
+            socket_address.sun_family = AF_UNIX;
+            path.copy(socket_address.sun_path, sizeof(socket_address.sun_path) - 1);
+            int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+            for (int attempt = 0; attempt < 100; ++attempt)
+            {
+                if (connect(fd, reinterpret_cast<sockaddr*>(&socket_address), sizeof(socket_address)) == 0)
+                {
+                    // The magic number, and the size of the .ctest section: the tests and the anchor
+                    std::uint32_t const hello[2] = {0x63746573u, static_cast<std::uint32_t>(tests + 1)};
+                    std::uint32_t flags {0};
+                    std::uint32_t batch {0};
+
+                    if (write(fd, hello, sizeof(hello)) == sizeof(hello))
+                    {
+                        read(fd, &flags, sizeof(flags));
+                        read(fd, &batch, sizeof(batch));
+                    }
+
+                    ASSERT_TRUE(batch > 0);
+
+                    break;
+                }
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            close(fd);
+
+            std::thread second {[&] { cli::execute({pather::make_absolute("depends"), "--worker=" + address}); }};
+            auto const first = cli::execute({pather::make_absolute("depends"), "--worker=" + address});
+            second.join();
+
+            ASSERT_EQUAL(cli::ExitCode_SUCCESS, first.exit_code);
+        }};
+    };
+
+    auto const distributed = cli::execute({pather::make_absolute("depends"), "--coordinator=" + address}, options);
+    workers.join();
+
+    auto const expected = parser::parse_std_out(local.std_out);
+    auto const results = parser::parse_std_out(distributed.std_out);
+
+    ASSERT_EQUAL(local.exit_code, distributed.exit_code);
+    ASSERT_TRUE(results.finished);
+    ASSERT_EQUAL(expected.cases.size(), results.cases.size());
+    ASSERT_EQUAL(expected.number_ok, results.number_ok);
+    ASSERT_EQUAL(expected.number_failed, results.number_failed);
+    ASSERT_EQUAL(expected.number_skipped, results.number_skipped);
+
+    for (std::size_t index = 0; index < expected.cases.size(); ++index)
+    {
+        ASSERT_STR(expected.cases[index].suite_name.c_str(), results.cases[index].suite_name.c_str());
+        ASSERT_STR(expected.cases[index].test_name.c_str(), results.cases[index].test_name.c_str());
+        ASSERT_EQUAL(expected.cases[index].return_status, results.cases[index].return_status);
+        ASSERT_EQUAL(expected.cases[index].messages.size(), results.cases[index].messages.size());
+    }
+
+    ASSERT_FALSE(std::filesystem::exists(path));
+}
+
+
+CTEST(api, runs_twice_with_callbacks)
+{
+    for (auto const* jobs : {"1", "2"})
+    {
+        auto const raw = cli::execute({pather::make_absolute("api"), jobs});
+        // A --jobs child prints before its test is reported
+        auto const run = std::string{jobs[0] == '1' ? "start 1/2 api:passing\nprinted by the test\n" : "printed by the test\nstart 1/2 api:passing\n"}
+            + "end api:passing 0\n"
+              "start 2/2 api:failing\n"
+              "end api:failing 1\n";
+
+        ASSERT_EQUAL(cli::ExitCode_SUCCESS, raw.exit_code);
+        ASSERT_STR(
+            (
+                run + "run 1: error 0, 2 total, 1 ok, 1 failed, 0 skipped, 2 started, 2 ended, 2 timed\n"
+                + run + "run 2: error 0, 2 total, 1 ok, 1 failed, 0 skipped, 2 started, 2 ended, 2 timed\n"
+            ).c_str(),
+            raw.std_out.c_str()
+        );
+    }
+}
+
+CTEST(capture, shown_on_failure)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("capture --capture=failed"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_EQUAL(3, cases.size());
+    ASSERT_EQUAL(0, cases[0].messages.size());
+    ASSERT_STR("", raw.std_err.c_str());
+
+    auto const& failing = cases[1].messages;
+
+    ASSERT_EQUAL(6, failing.size());
+    ASSERT_EQUAL(parser::MessageKind_OUT, failing[2].kind);
+    ASSERT_STR("to stderr", failing[2].text.c_str());
+    ASSERT_STR("written", failing[3].text.c_str());
+    ASSERT_STR("to stdout", failing[4].text.c_str());
+    ASSERT_STR("unterminated", failing[5].text.c_str());
+}
+
+
+CTEST(capture, all_in_events_and_jobs)
+{
+    cli::Options options;
+    options.environment = {"CTEST_EVENT_FD=3"};
+    options.capture_fd = 3;
+
+    auto const raw = cli::execute({pather::make_absolute("capture"), "--capture=all", "--jobs=2"}, options);
+    auto const results = parser::parse_std_out(raw.std_out);
+    std::vector<std::string> outputs;
+
+    for (auto const& record : events::decode(raw.captured))
+    {
+        if (record.type == CTEST_EVENT_OUTPUT)
+        {
+            outputs.push_back(record.message);
+        }
+    }
+
+    ASSERT_EQUAL(1, results.cases[0].messages.size());
+    ASSERT_STR("quiet", results.cases[0].messages[0].text.c_str());
+    ASSERT_EQUAL(0, results.cases[2].messages.size());
+    ASSERT_EQUAL(2, outputs.size());
+    ASSERT_STR("quiet\n", outputs[0].c_str());
+    ASSERT_STR("to stderr\nwritten\nto stdout\nunterminated", outputs[1].c_str());
+}
+
+CTEST(complexity, fits_the_declared_model)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("complexity"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_EQUAL(3, cases.size());
+    ASSERT_STR("linear", cases[0].test_name.c_str());
+    ASSERT_EQUAL(parser::TestStatus_OK, cases[0].return_status);
+    ASSERT_STRSTR(cases[0].messages[0].text.c_str(), "best fit O(n), times n=256: ");
+    ASSERT_EQUAL(parser::TestStatus_FAILED, cases[1].return_status);
+    ASSERT_STRSTR(raw.std_out.c_str(), "complexity.cpp:22  expected O(n log n), the times fit O(n^2) best\n");
+    ASSERT_EQUAL(parser::TestStatus_FAILED, cases[2].return_status);
+    ASSERT_STRSTR(raw.std_out.c_str(), "  ERR: CTEST_COMPLEXITY needs at least 3 sizes to fit, it has 2\n");
+}
+
+
+CTEST(complexity, pinned_cold_and_noisy)
+{
+    // More jobs than CPUs can't give stable timings
+    auto const jobs = std::to_string(2 * std::max(1u, std::thread::hardware_concurrency()) + 1);
+    auto const raw = cli::execute({
+        pather::make_absolute("complexity"), "--cpus=0", "--cpu-cache=cold", "--jobs=" + jobs
+    });
+    auto const results = parser::parse_std_out(raw.std_out);
+
+    ASSERT_EQUAL(3, results.cases.size());
+    ASSERT_STRSTR(raw.std_out.c_str(), ", noisy: load ");
+    ASSERT_STRSTR(raw.std_out.c_str(), (" + " + jobs + " jobs on ").c_str());
+
+    // Tests which aren't timed don't check
+    ASSERT_NOT_STRSTR(cli::execute_command(pather::make_absolute("lazy") + " --jobs=" + jobs).std_out.c_str(), "noisy");
+
+    auto const invalid = cli::execute({pather::make_absolute("complexity"), "--cpus=1-0"});
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, invalid.exit_code);
+    ASSERT_STRSTR(invalid.std_err.c_str(), "invalid option '--cpus=1-0'");
+}
+
+CTEST(lazy, formatted_on_failure)
+{
+    auto const raw = cli::execute_command(pather::make_absolute("lazy"));
+    auto const results = parser::parse_std_out(raw.std_out);
+    auto const& cases = results.cases;
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_EQUAL(4, cases.size());
+    ASSERT_EQUAL(0, cases[0].messages.size());
+
+    // As printf would have formatted them when they were logged
+    ASSERT_EQUAL(5, cases[1].messages.size());
+    ASSERT_STR("-1    42 7  | -8 9 10 -11 12", cases[1].messages[0].text.c_str());
+    ASSERT_STR("1 0xff FF 10 z %", cases[1].messages[1].text.c_str());
+    ASSERT_STR("3.14 1.234e+03 0.5 2.500000", cases[1].messages[2].text.c_str());
+    ASSERT_STR("[before] [abc] [   r] [le  ] [wide]", cases[1].messages[3].text.c_str());
+    ASSERT_EQUAL(parser::MessageKind_ERR, cases[1].messages[4].kind);
+
+    auto const& overflow = cases[2].messages;
+    ASSERT_STRSTR(overflow.front().text.c_str(), " earlier messages were dropped, see CTEST_LAZY_LOG_SIZE");
+    ASSERT_STR("message 999", overflow[overflow.size() - 2].text.c_str());
+
+    // CTEST_LAZY_LOG_SIZE is 1024, 64 values of 16 bytes, 3 of them for the header, the precision and the text
+    ASSERT_EQUAL(2, cases[3].messages.size());
+    ASSERT_STR(std::string(61 * 16 - 1, 'x').c_str(), cases[3].messages[0].text.c_str());
+}
+
+
+CTEST(lazy, verbose_and_events)
+{
+    auto const verbose = parser::parse_std_out(
+        cli::execute_command(pather::make_absolute("lazy --verbose lazy passing")).std_out
+    );
+
+    ASSERT_EQUAL(3, verbose.cases[0].messages.size());
+    ASSERT_STR("step 2", verbose.cases[0].messages[2].text.c_str());
+
+    cli::Options options;
+    options.environment = {"CTEST_EVENT_FD=3"};
+    options.capture_fd = 3;
+
+    auto const raw = cli::execute({pather::make_absolute("lazy"), "lazy", "passing"}, options);
+    std::vector<std::string> logs;
+
+    for (auto const& record : events::decode(raw.captured))
+    {
+        if (record.type == CTEST_EVENT_LOG)
+        {
+            logs.push_back(record.message);
+        }
+    }
+
+    ASSERT_EQUAL(0, parser::parse_std_out(raw.std_out).cases[0].messages.size());
+    ASSERT_EQUAL(3, logs.size());
+    ASSERT_STR("step 0", logs[0].c_str());
+}
+
+
+CTEST(profile, folded_stacks)
+{
+    auto const path = pather::make_absolute("profile.folded");
+    auto const raw = cli::execute({pather::make_absolute("profile"), "--profile=" + path});
+
+    std::ifstream file {path};
+    std::vector<std::string> lines;
+
+    for (std::string line; std::getline(file, line);)
+    {
+        lines.push_back(line);
+    }
+
+    std::filesystem::remove(path);
+
+    ASSERT_EQUAL(cli::ExitCode_BAD_EXIT, raw.exit_code);
+    ASSERT_FALSE(lines.empty());
+
+    unsigned long busy {0};
+
+    for (auto const& line : lines)
+    {
+        auto const count = std::stoul(line.substr(line.rfind(' ') + 1));
+        ASSERT_TRUE(count > 0);
+
+        // The failing test is profiled up to its failure
+        ASSERT_TRUE(line.rfind("profile;busy;", 0) == 0 || line.rfind("profile;fails;", 0) == 0);
+
+        if (line.rfind("profile;busy;", 0) == 0 && line.find("busy_caller") < line.find("busy_leaf"))
+        {
+            busy += count;
+        }
+    }
+
+    ASSERT_TRUE(busy > 0);
 }
 
 
@@ -0,0 +1,33 @@
+#include <stdio.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+// Tests which pass or fail depending on the order they run in
+
+static int polluted = 0;
+static int pair_polluted = 0;
+
+CTEST(order, first) { ASSERT_TRUE(1); }
+
+CTEST(order, pair_first) { pair_polluted |= 1; }
+
+CTEST(order, polluter) { polluted = 1; }
+
+CTEST(order, second) { ASSERT_TRUE(1); }
+
+CTEST(order, victim) { ASSERT_EQUAL(0, polluted); }
+
+CTEST(order, third) { ASSERT_TRUE(1); }
+
+CTEST(order, broken) { ASSERT_FAIL(); }
+
+CTEST(order, pair_second) { pair_polluted |= 2; }
+
+// Only fails after both pair_first and pair_second, which are in different halves of the tests before it
+CTEST(order, pair_victim) { ASSERT_NOT_EQUAL(3, pair_polluted); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -1,26 +1,41 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
-#include <regex>
-#include <sstream>  // std::stringstream
+#include <charconv>  // std::from_chars
+#include <cstring>  // std::memchr
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace parser {
 
-namespace details
-{
-    std::regex const TEST_REGEX {"TEST \\d+/\\d+ (\\w+):(\\w+)"};
-    std::regex const RESULTS_REGEX {
-        "RESULTS: (\\d+) tests \\((\\d+) ok, (\\d+) failed, (\\d+) skipped\\) ran in (\\d+\\.\\d+) ms"
-    };
-}
-
 enum TestStatus
 {
     TestStatus_FAILED,
     TestStatus_OK,
     TestStatus_SKIPPED,
+    TestStatus_SEGFAULT,
+    // A "TEST i/n" line was seen but no status line followed it (e.g. the
+    // binary was killed before it could report)
+    TestStatus_INCOMPLETE,
+    // Passed in an earlier run, with the same binary and inputs
+    TestStatus_CACHED,
+    // Failed, then passed when retried
+    TestStatus_FLAKY,
+};
+
+enum MessageKind
+{
+    MessageKind_ERR,
+    MessageKind_LOG,
+    // A line the test printed itself, shown with --capture
+    MessageKind_OUT,
+};
+
+struct Message
+{
+    MessageKind kind;
+    std::string text;
 };
 
 struct SingleTestCase
@@ -28,105 +43,357 @@ struct SingleTestCase
     std::string suite_name;
     std::string test_name;
     TestStatus return_status;
+    std::vector<Message> messages;
 };
 
 struct TestResults
 {
     std::vector<SingleTestCase> cases;
 
-    unsigned int number_ok;
-    unsigned int number_failed;
-    unsigned int number_skipped;
-    unsigned int number_total;
-    unsigned int total_time;
+    unsigned int number_ok {0};
+    unsigned int number_failed {0};
+    unsigned int number_skipped {0};
+    unsigned int number_total {0};
+    unsigned int number_flaky {0};  // Also counted in number_ok
+    double total_time {0.0};  // In milliseconds
+    unsigned long long seed {0};  // Only set if the tests were shuffled
+    bool shuffled {false};
+
+    // If the "RESULTS:" footer was seen
+    bool finished {false};
 };
 
-TestResults parse_std_out(std::string const text)
+namespace details
 {
-    std::stringstream stream(text);
-    std::string buffer;
-    std::vector<SingleTestCase> cases;
-    TestResults output;
-    std::string previous;
-    bool in_test {false};
+    // Remove every ANSI escape sequence ("\033[...m") from the start and end of `text`.
+    inline std::string_view strip_colors(std::string_view text)
+    {
+        while (text.size() > 1 && text[0] == '\033' && text[1] == '[')
+        {
+            auto const end = text.find('m');
+
+            if (end == std::string_view::npos)
+            {
+                break;
+            }
 
-    std::smatch matches;
+            text.remove_prefix(end + 1);
+        }
 
-    std::string suite_name;
-    std::string test_name;
-    TestStatus return_status;
+        while (!text.empty())
+        {
+            auto const start = text.rfind('\033');
 
-    unsigned int number_total;
-    unsigned int number_ok;
-    unsigned int number_failed;
-    unsigned int number_skipped;
-    unsigned int total_time;
+            if (start == std::string_view::npos || text.back() != 'm')
+            {
+                break;
+            }
 
-    // TODO: Replace with emplace_back
-    auto add_to_cases = [&suite_name, &test_name, &return_status, &cases](){
-        cases.push_back(SingleTestCase{suite_name, test_name, return_status});
-    };
+            text.remove_suffix(text.size() - start);
+        }
 
-    while(std::getline(stream, buffer, '\n'))
-    {
-        previous = buffer;
+        return text;
+    }
 
-        if (std::regex_search(buffer, matches, details::TEST_REGEX))
+    inline bool consume(std::string_view& text, std::string_view prefix)
+    {
+        if (text.substr(0, prefix.size()) != prefix)
         {
-            in_test = true;
-            suite_name = matches[1];
-            test_name = matches[2];
+            return false;
+        }
+
+        text.remove_prefix(prefix.size());
+
+        return true;
+    }
+
+    template <typename T>
+    bool consume_number(std::string_view& text, T& value)
+    {
+        auto const [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
 
-            continue;
+        if (error != std::errc{})
+        {
+            return false;
         }
 
-        if (in_test)
+        text.remove_prefix(static_cast<std::size_t>(end - text.data()));
+
+        return true;
+    }
+}
+
+// Parse ctest output incrementally, as it is read.
+//
+// Chunks may split lines at any byte. Complete lines are parsed in-place from
+// the given chunk and only the unterminated remainder of a chunk is copied,
+// so the cost is proportional to the input size regardless of the chunk size.
+//
+class StreamParser
+{
+public:
+    void feed(std::string_view chunk)
+    {
+        if (!m_partial.empty())
         {
-            if (buffer == "[OK]")
+            auto const* newline = static_cast<char const*>(std::memchr(chunk.data(), '\n', chunk.size()));
+
+            if (!newline)
             {
-                return_status = TestStatus_OK;
-                add_to_cases();
+                m_partial.append(chunk);
 
-                continue;
+                return;
             }
-            else if (buffer == "[FAILED]")
+
+            auto const size = static_cast<std::size_t>(newline - chunk.data());
+            m_partial.append(chunk.substr(0, size));
+            parse_line(m_partial);
+            m_partial.clear();
+            chunk.remove_prefix(size + 1);
+        }
+
+        while (!chunk.empty())
+        {
+            auto const* newline = static_cast<char const*>(std::memchr(chunk.data(), '\n', chunk.size()));
+
+            if (!newline)
             {
-                return_status = TestStatus_FAILED;
-                add_to_cases();
+                m_partial.assign(chunk);
 
-                continue;
+                return;
             }
-            else if (buffer == "[SKIPPED]")
-            {
-                return_status = TestStatus_SKIPPED;
-                add_to_cases();
 
-                continue;
+            auto const size = static_cast<std::size_t>(newline - chunk.data());
+            parse_line(chunk.substr(0, size));
+            chunk.remove_prefix(size + 1);
+        }
+    }
+
+    // Parse any unterminated last line. Call this once the input is exhausted.
+    TestResults const& finish()
+    {
+        if (!m_partial.empty())
+        {
+            parse_line(m_partial);
+            m_partial.clear();
+        }
+
+        return m_results;
+    }
+
+    TestResults const& results() const { return m_results; }
+
+    TestResults take() { return std::move(m_results); }
+
+private:
+    void parse_line(std::string_view line)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+
+        if (parse_test(line))
+        {
+            return;
+        }
+
+        line = details::strip_colors(line);
+
+        if (m_current && parse_status(line))
+        {
+            return;
+        }
+
+        if (m_current && parse_message(line))
+        {
+            return;
+        }
+
+        parse_results(line);
+    }
+
+    // "TEST 1/8 suite:name"
+    bool parse_test(std::string_view line)
+    {
+        unsigned int index = 0;
+        unsigned int total = 0;
+
+        if (
+            !details::consume(line, "TEST ")
+            || !details::consume_number(line, index)
+            || !details::consume(line, "/")
+            || !details::consume_number(line, total)
+            || !details::consume(line, " ")
+        )
+        {
+            return false;
+        }
+
+        auto const separator = line.find(':');
+
+        if (separator == std::string_view::npos)
+        {
+            return false;
+        }
+
+        m_results.cases.push_back(
+            SingleTestCase{
+                std::string{line.substr(0, separator)},
+                std::string{line.substr(separator + 1)},
+                TestStatus_INCOMPLETE,
+                {},
             }
+        );
+        m_current = true;
+
+        return true;
+    }
+
+    bool parse_status(std::string_view line)
+    {
+        TestStatus status;
+
+        if (line == "[OK]")
+        {
+            status = TestStatus_OK;
+        }
+        else if (line == "[FAIL]")
+        {
+            status = TestStatus_FAILED;
+        }
+        else if (line == "[SKIPPED]" || line == "[SKIPPED: dependency failed]")
+        {
+            status = TestStatus_SKIPPED;
+        }
+        else if (line == "[CACHED]")
+        {
+            status = TestStatus_CACHED;
+        }
+        else if (line == "[FLAKY]")
+        {
+            status = TestStatus_FLAKY;
+        }
+        else if (line.substr(0, 9) == "[SIGSEGV:")
+        {
+            status = TestStatus_SEGFAULT;
+        }
+        else
+        {
+            return false;
+        }
+
+        m_results.cases.back().return_status = status;
+
+        return true;
+    }
+
+    // "  ERR: mytests.cpp:4  expected 1, got 2"
+    bool parse_message(std::string_view line)
+    {
+        MessageKind kind;
+
+        if (details::consume(line, "  ERR: "))
+        {
+            kind = MessageKind_ERR;
         }
+        else if (details::consume(line, "  LOG: "))
+        {
+            kind = MessageKind_LOG;
+        }
+        else if (details::consume(line, "  OUT: "))
+        {
+            kind = MessageKind_OUT;
+        }
+        else
+        {
+            return false;
+        }
+
+        m_results.cases.back().messages.push_back(Message{kind, std::string{line}});
+
+        return true;
+    }
+
+    // "RESULTS: 2 tests (1 ok, 1 failed, 0 skipped) ran in 1.0 ms[, 1 flaky][, seed 42]"
+    bool parse_results(std::string_view line)
+    {
+        // Only stored once the whole line matched, a line that merely starts alike changes nothing
+        unsigned int number_total {0};
+        unsigned int number_ok {0};
+        unsigned int number_failed {0};
+        unsigned int number_skipped {0};
+        unsigned int number_flaky {0};
+        double total_time {0.0};
+        unsigned long long seed {0};
+        bool shuffled {false};
 
-        if (in_test && std::regex_search(buffer, matches, details::RESULTS_REGEX))
+        if (
+            !details::consume(line, "RESULTS: ")
+            || !details::consume_number(line, number_total)
+            || !details::consume(line, " tests (")
+            || !details::consume_number(line, number_ok)
+            || !details::consume(line, " ok, ")
+            || !details::consume_number(line, number_failed)
+            || !details::consume(line, " failed, ")
+            || !details::consume_number(line, number_skipped)
+            || !details::consume(line, " skipped) ran in ")
+            || !details::consume_number(line, total_time)
+        )
         {
-            number_total = std::stoi(matches[1]);
-            number_ok = std::stoi(matches[2]);
-            number_failed = std::stoi(matches[3]);
-            number_skipped = std::stoi(matches[4]);
-            total_time = std::stoi(matches[5]);
+            return false;
+        }
 
-            in_test = false;
+        details::consume(line, " ms");
 
-            output.cases = cases;
-            output.number_ok = number_ok;
-            output.number_failed = number_failed;
-            output.number_skipped = number_skipped;
-            output.number_total = number_total;
-            output.total_time = total_time;
+        std::string_view flaky = line;
 
-            break;
+        if (
+            details::consume(flaky, ", ")
+            && details::consume_number(flaky, number_flaky)
+            && details::consume(flaky, " flaky")
+        )
+        {
+            line = flaky;
         }
+        else
+        {
+            number_flaky = 0;
+        }
+
+        if (details::consume(line, ", seed "))
+        {
+            shuffled = details::consume_number(line, seed);
+        }
+
+        TestResults& output = m_results;
+
+        output.number_total = number_total;
+        output.number_ok = number_ok;
+        output.number_failed = number_failed;
+        output.number_skipped = number_skipped;
+        output.number_flaky = number_flaky;
+        output.total_time = total_time;
+        output.seed = seed;
+        output.shuffled = shuffled;
+        output.finished = true;
+        m_current = false;
+
+        return true;
     }
 
-    return output;
+    std::string m_partial;
+    TestResults m_results;
+    bool m_current {false};
+};
+
+inline TestResults parse_std_out(std::string_view text)
+{
+    StreamParser parser;
+    parser.feed(text);
+    parser.finish();
+
+    return parser.take();
 }
 
 }
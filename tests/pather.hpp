@@ -21,6 +21,7 @@ std::string get_current_directory()
 #else
 #include <unistd.h>
 #include <limits.h>
+#include <stdlib.h>
 
 char const PATH_SEPARATOR = '/';
 
@@ -40,6 +41,19 @@ std::string get_current_directory()
     return path.substr(0, path.find_last_of(PATH_SEPARATOR));
 }
 
+// Create a new, empty directory under TMPDIR, so that runs of the tests don't share their files
+std::string make_temporary_directory(std::string const name)
+{
+    char const* root = getenv("TMPDIR");
+    std::string path = std::string{root && root[0] ? root : "/tmp"} + PATH_SEPARATOR + "ctest_" + name + ".XXXXXX";
+
+    if (!mkdtemp(path.data())) {
+        return std::string{};
+    }
+
+    return path;
+}
+
 #endif
 
 std::string const CURRENT_DIRECTORY = get_current_directory();
@@ -0,0 +1,29 @@
+#include <stddef.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+// volatile, so that the compiler can't skip or fold the loop
+static volatile unsigned long profile_sink;
+
+__attribute__((noinline)) static void busy_leaf(unsigned long count) {
+    unsigned long i;
+    for (i = 0; i < count; i++) profile_sink = profile_sink + i;
+}
+
+__attribute__((noinline)) static void busy_caller(void) {
+    int i;
+    for (i = 0; i < 100; i++) busy_leaf(1000000);
+}
+
+CTEST(profile, busy) { busy_caller(); }
+
+CTEST(profile, fails) {
+    busy_leaf(20000000);
+    ASSERT_FAIL();
+}
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
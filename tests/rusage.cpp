@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+static void touch(size_t size) {
+    char* volatile buffer = (char*)malloc(size);
+    memset(buffer, 1, size);
+    free(buffer);
+}
+
+CTEST(rusage, small) { ASSERT_MAX_RSS_DELTA(4 * 1024); }
+
+CTEST(rusage, over_the_ceiling) {
+    touch(64 * 1024 * 1024);
+    ASSERT_MAX_RSS_DELTA(16 * 1024);
+}
+
+CTEST(rusage, under_the_ceiling) {
+    touch(8 * 1024 * 1024);
+    ASSERT_MAX_RSS_DELTA(256 * 1024);
+}
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
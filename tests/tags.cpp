@@ -0,0 +1,21 @@
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+CTEST_TAGGED(tags, fast_io, "fast, io") {}
+
+CTEST_TAGGED(tags, fast, "fast") {}
+
+CTEST(tags, untagged) {}
+
+CTEST_DATA(tags_fixture) {
+    int value;
+};
+
+CTEST2_TAGGED(tags_fixture, slow, "slow") {
+    ASSERT_EQUAL(0, data->value);
+}
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,32 @@
+#include <atomic>
+#include <stdio.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+#define CTEST_THREADS
+
+#include "ctest.h"
+
+static std::atomic<int> counter {0};
+
+CTEST_THREADED(threads, increment, 4) {
+    ASSERT_INTERVAL(0, 3, thread_index);
+    for (int i = 0; i < 10000; ++i) counter++;
+}
+
+CTEST(threads, all_increments_seen) { ASSERT_EQUAL(40000, counter.load()); }
+
+CTEST_THREADED(threads, one_fails, 4) {
+    ASSERT_NOT_EQUAL(2, thread_index);
+}
+
+CTEST_THREADED(threads, all_fail, 3) {
+    CTEST_LOG("before");
+    ASSERT_FAIL();
+    CTEST_LOG("never printed");
+}
+
+CTEST(threads, after) { ASSERT_TRUE(1); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#include "ctest.h"
+
+CTEST_DATA(traced) {
+    int value;
+};
+
+CTEST_SETUP(traced) { data->value = 1; }
+
+CTEST_TEARDOWN(traced) { data->value = 0; }
+
+CTEST2(traced, with_fixture) {
+    CTEST_TRACE_SCOPE("outer \"scope\"");
+    {
+        CTEST_TRACE_SCOPE("inner");
+        ASSERT_EQUAL(1, data->value);
+    }
+}
+
+CTEST(traced, fails_in_scope) {
+    CTEST_TRACE_SCOPE("left by an assertion");
+    ASSERT_FAIL();
+}
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }
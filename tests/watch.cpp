@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CTEST_MAIN
+
+#define CTEST_NO_COLORS
+
+#define CTEST_WATCH_DEBOUNCE_MS 20
+
+#include "ctest.h"
+
+CTEST(watch, stable) {}
+
+// Fails once the file named by WATCH_FLAG exists
+CTEST(watch, flips) {
+    const char* path = getenv("WATCH_FLAG");
+    FILE* flag = path ? fopen(path, "r") : NULL;
+    if (flag) {
+        fclose(flag);
+        ASSERT_FAIL();
+    }
+}
+
+CTEST(watch, always_fails) { ASSERT_FAIL(); }
+
+int main(int argc, const char *argv[]) { return ctest_main(argc, argv); }